@@ -0,0 +1,255 @@
+/*
+ * baseline.c <z64.me>
+ *
+ * comparing benchmark results against a baseline
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "baseline.h"
+
+/* phases timed in milliseconds must also be slower by this many to be
+ * called regressions; those taking a few of them vary by more than the
+ * threshold from run to run */
+#define MIN_SLOWER_MS 2.0
+
+/* fields naming a benchmark, in the order they form its key */
+static const char *keyFields[] = { "rom", "codec", "corpus", "phase" };
+#define KEY_FIELDS (int)(sizeof(keyFields) / sizeof(*keyFields))
+
+/* load a file, terminated so it can be parsed as a string */
+static char *load(const char *fn)
+{
+	FILE *fp = fopen(fn, "rb");
+	char *buf = NULL;
+	long sz;
+
+	if (!fp)
+		return NULL;
+
+	if (!fseek(fp, 0, SEEK_END)
+		&& (sz = ftell(fp)) > 0
+		&& !fseek(fp, 0, SEEK_SET)
+		&& (buf = malloc(sz + 1))
+	)
+	{
+		if (fread(buf, 1, sz, fp) == (size_t)sz)
+			buf[sz] = '\0';
+		else
+		{
+			free(buf);
+			buf = NULL;
+		}
+	}
+
+	fclose(fp);
+
+	return buf;
+}
+
+static const char *skip_space(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		++p;
+
+	return p;
+}
+
+/* parse a string, copying up to dstSz - 1 characters of it to dst;
+ * returns NULL if there isn't one; z64bench never escapes characters */
+static const char *parse_string(const char *p, char *dst, size_t dstSz)
+{
+	size_t n = 0;
+
+	if (*p != '"')
+		return NULL;
+
+	for (++p; *p && *p != '"'; ++p)
+		if (n + 1 < dstSz)
+			dst[n++] = *p;
+	dst[n] = '\0';
+
+	return *p ? p + 1 : NULL;
+}
+
+/* parse one result object, whose values are all strings or numbers;
+ * returns NULL if it's malformed */
+static const char *parse_result(const char *p, struct result *r)
+{
+	char fields[KEY_FIELDS][32] = { { 0 } };
+	int i;
+
+	memset(r, 0, sizeof(*r));
+	r->median = -1;
+
+	for (p = skip_space(p + 1); *p != '}'; p = skip_space(p))
+	{
+		char name[32];
+		char str[32];
+
+		if (!(p = parse_string(p, name, sizeof(name))))
+			return NULL;
+		p = skip_space(p);
+		if (*p++ != ':')
+			return NULL;
+		p = skip_space(p);
+
+		if (*p == '"')
+		{
+			if (!(p = parse_string(p, str, sizeof(str))))
+				return NULL;
+			for (i = 0; i < KEY_FIELDS; ++i)
+				if (!strcmp(name, keyFields[i]))
+					strcpy(fields[i], str);
+		}
+		else
+		{
+			char *end;
+			double v = strtod(p, &end);
+
+			/* null and the like */
+			if (end == p)
+				while (*end >= 'a' && *end <= 'z')
+					++end;
+			if (end == p)
+				return NULL;
+			p = end;
+
+			if (!strcmp(name, "mbps_median"))
+				r->median = v, r->faster = 1;
+			else if (!strcmp(name, "ms_median"))
+				r->median = v, r->faster = 0;
+		}
+
+		p = skip_space(p);
+		if (*p == ',')
+			++p;
+		else if (*p != '}')
+			return NULL;
+	}
+
+	for (i = 0; i < KEY_FIELDS; ++i)
+	{
+		if (!*fields[i])
+			continue;
+		if (*r->key)
+			strcat(r->key, " ");
+		strcat(r->key, fields[i]);
+	}
+
+	return p + 1;
+}
+
+/* load the results in a json file written by z64bench */
+int baseline_load(const char *fn, struct result **results, int *num)
+{
+	char *json = load(fn);
+	const char *p;
+	int cap = 0;
+
+	*results = NULL;
+	*num = 0;
+
+	if (!json)
+		return -1;
+
+	if (!(p = strstr(json, "\"results\"")) || !(p = strchr(p, '[')))
+		goto L_fail;
+
+	for (p = skip_space(p + 1); *p == '{'; p = skip_space(p))
+	{
+		struct result r;
+
+		if (!(p = parse_result(p, &r)))
+			goto L_fail;
+
+		if (*num == cap)
+		{
+			struct result *grown;
+
+			cap = cap ? cap * 2 : 64;
+			if (!(grown = realloc(*results, cap * sizeof(**results))))
+				goto L_fail;
+			*results = grown;
+		}
+
+		if (r.median >= 0)
+			(*results)[(*num)++] = r;
+
+		p = skip_space(p);
+		if (*p == ',')
+			++p;
+	}
+
+	if (!*num)
+		goto L_fail;
+
+	free(json);
+
+	return 0;
+
+L_fail:
+	free(json);
+	free(*results);
+	*results = NULL;
+	*num = 0;
+
+	return -1;
+}
+
+/* compare results against a baseline */
+int baseline_compare(const struct result *base, int numBase, const struct result *cur, int numCur, double threshold)
+{
+	int regressions = 0;
+	int i;
+	int k;
+
+	fprintf(stderr, "%-26s %-12s %-12s %9s\n", "benchmark", "baseline", "current", "slower");
+
+	for (i = 0; i < numCur; ++i)
+	{
+		const struct result *c = &cur[i];
+		const struct result *b = NULL;
+		const char *unit = c->faster ? "MB/s" : "ms";
+		const char *verdict = "";
+		double slower;
+
+		for (k = 0; k < numBase && !b; ++k)
+			if (base[k].faster == c->faster && !strcmp(base[k].key, c->key))
+				b = &base[k];
+
+		if (!b || b->median <= 0 || c->median <= 0)
+		{
+			fprintf(stderr, "%-26s %12s %7.2f %-4s %9s  not in baseline\n"
+				, c->key, "-", c->median, unit, "-"
+			);
+			continue;
+		}
+
+		/* percentage by which the current run takes longer */
+		if (c->faster)
+			slower = (b->median / c->median - 1) * 100;
+		else
+			slower = (c->median / b->median - 1) * 100;
+
+		if (slower > threshold)
+		{
+			if (!c->faster && c->median - b->median < MIN_SLOWER_MS)
+				verdict = "  (too quick to tell)";
+			else
+			{
+				verdict = "  REGRESSION";
+				++regressions;
+			}
+		}
+
+		fprintf(stderr, "%-26s %7.2f %-4s %7.2f %-4s %+8.1f%%%s\n"
+			, c->key, b->median, unit, c->median, unit, slower, verdict
+		);
+	}
+
+	return regressions;
+}
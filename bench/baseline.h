@@ -0,0 +1,25 @@
+#ifndef Z64DECOMPRESS_BENCH_BASELINE_H_INCLUDED
+#define Z64DECOMPRESS_BENCH_BASELINE_H_INCLUDED
+
+/* baselines are results from an earlier run, usually on the same class
+ * of machine; medians slower than these by more than a threshold are
+ * regressions */
+
+/* median of one benchmark */
+struct result
+{
+	char   key[64];   /* e.g. "yaz texture" or "retail yaz decode" */
+	double median;
+	int    faster;    /* non-zero if larger medians are faster   */
+};
+
+/* load the results in a json file written by z64bench; returns
+ * non-zero if it can't be read or contains none */
+int baseline_load(const char *fn, struct result **results, int *num);
+
+/* compare results against a baseline, printing the difference of each
+ * on stderr; returns the number of regressions beyond `threshold`
+ * percent */
+int baseline_compare(const struct result *base, int numBase, const struct result *cur, int numCur, double threshold);
+
+#endif /* Z64DECOMPRESS_BENCH_BASELINE_H_INCLUDED */
@@ -0,0 +1,561 @@
+/*
+ * bench.c <z64.me>
+ *
+ * z64bench: measures how fast libz64decompress decodes each codec, on
+ * generated data compressed with the reference encoders in encode.c;
+ * with --rom, times each phase of decompressing a generated rom instead
+ *
+ * results are written to stdout as json, and summarized on stderr
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "z64decompress.h"
+#include "n64crc.h"
+#include "file.h"
+#include "encode.h"
+#include "corpus.h"
+#include "romgen.h"
+#include "timer.h"
+#include "baseline.h"
+
+/* decompressed roms are written here, then removed */
+#define ROM_TMP "z64bench.tmp"
+
+/* phases of decompressing a rom, as z64decompress does */
+enum phase
+{
+	PHASE_SCAN,      /* locating and parsing dmadata     */
+	PHASE_CALLOC,    /* allocating the decompressed rom  */
+	PHASE_DECODE,    /* decompressing compressed files   */
+	PHASE_MEMCPY,    /* copying uncompressed files       */
+	PHASE_CRC,       /* n64crc()                         */
+	PHASE_WRITE,     /* file_write()                     */
+	PHASE_TOTAL,
+	PHASE_MAX
+};
+
+/* how the benchmarks are run */
+struct options
+{
+	int         runs;     /* timed runs per benchmark        */
+	int         warmup;   /* untimed runs preceding them     */
+	size_t      size;     /* bytes of each generated corpus  */
+	const char *codec;    /* only benchmark this codec       */
+	const char *corpus;   /* only benchmark this corpus      */
+	const char *rom;      /* rom layout, or "all"            */
+	int         files;    /* files in each generated rom     */
+	size_t      fileSz;   /* their average size              */
+	const char *output;   /* write the generated rom here    */
+};
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: z64bench [options]\n"
+		"  -n, --runs N      timed runs per benchmark (default: 20)\n"
+		"  -w, --warmup N    untimed runs before those (default: 3)\n"
+		"  -s, --size N      bytes of data per corpus (default: 1048576)\n"
+		"  -c, --codec NAME  only benchmark this codec\n"
+		"  -k, --corpus NAME only benchmark this kind of data\n"
+		"                    (texture, dlist, code, audio)\n"
+		"  -r, --rom LAYOUT  time decompressing a generated rom instead\n"
+		"                    (retail, ique, dmaext, all); -c picks the\n"
+		"                    codec for retail and dmaext (default: yaz)\n"
+		"  -f, --files N     files per rom (default: 1500)\n"
+		"  -z, --file-size N average size of those (default: 24576)\n"
+		"  -o, --output FILE only write the generated rom to FILE\n"
+		"  -a, --all         run the codec benchmarks and every rom\n"
+		"  -b, --baseline F  compare medians against results in F, and\n"
+		"                    fail if any are slower than the threshold\n"
+		"  -t, --threshold N percentage that is too slow (default: 15)\n"
+	);
+	exit(EXIT_FAILURE);
+}
+
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size);
+
+	if (!p)
+	{
+		fprintf(stderr, "z64bench: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return p;
+}
+
+/* medians measured so far, for comparing against a baseline */
+static struct result *results;
+static int numResults;
+
+/* remember the median of a benchmark named by up to three words */
+static void record(const char *a, const char *b, const char *c, double median, int faster)
+{
+	struct result *r;
+
+	results = realloc(results, (numResults + 1) * sizeof(*results));
+	if (!results)
+	{
+		fprintf(stderr, "z64bench: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	r = &results[numResults++];
+	snprintf(r->key, sizeof(r->key), "%s %s%s%s", a, b, c ? " " : "", c ? c : "");
+	r->median = median;
+	r->faster = faster;
+}
+
+/* json fields describing a set of measurements */
+static void print_stats(const char *unit, const struct stats *s)
+{
+	printf(", \"%s_median\": %.3f, \"%s_mean\": %.3f"
+		", \"%s_min\": %.3f, \"%s_max\": %.3f, \"%s_stddev\": %.3f"
+		", \"%s_variance\": %.3f"
+		, unit, s->median, unit, s->mean
+		, unit, s->min, unit, s->max, unit, s->stddev
+		, unit, s->stddev * s->stddev
+	);
+}
+
+/* decode a file with a stream, given `chunk` bytes of it at a time, into
+ * a buffer of exactly its decompressed size (returns Z64DEC_*) */
+static int stream_decode(const unsigned char *comp, size_t compSz, unsigned char *dec, size_t size, size_t chunk)
+{
+	z64dec_stream *stream;
+	size_t inDone = 0;
+	size_t outDone = 0;
+	int err;
+
+	if ((err = z64dec_stream_open(&stream, Z64DEC_CODEC_AUTO, 0)))
+		return err;
+
+	do
+	{
+		size_t n = compSz - inDone < chunk ? compSz - inDone : chunk;
+		size_t in;
+		size_t out;
+
+		err = z64dec_stream_decode(stream, comp + inDone, n, &in, dec + outDone, size - outDone, &out);
+		inDone += in;
+		outDone += out;
+
+		/* a stream that makes no progress would never finish */
+		if (err == Z64DEC_MORE && !in && !out)
+			err = Z64DEC_ERR_DATA;
+	} while (err == Z64DEC_MORE);
+	z64dec_stream_close(stream);
+
+	if (!err && outDone != size)
+		err = Z64DEC_ERR_DATA;
+
+	return err;
+}
+
+/* time `opt->runs` decodes of one compressed corpus */
+static int bench_one(const struct options *opt, const char *codec, enum corpus kind, int first)
+{
+	size_t size = opt->size;
+	unsigned char *raw = xmalloc(size);
+	unsigned char *comp = xmalloc(encode_bound(size));
+	unsigned char *dec = xmalloc(size);
+	double *rate = xmalloc(sizeof(*rate) * opt->runs);
+	double *cpb = xmalloc(sizeof(*cpb) * opt->runs);
+	struct stats mbps;
+	struct stats cycles;
+	size_t compSz;
+	size_t decSz;
+	int hasCycles = timer_cycles() != 0;
+	int err;
+	int i;
+
+	corpus_generate(kind, raw, size, 0x64 + kind);
+	compSz = encoder_from_name(codec)(raw, size, comp);
+
+	/* the reference encoders are only useful if they round-trip */
+	err = z64dec_file(comp, compSz, dec, size, &decSz, Z64DEC_CODEC_AUTO);
+	if (err || decSz != size || memcmp(raw, dec, size))
+	{
+		fprintf(stderr, "z64bench: %s %s does not round-trip: %s\n"
+			, codec, corpus_name(kind), err ? z64dec_strerror(err) : "data differs"
+		);
+		return EXIT_FAILURE;
+	}
+
+	/* so must streams, fed a little at a time, into no more room than
+	 * the file needs */
+	for (i = 1; i <= 4096; i *= 8)
+	{
+		memset(dec, 0, size);
+		err = stream_decode(comp, compSz, dec, size, i);
+		if (err || memcmp(raw, dec, size))
+		{
+			fprintf(stderr, "z64bench: %s %s stream does not round-trip in %d-byte chunks: %s\n"
+				, codec, corpus_name(kind), i, err ? z64dec_strerror(err) : "data differs"
+			);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = -opt->warmup; i < opt->runs; ++i)
+	{
+		double t = timer_seconds();
+		unsigned long long c = timer_cycles();
+
+		z64dec_file(comp, compSz, dec, size, &decSz, Z64DEC_CODEC_AUTO);
+
+		c = timer_cycles() - c;
+		t = timer_seconds() - t;
+
+		if (i < 0)
+			continue;
+
+		rate[i] = size / (t * 1e6);
+		cpb[i] = (double)c / size;
+	}
+
+	stats_compute(&mbps, rate, opt->runs);
+	stats_compute(&cycles, cpb, opt->runs);
+
+	printf("%s\n    {\"codec\": \"%s\", \"corpus\": \"%s\", \"size\": %lu, \"compressed\": %lu"
+		", \"runs\": %d"
+		, first ? "" : ","
+		, codec, corpus_name(kind), (unsigned long)size, (unsigned long)compSz
+		, opt->runs
+	);
+	print_stats("mbps", &mbps);
+	record(codec, corpus_name(kind), NULL, mbps.median, 1);
+	printf(", \"cycles_per_byte\": ");
+	if (hasCycles)
+		printf("%.3f}", cycles.median);
+	else
+		printf("null}");
+
+	fprintf(stderr, "%-6s %-8s %6.1f%%  %9.2f MB/s  +/- %6.2f", codec, corpus_name(kind)
+		, compSz * 100.0 / size, mbps.median, mbps.stddev
+	);
+	if (hasCycles)
+		fprintf(stderr, "  %6.2f cycles/byte", cycles.median);
+	fprintf(stderr, "\n");
+
+	free(raw);
+	free(comp);
+	free(dec);
+	free(rate);
+	free(cpb);
+
+	return EXIT_SUCCESS;
+}
+
+/* decompress a rom the way z64decompress does, adding the time spent in
+ * each phase to t[]; returns the decompressed rom */
+static unsigned char *rom_run(const struct romgen_rom *gen, const struct z64dec_options *options, double t[PHASE_MAX], size_t *decSz)
+{
+	struct z64dec_info info;
+	z64dec_rom *rom;
+	unsigned char *dec;
+	double start = timer_seconds();
+	double now;
+	int i;
+
+	if (z64dec_rom_open(&rom, gen->rom, gen->romSz, options))
+		return NULL;
+	now = timer_seconds();
+	t[PHASE_SCAN] += now - start;
+
+	z64dec_rom_info(rom, &info);
+	dec = calloc(info.size, 1);
+	t[PHASE_CALLOC] += timer_seconds() - now;
+	if (!dec)
+	{
+		z64dec_rom_close(rom);
+		return NULL;
+	}
+
+	/* files are timed one at a time, to tell decompressing from copying */
+	for (i = 0; i < info.entries; ++i)
+	{
+		struct z64dec_entry e;
+		double ft;
+
+		if (z64dec_rom_entry(rom, i, &e) || !e.valid)
+			continue;
+
+		ft = timer_seconds();
+		if (e.vstart > info.size
+			|| z64dec_rom_decode_entry(rom, i, dec + e.vstart, info.size - e.vstart, NULL)
+		)
+		{
+			free(dec);
+			z64dec_rom_close(rom);
+			return NULL;
+		}
+		t[e.compressed ? PHASE_DECODE : PHASE_MEMCPY] += timer_seconds() - ft;
+	}
+
+	now = timer_seconds();
+	n64crc(dec);
+	t[PHASE_CRC] += timer_seconds() - now;
+
+	now = timer_seconds();
+	file_write(ROM_TMP, dec, info.size);
+	t[PHASE_WRITE] += timer_seconds() - now;
+
+	z64dec_rom_close(rom);
+	t[PHASE_TOTAL] += timer_seconds() - start;
+	*decSz = info.size;
+
+	return dec;
+}
+
+/* time each phase of decompressing a generated rom `opt->runs` times */
+static int bench_rom(const struct options *opt, enum romgen_layout layout, int first)
+{
+	static const char *phases[PHASE_MAX] = {
+		[PHASE_SCAN]   = "scan",
+		[PHASE_CALLOC] = "calloc",
+		[PHASE_DECODE] = "decode",
+		[PHASE_MEMCPY] = "memcpy",
+		[PHASE_CRC]    = "n64crc",
+		[PHASE_WRITE]  = "write",
+		[PHASE_TOTAL]  = "total",
+	};
+	const char *codec = layout == ROMGEN_IQUE ? "zlib" : opt->codec ? opt->codec : "yaz";
+	struct romgen cfg = { layout, opt->files, opt->fileSz, encoder_from_name(codec), 0x64 + layout };
+	struct z64dec_options options = { Z64DEC_CODEC_AUTO, 0, 0 };
+	struct romgen_rom gen;
+	double *ms[PHASE_MAX];
+	unsigned char *dec;
+	size_t decSz = 0;
+	int i;
+	int p;
+
+	if (romgen_build(&cfg, &gen))
+	{
+		fprintf(stderr, "z64bench: out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	if (opt->output)
+	{
+		file_write(opt->output, gen.rom, gen.romSz);
+		fprintf(stderr, "%s rom with %d dma entries written to '%s'\n"
+			, romgen_name(layout), gen.entries, opt->output
+		);
+		romgen_free(&gen);
+		return EXIT_SUCCESS;
+	}
+
+	/* dmaext can't be detected, so it needs to be told everything */
+	if (layout == ROMGEN_DMAEXT)
+	{
+		options.dmaext = 1;
+		options.codec = z64dec_codec_from_name(codec);
+	}
+
+	for (p = 0; p < PHASE_MAX; ++p)
+		ms[p] = xmalloc(sizeof(**ms) * opt->runs);
+
+	for (i = -opt->warmup; i < opt->runs; ++i)
+	{
+		double t[PHASE_MAX] = { 0 };
+
+		dec = rom_run(&gen, &options, t, &decSz);
+
+		/* the generator is only useful if its roms decompress to what
+		 * it expects */
+		if (!dec || decSz != gen.decSz || memcmp(dec, gen.dec, decSz))
+		{
+			fprintf(stderr, "z64bench: %s rom does not decompress correctly\n", romgen_name(layout));
+			remove(ROM_TMP);
+			return EXIT_FAILURE;
+		}
+		free(dec);
+
+		if (i < 0)
+			continue;
+
+		for (p = 0; p < PHASE_MAX; ++p)
+			ms[p][i] = t[p] * 1e3;
+	}
+	remove(ROM_TMP);
+
+	for (p = 0; p < PHASE_MAX; ++p)
+	{
+		struct stats st;
+
+		stats_compute(&st, ms[p], opt->runs);
+
+		printf("%s\n    {\"rom\": \"%s\", \"codec\": \"%s\", \"phase\": \"%s\""
+			", \"entries\": %d, \"size\": %lu, \"compressed\": %lu, \"runs\": %d"
+			, first && !p ? "" : ","
+			, romgen_name(layout), codec, phases[p]
+			, gen.entries, (unsigned long)gen.decSz, (unsigned long)gen.romSz, opt->runs
+		);
+		print_stats("ms", &st);
+		record(romgen_name(layout), codec, phases[p], st.median, 0);
+		printf("}");
+
+		fprintf(stderr, "%-6s %-6s %-8s %9.3f ms  +/- %7.3f\n"
+			, romgen_name(layout), codec, phases[p], st.median, st.stddev
+		);
+
+		free(ms[p]);
+	}
+
+	romgen_free(&gen);
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *codecs[] = { "yaz", "lzo", "ucl", "aplib", "zlib" };
+	struct options opt = { 20, 3, 1024 * 1024, NULL, NULL, NULL, 1500, 24576, NULL };
+	const char *baseline = NULL;
+	double threshold = 15;
+	int all = 0;
+	int doCodecs;
+	int doRoms;
+	int first = 1;
+	int i;
+	int k;
+
+	for (i = 1; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (!strcmp(arg, "-a") || !strcmp(arg, "--all"))
+		{
+			all = 1;
+			continue;
+		}
+
+		if (!val)
+			usage();
+
+		if (!strcmp(arg, "-n") || !strcmp(arg, "--runs"))
+			opt.runs = atoi(val);
+		else if (!strcmp(arg, "-w") || !strcmp(arg, "--warmup"))
+			opt.warmup = atoi(val);
+		else if (!strcmp(arg, "-s") || !strcmp(arg, "--size"))
+			opt.size = strtoul(val, NULL, 0);
+		else if (!strcmp(arg, "-c") || !strcmp(arg, "--codec"))
+			opt.codec = val;
+		else if (!strcmp(arg, "-k") || !strcmp(arg, "--corpus"))
+			opt.corpus = val;
+		else if (!strcmp(arg, "-r") || !strcmp(arg, "--rom"))
+			opt.rom = val;
+		else if (!strcmp(arg, "-f") || !strcmp(arg, "--files"))
+			opt.files = atoi(val);
+		else if (!strcmp(arg, "-z") || !strcmp(arg, "--file-size"))
+			opt.fileSz = strtoul(val, NULL, 0);
+		else if (!strcmp(arg, "-o") || !strcmp(arg, "--output"))
+			opt.output = val;
+		else if (!strcmp(arg, "-b") || !strcmp(arg, "--baseline"))
+			baseline = val;
+		else if (!strcmp(arg, "-t") || !strcmp(arg, "--threshold"))
+			threshold = atof(val);
+		else
+			usage();
+		++i;
+	}
+
+	/* --rom alone only benchmarks roms */
+	doCodecs = all || !opt.rom;
+	doRoms = all || opt.rom;
+	if (!opt.rom)
+		opt.rom = "all";
+
+	if (opt.runs < 1 || opt.warmup < 0 || opt.size < 1024 || threshold < 0)
+		usage();
+
+	if (opt.codec && !encoder_from_name(opt.codec))
+		usage();
+
+	if (doRoms && (opt.files < 1 || opt.fileSz < 16
+		|| (opt.output && (doCodecs || !strcmp(opt.rom, "all"))))
+	)
+		usage();
+
+	if (opt.output)
+	{
+		for (k = 0; k < ROMGEN_MAX; ++k)
+			if (!strcmp(opt.rom, romgen_name(k)))
+				return bench_rom(&opt, k, 1);
+		usage();
+	}
+
+	printf("{\n  \"benchmark\": \"%s\",\n  \"results\": ["
+		, doCodecs && doRoms ? "all" : doRoms ? "rom" : "codec"
+	);
+
+	for (i = 0; doCodecs && i < (int)(sizeof(codecs) / sizeof(*codecs)); ++i)
+	{
+		if (opt.codec && strcmp(opt.codec, codecs[i]))
+			continue;
+
+		for (k = 0; k < CORPUS_MAX; ++k)
+		{
+			if (opt.corpus && strcmp(opt.corpus, corpus_name(k)))
+				continue;
+
+			if (bench_one(&opt, codecs[i], k, first))
+				return EXIT_FAILURE;
+			first = 0;
+		}
+	}
+
+	for (k = 0; doRoms && k < ROMGEN_MAX; ++k)
+	{
+		if (strcmp(opt.rom, "all") && strcmp(opt.rom, romgen_name(k)))
+			continue;
+
+		if (bench_rom(&opt, k, first))
+			return EXIT_FAILURE;
+		first = 0;
+	}
+
+	printf("\n  ]\n}\n");
+
+	if (first)
+		usage();
+
+	/* compare what was measured against an earlier run */
+	if (baseline)
+	{
+		struct result *base;
+		int numBase;
+		int regressions;
+
+		fflush(stdout);
+		if (baseline_load(baseline, &base, &numBase))
+		{
+			fprintf(stderr, "z64bench: failed to load baseline '%s'\n", baseline);
+			return EXIT_FAILURE;
+		}
+
+		fprintf(stderr, "\ncompared to '%s' (threshold %.1f%%):\n", baseline, threshold);
+		regressions = baseline_compare(base, numBase, results, numResults, threshold);
+		free(base);
+
+		if (regressions)
+		{
+			fprintf(stderr, "%d benchmark%s slowed down by more than %.1f%%\n"
+				, regressions, regressions == 1 ? "" : "s", threshold
+			);
+			return EXIT_FAILURE;
+		}
+		fprintf(stderr, "no regressions\n");
+	}
+
+	free(results);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,270 @@
+/*
+ * corpus.c <z64.me>
+ *
+ * generates data resembling what zelda 64 roms compress, so the codecs
+ * can be benchmarked without distributing copyrighted files
+ *
+ */
+
+#include <string.h>
+
+#include "corpus.h"
+
+/* bytes being generated; writes past the end are dropped */
+struct cursor
+{
+	unsigned char *p;
+	unsigned char *end;
+	unsigned       seed;
+};
+
+/* xorshift32 */
+unsigned corpus_rand(unsigned *seed)
+{
+	unsigned x = *seed ? *seed : 0x9E3779B9;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *seed = x;
+}
+
+/* random number in [0, n) */
+static unsigned rnd(struct cursor *c, unsigned n)
+{
+	return corpus_rand(&c->seed) % n;
+}
+
+static void put8(struct cursor *c, unsigned v)
+{
+	if (c->p < c->end)
+		*c->p++ = v;
+}
+
+static void put16(struct cursor *c, unsigned v)
+{
+	put8(c, v >> 8);
+	put8(c, v);
+}
+
+static void put32(struct cursor *c, unsigned v)
+{
+	put16(c, v >> 16);
+	put16(c, v);
+}
+
+static int clamp(int v, int lo, int hi)
+{
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* images: smooth gradients with a little noise, in the formats the
+ * games use most; ci8 images are preceded by their palette */
+static void texture(struct cursor *c)
+{
+	int w = 16 << rnd(c, 3);
+	int h = 16 << rnd(c, 3);
+	int noise = rnd(c, 3);
+	int x, y;
+
+	switch (rnd(c, 3))
+	{
+		case 0: /* rgba16 */
+		{
+			int r0 = rnd(c, 32), g0 = rnd(c, 32), b0 = rnd(c, 32);
+
+			for (y = 0; y < h; ++y)
+				for (x = 0; x < w; ++x)
+				{
+					int n = rnd(c, 2) ? 0 : (int)rnd(c, noise * 2 + 1) - noise;
+					int r = clamp(r0 + x * 8 / w + n, 0, 31);
+					int g = clamp(g0 + y * 8 / h + n, 0, 31);
+					int b = clamp(b0 + (x + y) * 4 / (w + h) + n, 0, 31);
+
+					put16(c, r << 11 | g << 6 | b << 1 | 1);
+				}
+			break;
+		}
+
+		case 1: /* i4 */
+			for (y = 0; y < h; ++y)
+				for (x = 0; x < w; x += 2)
+				{
+					int a = clamp(x * 16 / w + (int)rnd(c, noise + 1), 0, 15);
+					int b = clamp((x + 1) * 16 / w + (int)rnd(c, noise + 1), 0, 15);
+
+					put8(c, a << 4 | b);
+				}
+			break;
+
+		case 2: /* ci8, with a 256-color rgba16 palette */
+			for (x = 0; x < 256; ++x)
+				put16(c, (x * 0x0841 & 0xFFFE) | 1);
+			for (y = 0; y < h; ++y)
+				for (x = 0; x < w; ++x)
+					put8(c, clamp((x + y) * 64 / (w + h) + (int)rnd(c, noise + 1), 0, 255));
+			break;
+	}
+}
+
+/* an f3dex2 mesh: a vertex buffer, then the display list drawing it */
+static void dlist(struct cursor *c)
+{
+	int nvtx = 8 + rnd(c, 24);
+	int ntri = nvtx + rnd(c, nvtx);
+	unsigned segment = 0x06000000 | (rnd(c, 0x4000) << 4);
+	int i;
+
+	/* vertices: position, flag, texture coordinates, color or normal;
+	 * meshes are built on a grid, so coordinates repeat a lot */
+	for (i = 0; i < nvtx; ++i)
+	{
+		put16(c, (rnd(c, 16) * 50 - 400) & 0xFFFF);
+		put16(c, (rnd(c, 8) * 50) & 0xFFFF);
+		put16(c, (rnd(c, 16) * 50 - 400) & 0xFFFF);
+		put16(c, 0);
+		put16(c, rnd(c, 8) << 9);
+		put16(c, rnd(c, 8) << 9);
+		put32(c, rnd(c, 4) ? 0xFFFFFFFF : (0x808080 + rnd(c, 0x10) * 0x10101) << 8 | 0xFF);
+	}
+
+	/* material setup */
+	put32(c, 0xE7000000); put32(c, 0x00000000);                      /* gsDPPipeSync        */
+	put32(c, 0xFD100000); put32(c, 0x06000000 | rnd(c, 0x8000) * 8); /* gsDPSetTextureImage */
+	put32(c, 0xF5100000); put32(c, 0x07000000 | rnd(c, 16) << 14);   /* gsDPSetTile         */
+	put32(c, 0xE6000000); put32(c, 0x00000000);                      /* gsDPLoadSync        */
+	put32(c, 0xF3000000); put32(c, 0x073FF100);                      /* gsDPLoadBlock       */
+	put32(c, 0xFC127E03); put32(c, 0xFFFFF3F8);                      /* gsDPSetCombineLERP  */
+	put32(c, 0xD9F3FFFF); put32(c, 0x00000000);                      /* gsSPGeometryMode    */
+
+	/* load vertices, then draw triangles indexing them */
+	put32(c, 0x01000000 | nvtx << 12 | nvtx * 2); put32(c, segment);
+	for (i = 0; i + 1 < ntri; i += 2)
+	{
+		int v = rnd(c, nvtx - 2);
+
+		put32(c, 0x06000000 | v * 2 << 16 | (v + 1) * 2 << 8 | (v + 2) * 2);
+		v = rnd(c, nvtx - 2);
+		put32(c, v * 2 << 16 | (v + 2) * 2 << 8 | (v + 1) * 2);
+	}
+	put32(c, 0xDF000000); put32(c, 0x00000000);                      /* gsSPEndDisplayList  */
+}
+
+/* mips: functions built from common instructions, favoring a few
+ * registers, followed by some rodata */
+static void code(struct cursor *c)
+{
+	static const unsigned char regs[] = { 2, 4, 5, 6, 16, 17, 18, 31 };
+	int frame = 0x18 + rnd(c, 8) * 8;
+	int len = 8 + rnd(c, 64);
+	int i;
+
+	put32(c, 0x27BD0000 | (-frame & 0xFFFF));           /* addiu sp, sp, -frame */
+	put32(c, 0xAFBF0000 | (frame - 4));                 /* sw    ra, frame-4(sp) */
+
+	for (i = 0; i < len; ++i)
+	{
+		unsigned rs = regs[rnd(c, sizeof(regs))];
+		unsigned rt = regs[rnd(c, sizeof(regs))];
+		unsigned imm = rnd(c, 8) ? rnd(c, 0x20) * 4 : rnd(c, 0x10000);
+
+		switch (rnd(c, 10))
+		{
+			case 0: put32(c, 0x3C000000 | rt << 16 | 0x8010 | rnd(c, 8)); break;   /* lui   */
+			case 1: put32(c, 0x8C000000 | rs << 21 | rt << 16 | imm); break;        /* lw    */
+			case 2: put32(c, 0xAC000000 | rs << 21 | rt << 16 | imm); break;        /* sw    */
+			case 3: put32(c, 0x24000000 | rs << 21 | rt << 16 | imm); break;        /* addiu */
+			case 4: put32(c, 0x0C000000 | (0x80000 + rnd(c, 0x100) * 0x40)); break; /* jal   */
+			case 5: put32(c, 0x00000000); break;                                    /* nop   */
+			case 6: put32(c, 0x14000000 | rs << 21 | rt << 16 | rnd(c, 32)); break; /* bne   */
+			case 7: put32(c, 0x00000021 | rs << 21 | rt << 16 | 2 << 11); break;    /* addu  */
+			case 8: /* lwc1 */
+				put32(c, 0xC4000000 | rs << 21 | rnd(c, 16) * 2 << 16 | imm);
+				break;
+			case 9: /* add.s, sub.s, mul.s, div.s */
+				put32(c, 0x46000000 | rnd(c, 16) << 11 | rnd(c, 16) << 6 | rnd(c, 4));
+				break;
+		}
+	}
+
+	put32(c, 0x8FBF0000 | (frame - 4));                 /* lw    ra, frame-4(sp) */
+	put32(c, 0x03E00008);                               /* jr    ra */
+	put32(c, 0x27BD0000 | frame);                       /* addiu sp, sp, frame */
+
+	/* rodata: floats and jump tables */
+	if (!rnd(c, 4))
+	{
+		for (i = rnd(c, 8); i; --i)
+			put32(c, 0x3F000000 + (rnd(c, 0x100) << 16));
+		for (i = rnd(c, 8); i; --i)
+			put32(c, 0x80800000 + rnd(c, 0x1000) * 4);
+	}
+}
+
+/* vadpcm: 9-byte frames of a header and sixteen 4-bit samples of a
+ * noisy waveform, with the occasional stretch of silence */
+static void audio(struct cursor *c)
+{
+	int frames = 64 + rnd(c, 256);
+	int level = 0;
+	int i, j;
+
+	if (!rnd(c, 8))
+	{
+		for (i = 0; i < frames * 9; ++i)
+			put8(c, 0);
+		return;
+	}
+
+	for (i = 0; i < frames; ++i)
+	{
+		put8(c, rnd(c, 12) << 4 | rnd(c, 2));
+		for (j = 0; j < 8; ++j)
+		{
+			int a, b;
+
+			level = clamp(level + (int)rnd(c, 7) - 3, -8, 7);
+			a = level & 15;
+			level = clamp(level + (int)rnd(c, 7) - 3, -8, 7);
+			b = level & 15;
+			put8(c, a << 4 | b);
+		}
+	}
+}
+
+/* name of a kind of data */
+const char *corpus_name(enum corpus kind)
+{
+	static const char *names[CORPUS_MAX] = {
+		[CORPUS_TEXTURE] = "texture",
+		[CORPUS_DLIST]   = "dlist",
+		[CORPUS_CODE]    = "code",
+		[CORPUS_AUDIO]   = "audio",
+	};
+
+	if (kind >= CORPUS_MAX)
+		return "none";
+
+	return names[kind];
+}
+
+/* fill dst with `size` bytes resembling a kind of data */
+void corpus_generate(enum corpus kind, unsigned char *dst, size_t size, unsigned seed)
+{
+	struct cursor c = { dst, dst + size, seed };
+
+	while (c.p < c.end)
+	{
+		switch (kind)
+		{
+			case CORPUS_TEXTURE: texture(&c); break;
+			case CORPUS_DLIST:   dlist(&c);   break;
+			case CORPUS_CODE:    code(&c);    break;
+			case CORPUS_AUDIO:   audio(&c);   break;
+			default:
+				memset(c.p, 0, c.end - c.p);
+				return;
+		}
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef Z64DECOMPRESS_BENCH_CORPUS_H_INCLUDED
+#define Z64DECOMPRESS_BENCH_CORPUS_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+/* kinds of data found in zelda 64 roms */
+enum corpus
+{
+	CORPUS_TEXTURE,  /* rgba16, i4, and ci8 images       */
+	CORPUS_DLIST,    /* f3dex2 display lists and vertices */
+	CORPUS_CODE,     /* mips code and rodata              */
+	CORPUS_AUDIO,    /* vadpcm sample frames              */
+	CORPUS_MAX
+};
+
+/* name of a kind of data ("texture", "dlist", "code", "audio") */
+const char *corpus_name(enum corpus kind);
+
+/* fill dst with `size` bytes resembling a kind of data; the same seed
+ * always generates the same bytes */
+void corpus_generate(enum corpus kind, unsigned char *dst, size_t size, unsigned seed);
+
+/* pseudo-random number generator shared by the benchmark generators */
+unsigned corpus_rand(unsigned *seed);
+
+#endif /* Z64DECOMPRESS_BENCH_CORPUS_H_INCLUDED */
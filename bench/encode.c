@@ -0,0 +1,641 @@
+/*
+ * encode.c <z64.me>
+ *
+ * greedy reference encoders for the benchmarks; they favor simplicity
+ * over compression ratio, but produce the same kinds of streams (and use
+ * the same features of each format) as z64compress does
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "encode.h"
+
+/* the matcher finds back references using hash chains of 3-byte prefixes */
+#define HASH_BITS  15
+#define MIN_MATCH  3
+#define MAX_CHAIN  48  /* candidates examined per position */
+
+struct matcher
+{
+	const unsigned char *src;
+	size_t               srcSz;
+	size_t               window;  /* most distant back reference */
+	int                 *head;    /* most recent position per hash */
+	int                 *prev;    /* previous position, same hash */
+};
+
+static unsigned hash3(const unsigned char *p)
+{
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void matcher_init(struct matcher *m, const unsigned char *src, size_t srcSz, size_t window)
+{
+	m->src = src;
+	m->srcSz = srcSz;
+	m->window = window;
+	m->head = malloc(sizeof(*m->head) << HASH_BITS);
+	m->prev = malloc(sizeof(*m->prev) * (srcSz + 1));
+	memset(m->head, -1, sizeof(*m->head) << HASH_BITS);
+}
+
+static void matcher_free(struct matcher *m)
+{
+	free(m->head);
+	free(m->prev);
+}
+
+/* make position i available to later matches */
+static void matcher_insert(struct matcher *m, size_t i)
+{
+	unsigned h;
+
+	if (i + MIN_MATCH > m->srcSz)
+		return;
+
+	h = hash3(m->src + i);
+	m->prev[i] = m->head[h];
+	m->head[h] = i;
+}
+
+/* insert the `len` positions starting at *i, advancing *i past them */
+static void matcher_skip(struct matcher *m, size_t *i, unsigned len)
+{
+	while (len--)
+		matcher_insert(m, (*i)++);
+}
+
+/* find the longest match at position i, no longer than maxLen;
+ * returns its length (0 if none), and its distance in *dist */
+static unsigned matcher_find(struct matcher *m, size_t i, unsigned maxLen, unsigned *dist)
+{
+	const unsigned char *src = m->src;
+	unsigned best = 0;
+	int chain = MAX_CHAIN;
+	int c;
+
+	if (i + MIN_MATCH > m->srcSz)
+		return 0;
+
+	if (maxLen > m->srcSz - i)
+		maxLen = m->srcSz - i;
+
+	for (c = m->head[hash3(src + i)]; c >= 0 && chain--; c = m->prev[c])
+	{
+		unsigned len = 0;
+
+		if (i - c > m->window)
+			break;
+
+		while (len < maxLen && src[c + len] == src[i + len])
+			++len;
+
+		if (len > best)
+		{
+			best = len;
+			*dist = i - c;
+			if (len == maxLen)
+				break;
+		}
+	}
+
+	return best;
+}
+
+/* write u32 as big-endian bytes */
+static void wbeU32(unsigned char *b, unsigned v)
+{
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >>  8;
+	b[3] = v;
+}
+
+/* write a z64compress header, returning a pointer past it */
+static unsigned char *header(unsigned char *dst, const char *magic, size_t srcSz)
+{
+	memcpy(dst, magic, 4);
+	wbeU32(dst + 4, srcSz);
+
+	return dst + 8;
+}
+
+/* most bytes an encoder can write for srcSz bytes of input */
+size_t encode_bound(size_t srcSz)
+{
+	return srcSz + srcSz / 4 + 64;
+}
+
+/* yaz: a code byte flags each of the next eight items as a literal
+ * byte or a two or three byte back reference */
+size_t yazenc(const unsigned char *src, size_t srcSz, unsigned char *dst)
+{
+	struct matcher m;
+	unsigned char *out = header(dst, "Yaz0", srcSz);
+	unsigned char *code = NULL;
+	unsigned bit = 8;
+	size_t i = 0;
+
+	/* yaz headers are padded to 16 bytes */
+	memset(out, 0, 8);
+	out += 8;
+
+	matcher_init(&m, src, srcSz, 0x1000);
+
+	while (i < srcSz)
+	{
+		unsigned dist = 0;
+		unsigned len;
+
+		if (bit == 8)
+		{
+			code = out++;
+			*code = 0;
+			bit = 0;
+		}
+
+		len = matcher_find(&m, i, 0x111, &dist);
+
+		if (len >= 3)
+		{
+			if (len >= 0x12)
+			{
+				*out++ = (dist - 1) >> 8;
+				*out++ = dist - 1;
+				*out++ = len - 0x12;
+			}
+			else
+			{
+				*out++ = ((len - 2) << 4) | ((dist - 1) >> 8);
+				*out++ = dist - 1;
+			}
+			matcher_skip(&m, &i, len);
+		}
+		else
+		{
+			*code |= 0x80 >> bit;
+			*out++ = src[i];
+			matcher_skip(&m, &i, 1);
+		}
+
+		++bit;
+	}
+
+	matcher_free(&m);
+
+	return out - dst;
+}
+
+/* lzo1x: write a length that doesn't fit in a `bits`-bit field of the
+ * instruction byte `op` as zero bytes followed by the remainder */
+static unsigned char *lzo_length(unsigned char *out, unsigned len, unsigned bits, unsigned char op)
+{
+	unsigned max = (1u << bits) - 1;
+
+	if (len <= max)
+	{
+		*out++ = op | len;
+		return out;
+	}
+
+	*out++ = op;
+	len -= max;
+	while (len > 255)
+	{
+		*out++ = 0;
+		len -= 255;
+	}
+	*out++ = len;
+
+	return out;
+}
+
+/* lzo1x: literal runs and M2/M3/M4 matches, as produced by lzo1x_1 */
+size_t lzoenc(const unsigned char *src, size_t srcSz, unsigned char *dst)
+{
+	struct matcher m;
+	unsigned char *out = header(dst, "LZO0", srcSz);
+	unsigned char *state = NULL; /* counts literals following a match */
+	size_t lit = 0;
+	size_t i = 0;
+	int first = 1;
+
+	matcher_init(&m, src, srcSz, 0xBFFF);
+
+	for (;;)
+	{
+		unsigned dist = 0;
+		unsigned len = 0;
+
+		if (i < srcSz)
+		{
+			len = matcher_find(&m, i, 0x1000, &dist);
+			if (len < 3)
+			{
+				matcher_skip(&m, &i, 1);
+				++lit;
+				continue;
+			}
+		}
+
+		/* flush pending literals, src[i - lit, i) */
+		if (lit)
+		{
+			if (first && lit <= 238)
+				*out++ = 17 + lit;
+			else if (lit <= 3)
+				*state |= lit;
+			else
+			{
+				size_t t = lit - 3;
+
+				if (t <= 15)
+					*out++ = t;
+				else
+				{
+					*out++ = 0;
+					t -= 15;
+					while (t > 255)
+					{
+						*out++ = 0;
+						t -= 255;
+					}
+					*out++ = t;
+				}
+			}
+			memcpy(out, src + i - lit, lit);
+			out += lit;
+			lit = 0;
+		}
+		first = 0;
+
+		if (i >= srcSz)
+			break;
+
+		/* M2: short and near */
+		if (dist <= 0x800 && len <= 8)
+		{
+			*out = ((len - 1) << 5) | (((dist - 1) & 7) << 2);
+			state = out++;
+			*out++ = (dist - 1) >> 3;
+		}
+		/* M3 */
+		else if (dist <= 0x4000)
+		{
+			out = lzo_length(out, len - 2, 5, 32);
+			*out = ((dist - 1) & 63) << 2;
+			state = out++;
+			*out++ = (dist - 1) >> 6;
+		}
+		/* M4: distant */
+		else
+		{
+			unsigned d = dist - 0x4000;
+
+			out = lzo_length(out, len - 2, 3, 16 | ((d & 0x4000) >> 11));
+			*out = (d & 63) << 2;
+			state = out++;
+			*out++ = d >> 6;
+		}
+
+		matcher_skip(&m, &i, len);
+	}
+
+	/* end of stream: M4 with a distance of zero */
+	*out++ = 0x11;
+	*out++ = 0;
+	*out++ = 0;
+
+	matcher_free(&m);
+
+	return out - dst;
+}
+
+/* ucl and aplib interleave tag bytes holding bits, most significant
+ * first, with whole bytes; a tag byte is reserved where it is needed */
+struct bitwriter
+{
+	unsigned char *out;
+	unsigned char *tag;
+	int            bits;  /* bits left in *tag */
+};
+
+static void put_bit(struct bitwriter *bw, int bit)
+{
+	if (!bw->bits)
+	{
+		bw->tag = bw->out++;
+		*bw->tag = 0;
+		bw->bits = 8;
+	}
+
+	if (bit)
+		*bw->tag |= 1 << (bw->bits - 1);
+	--bw->bits;
+}
+
+static void put_byte(struct bitwriter *bw, unsigned char byte)
+{
+	*bw->out++ = byte;
+}
+
+/* the bits of v (>= 2) after its leading one, each followed by a bit
+ * that is set after the last one (ucl) or while more follow (aplib) */
+static void put_gamma(struct bitwriter *bw, unsigned v, int moreFollow)
+{
+	int k = 31;
+
+	while (!(v >> k))
+		--k;
+
+	while (k--)
+	{
+		put_bit(bw, (v >> k) & 1);
+		put_bit(bw, moreFollow ? k != 0 : k == 0);
+	}
+}
+
+/* ucl nrv2b */
+size_t uclenc(const unsigned char *src, size_t srcSz, unsigned char *dst)
+{
+	struct bitwriter bw = { header(dst, "UCL0", srcSz), NULL, 0 };
+	struct matcher m;
+	unsigned last = 1;
+	size_t i = 0;
+
+	matcher_init(&m, src, srcSz, 0xFFFFFF);
+
+	while (i < srcSz)
+	{
+		unsigned dist = 0;
+		unsigned len = matcher_find(&m, i, 0x10000, &dist);
+		unsigned code;
+
+		/* distant matches must be at least four bytes long */
+		if (len < 3 || (dist > 0xd00 && len < 4))
+		{
+			put_bit(&bw, 1);
+			put_byte(&bw, src[i]);
+			matcher_skip(&m, &i, 1);
+			continue;
+		}
+
+		put_bit(&bw, 0);
+		if (dist == last)
+			put_gamma(&bw, 2, 0);
+		else
+		{
+			put_gamma(&bw, ((dist - 1) >> 8) + 3, 0);
+			put_byte(&bw, dist - 1);
+			last = dist;
+		}
+
+		code = len - 1 - (dist > 0xd00);
+		if (code <= 3)
+		{
+			put_bit(&bw, code >> 1);
+			put_bit(&bw, code & 1);
+		}
+		else
+		{
+			put_bit(&bw, 0);
+			put_bit(&bw, 0);
+			put_gamma(&bw, code - 2, 0);
+		}
+
+		matcher_skip(&m, &i, len);
+	}
+
+	/* end of stream: an offset of 0xffffffff */
+	put_bit(&bw, 0);
+	put_gamma(&bw, 0x1000002, 0);
+	put_byte(&bw, 0xff);
+
+	matcher_free(&m);
+
+	return bw.out - dst;
+}
+
+/* aplib */
+size_t aplenc(const unsigned char *src, size_t srcSz, unsigned char *dst)
+{
+	struct bitwriter bw = { header(dst, "APL0", srcSz), NULL, 0 };
+	struct matcher m;
+	unsigned R0 = ~0u;  /* last offset */
+	int LWM = 0;        /* last item was a match */
+	size_t i = 0;
+
+	matcher_init(&m, src, srcSz, 0x10000);
+
+	/* first byte verbatim */
+	if (srcSz)
+	{
+		put_byte(&bw, src[0]);
+		matcher_skip(&m, &i, 1);
+	}
+
+	while (i < srcSz)
+	{
+		unsigned dist = 0;
+		unsigned len = matcher_find(&m, i, 0x10000, &dist);
+		unsigned adjust = (dist >= 32000) + (dist >= 1280) + 2 * (dist < 128);
+		unsigned back;
+
+		/* repeat of the last offset */
+		if (len >= 2 && dist == R0 && !LWM)
+		{
+			put_bit(&bw, 1);
+			put_bit(&bw, 0);
+			put_gamma(&bw, 2, 1);
+			put_gamma(&bw, len, 1);
+			LWM = 1;
+		}
+		/* short match */
+		else if (len >= 2 && len <= 3 && dist < 128)
+		{
+			put_bit(&bw, 1);
+			put_bit(&bw, 1);
+			put_bit(&bw, 0);
+			put_byte(&bw, (dist << 1) | (len - 2));
+			R0 = dist;
+			LWM = 1;
+		}
+		/* normal match */
+		else if (len >= 3 && len >= 2 + adjust)
+		{
+			put_bit(&bw, 1);
+			put_bit(&bw, 0);
+			put_gamma(&bw, (dist >> 8) + (LWM ? 2 : 3), 1);
+			put_byte(&bw, dist);
+			put_gamma(&bw, len - adjust, 1);
+			R0 = dist;
+			LWM = 1;
+		}
+		else
+		{
+			/* a zero, or a byte from up to 15 bytes back */
+			for (back = 1; back < 16 && back <= i; ++back)
+				if (src[i - back] == src[i])
+					break;
+
+			if (!src[i] || (back < 16 && back <= i))
+			{
+				unsigned v = src[i] ? back : 0;
+				int k;
+
+				put_bit(&bw, 1);
+				put_bit(&bw, 1);
+				put_bit(&bw, 1);
+				for (k = 3; k >= 0; --k)
+					put_bit(&bw, (v >> k) & 1);
+			}
+			else
+			{
+				put_bit(&bw, 0);
+				put_byte(&bw, src[i]);
+			}
+
+			LWM = 0;
+			len = 1;
+		}
+
+		matcher_skip(&m, &i, len);
+	}
+
+	/* end of stream: a short match with an offset of zero */
+	put_bit(&bw, 1);
+	put_bit(&bw, 1);
+	put_bit(&bw, 0);
+	put_byte(&bw, 0);
+
+	matcher_free(&m);
+
+	return bw.out - dst;
+}
+
+/* deflate writes bits least significant first */
+struct deflatewriter
+{
+	unsigned char *out;
+	unsigned       accum;
+	int            bits;
+};
+
+static void deflate_bits(struct deflatewriter *dw, unsigned v, int n)
+{
+	dw->accum |= v << dw->bits;
+	dw->bits += n;
+
+	while (dw->bits >= 8)
+	{
+		*dw->out++ = dw->accum;
+		dw->accum >>= 8;
+		dw->bits -= 8;
+	}
+}
+
+/* huffman codes are stored most significant bit first */
+static void deflate_code(struct deflatewriter *dw, unsigned code, int n)
+{
+	while (n--)
+		deflate_bits(dw, (code >> n) & 1, 1);
+}
+
+/* a literal or length symbol from the fixed huffman table */
+static void deflate_symbol(struct deflatewriter *dw, unsigned sym)
+{
+	if (sym < 144)
+		deflate_code(dw, 0x30 + sym, 8);
+	else if (sym < 256)
+		deflate_code(dw, 0x190 + sym - 144, 9);
+	else if (sym < 280)
+		deflate_code(dw, sym - 256, 7);
+	else
+		deflate_code(dw, 0xC0 + sym - 280, 8);
+}
+
+/* zlib: a single fixed huffman deflate block */
+size_t zlibenc(const unsigned char *src, size_t srcSz, unsigned char *dst)
+{
+	static const unsigned short lenBase[] = {
+		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+	};
+	static const unsigned char lenExtra[] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+	};
+	static const unsigned short distBase[] = {
+		1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+		257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+		8193, 12289, 16385, 24577
+	};
+	static const unsigned char distExtra[] = {
+		0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+		7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+	};
+	struct deflatewriter dw = { header(dst, "ZLIB", srcSz), 0, 0 };
+	struct matcher m;
+	size_t i = 0;
+
+	matcher_init(&m, src, srcSz, 0x8000);
+
+	/* final block, fixed huffman codes */
+	deflate_bits(&dw, 1, 1);
+	deflate_bits(&dw, 1, 2);
+
+	while (i < srcSz)
+	{
+		unsigned dist = 0;
+		unsigned len = matcher_find(&m, i, 258, &dist);
+		int c;
+
+		if (len < 3)
+		{
+			deflate_symbol(&dw, src[i]);
+			matcher_skip(&m, &i, 1);
+			continue;
+		}
+
+		for (c = 28; lenBase[c] > len; --c)
+			;
+		deflate_symbol(&dw, 257 + c);
+		deflate_bits(&dw, len - lenBase[c], lenExtra[c]);
+
+		for (c = 29; distBase[c] > dist; --c)
+			;
+		deflate_code(&dw, c, 5);
+		deflate_bits(&dw, dist - distBase[c], distExtra[c]);
+
+		matcher_skip(&m, &i, len);
+	}
+
+	/* end of block, then flush */
+	deflate_symbol(&dw, 256);
+	deflate_bits(&dw, 0, 7);
+
+	matcher_free(&m);
+
+	return dw.out - dst;
+}
+
+/* encoder for a codec by name, or NULL if unknown */
+encoder encoder_from_name(const char *name)
+{
+	static const struct { const char *name; encoder enc; } list[] = {
+		{ "yaz", yazenc },
+		{ "lzo", lzoenc },
+		{ "ucl", uclenc },
+		{ "aplib", aplenc },
+		{ "zlib", zlibenc },
+	};
+	unsigned i;
+
+	for (i = 0; i < sizeof(list) / sizeof(*list); ++i)
+		if (!strcmp(name, list[i].name))
+			return list[i].enc;
+
+	return NULL;
+}
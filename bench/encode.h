@@ -0,0 +1,23 @@
+#ifndef Z64DECOMPRESS_BENCH_ENCODE_H_INCLUDED
+#define Z64DECOMPRESS_BENCH_ENCODE_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+/* greedy reference encoders, for generating benchmark data; each writes
+ * the z64compress header (Yaz0, LZO0, UCL0, APL0, ZLIB) followed by the
+ * compressed data to dst, which must hold encode_bound(srcSz) bytes, and
+ * returns the size written */
+size_t yazenc(const unsigned char *src, size_t srcSz, unsigned char *dst);
+size_t lzoenc(const unsigned char *src, size_t srcSz, unsigned char *dst);
+size_t uclenc(const unsigned char *src, size_t srcSz, unsigned char *dst);
+size_t aplenc(const unsigned char *src, size_t srcSz, unsigned char *dst);
+size_t zlibenc(const unsigned char *src, size_t srcSz, unsigned char *dst);
+
+/* encoder for a codec by name ("yaz", "lzo", ...), or NULL if unknown */
+typedef size_t (*encoder)(const unsigned char *src, size_t srcSz, unsigned char *dst);
+encoder encoder_from_name(const char *name);
+
+/* most bytes an encoder can write for srcSz bytes of input */
+size_t encode_bound(size_t srcSz);
+
+#endif /* Z64DECOMPRESS_BENCH_ENCODE_H_INCLUDED */
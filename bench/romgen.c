@@ -0,0 +1,354 @@
+/*
+ * romgen.c <z64.me>
+ *
+ * generates roms laid out like ocarina and majora: makerom, boot, and
+ * dmadata, followed by files of generated data, most of them compressed
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "romgen.h"
+#include "corpus.h"
+#include "dma.h"
+#include "n64crc.h"
+
+#define ALIGN16(X)  (((X) + 15) & ~(size_t)15)
+
+#define BOOT_SIZE   0x6000   /* bytes of boot (code)                  */
+#define CRC_EXTENT  0x101000 /* n64crc() checksums up to this offset  */
+#define BOOTCODE    0x40     /* ipl3 lies between here and 0x1000     */
+#define CIC6102     0x90BB6CB5 /* crc32 identifying 6102 ipl3         */
+
+/* dmaext Pstart flags */
+#define COMPRESSED  (1u << 31)
+#define OVERLAP     (1u <<  0)
+#define HEADER      (1u <<  1)
+
+/* a generated file */
+struct file
+{
+	size_t         Vstart;
+	size_t         Vend;
+	size_t         Pstart;
+	size_t         Pend;        /* zero if uncompressed               */
+	enum corpus    kind;
+	unsigned char  compressed;
+	unsigned char  header;      /* dmaext: z64ext header precedes it  */
+	unsigned char  overlap;     /* dmaext: entry is only two words    */
+};
+
+/* name of a layout */
+const char *romgen_name(enum romgen_layout layout)
+{
+	static const char *names[ROMGEN_MAX] = {
+		[ROMGEN_RETAIL] = "retail",
+		[ROMGEN_IQUE]   = "ique",
+		[ROMGEN_DMAEXT] = "dmaext",
+	};
+
+	if (layout >= ROMGEN_MAX)
+		return "none";
+
+	return names[layout];
+}
+
+/* smallest power of two >= v */
+static size_t pow2(size_t v)
+{
+	size_t p = 1;
+
+	while (p < v)
+		p *= 2;
+
+	return p;
+}
+
+/* the crc32 n64crc() uses to identify the ipl3 */
+static void crc_table(unsigned table[256])
+{
+	unsigned i, j;
+
+	for (i = 0; i < 256; ++i)
+	{
+		unsigned crc = i;
+
+		for (j = 0; j < 8; ++j)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+		table[i] = crc;
+	}
+}
+
+/* overwrite the last 4 bytes of data[0, len) so its crc32 is `want`;
+ * n64crc() only checksums roms whose ipl3 it recognizes, so the ipl3
+ * is forged to look like a 6102 one */
+static void crc_forge(unsigned char *data, size_t len, unsigned want)
+{
+	unsigned table[256];
+	unsigned char idx[4];
+	unsigned crc = ~0u;
+	unsigned r = ~want;
+	size_t i;
+	int k;
+
+	crc_table(table);
+
+	for (i = 0; i < len - 4; ++i)
+		crc = (crc >> 8) ^ table[(crc ^ data[i]) & 0xFF];
+
+	/* each table entry has a unique top byte, so walking backward from
+	 * the wanted crc reveals the table index used by each step */
+	for (k = 3; k >= 0; --k)
+	{
+		unsigned j;
+
+		for (j = 0; (table[j] >> 24) != (r >> 24); ++j)
+			;
+		idx[k] = j;
+		r = (r ^ table[j]) << 8;
+	}
+
+	/* then choose the bytes leading to those indices */
+	for (k = 0; k < 4; ++k)
+	{
+		data[len - 4 + k] = (crc ^ idx[k]) & 0xFF;
+		crc = (crc >> 8) ^ table[idx[k]];
+	}
+}
+
+/* rom header and ipl3 */
+static void makerom(unsigned char *dst, size_t size, unsigned seed)
+{
+	corpus_generate(CORPUS_CODE, dst, size, seed);
+	memset(dst, 0, BOOTCODE);
+	wbeU32(dst + 0x00, 0x80371240);
+	wbeU32(dst + 0x04, 0x0000000F);
+	wbeU32(dst + 0x08, 0x80000400);
+	wbeU32(dst + 0x0C, 0x0000144B);
+	memcpy(dst + 0x20, "Z64DECOMPRESS BENCH ", 20);
+	crc_forge(dst + BOOTCODE, 0x1000 - BOOTCODE, CIC6102);
+}
+
+/* write one dmadata row; rows describing the decompressed rom say every
+ * file is uncompressed and lies at its virtual address */
+static unsigned char *dma_row(unsigned char *row, const struct file *f, enum romgen_layout layout, int patched)
+{
+	if (layout == ROMGEN_DMAEXT)
+	{
+		unsigned flags = (f->overlap ? OVERLAP : 0) | (f->header ? HEADER : 0);
+
+		wbeU32(row + 0, f->Vstart);
+		if (patched)
+			wbeU32(row + 4, f->Vstart | flags);
+		else
+			wbeU32(row + 4, f->Pstart | flags | (f->compressed ? COMPRESSED : 0));
+		if (f->overlap)
+			return row + 8;
+		wbeU32(row + 8, f->Vend);
+		return row + 12;
+	}
+
+	wbeU32(row +  0, f->Vstart);
+	wbeU32(row +  4, f->Vend);
+	wbeU32(row +  8, patched ? f->Vstart : f->Pstart);
+	wbeU32(row + 12, patched ? 0 : f->Pend);
+
+	return row + 16;
+}
+
+/* write dmadata describing `files` to dst */
+static void dma_write(unsigned char *dst, const struct file *files, int num, enum romgen_layout layout, int patched)
+{
+	int i;
+
+	for (i = 0; i < num; ++i)
+		dst = dma_row(dst, &files[i], layout, patched);
+}
+
+/* generate a rom */
+int romgen_build(const struct romgen *cfg, struct romgen_rom *out)
+{
+	enum romgen_layout layout = cfg->layout;
+	encoder encode = layout == ROMGEN_IQUE ? zlibenc : cfg->encode;
+	unsigned seed = cfg->seed;
+	int num = cfg->files + 3;
+	struct file *files;
+	unsigned char *scratch = NULL;
+	unsigned char *mem;
+	size_t maxSz = 0;
+	size_t dmaSz;
+	size_t pos;
+	size_t romSz;
+	size_t decSz;
+	int i;
+
+	memset(out, 0, sizeof(*out));
+
+	if (!(files = calloc(num, sizeof(*files))))
+		return -1;
+
+	/* makerom, boot, dmadata; dmaext dmadata starts with two overlapping
+	 * entries, and iQue's makerom is a little smaller */
+	files[0].Vend = layout == ROMGEN_IQUE ? 0x1050 : 0x1060;
+	files[1].Vstart = files[0].Vend;
+	files[1].Vend = files[1].Vstart + BOOT_SIZE;
+	files[0].kind = files[1].kind = files[2].kind = CORPUS_CODE;
+	files[0].overlap = files[1].overlap = layout == ROMGEN_DMAEXT;
+
+	/* files of random kinds and sizes; audio is left uncompressed, as
+	 * the games do, and a few dmaext files keep a z64ext header */
+	for (i = 3; i < num; ++i)
+	{
+		struct file *f = &files[i];
+		size_t size = cfg->fileSz / 4 + corpus_rand(&seed) % (cfg->fileSz * 3 / 2 + 1);
+
+		f->kind = corpus_rand(&seed) % CORPUS_MAX;
+		f->compressed = f->kind != CORPUS_AUDIO;
+		f->Vend = ALIGN16(size < 16 ? 16 : size);
+		if (layout == ROMGEN_DMAEXT)
+		{
+			f->overlap = i + 1 < num && (corpus_rand(&seed) & 1);
+			f->header = f->compressed && f->Vend > 16 && !(corpus_rand(&seed) % 16);
+		}
+		if (f->Vend > maxSz)
+			maxSz = f->Vend;
+	}
+
+	/* dmadata size, including a terminator */
+	for (i = 0, dmaSz = 16; i < num; ++i)
+		dmaSz += layout != ROMGEN_DMAEXT ? 16 : files[i].overlap ? 8 : 12;
+	dmaSz = ALIGN16(dmaSz);
+
+	/* virtual addresses follow one another */
+	files[2].Vstart = ALIGN16(files[1].Vend);
+	files[2].Vend = files[2].Vstart + dmaSz;
+	for (i = 3; i < num; ++i)
+	{
+		files[i].Vend += files[i - 1].Vend;
+		files[i].Vstart = files[i - 1].Vend;
+	}
+
+	/* the decompressed rom; it must be large enough to be checksummed */
+	decSz = pow2(files[num - 1].Vend);
+	if (decSz < CRC_EXTENT)
+		decSz = pow2(CRC_EXTENT);
+	if (!(out->dec = calloc(decSz, 1)))
+		goto L_nomem;
+
+	/* dmadata is written once the files have been placed */
+	makerom(out->dec, files[0].Vend, seed);
+	for (i = 1; i < num; ++i)
+	{
+		const struct file *f = &files[i];
+
+		if (i != 2)
+			corpus_generate(f->kind, out->dec + f->Vstart, f->Vend - f->Vstart, seed + i);
+	}
+
+	/* the compressed rom; makerom, boot, and dmadata are at the same
+	 * offsets in both, and each other file is packed after them */
+	romSz = encode_bound(files[num - 1].Vend) + 80 * num;
+	if (!(out->rom = calloc(romSz, 1))
+		|| !(scratch = malloc(encode_bound(maxSz)))
+	)
+		goto L_nomem;
+
+	memcpy(out->rom, out->dec, files[2].Vstart);
+	for (i = 0; i < 3; ++i)
+		files[i].Pstart = files[i].Vstart;
+
+	for (i = 3, pos = files[2].Vend; i < num; ++i)
+	{
+		struct file *f = &files[i];
+		const unsigned char *src = out->dec + f->Vstart;
+		size_t size = f->Vend - f->Vstart;
+		size_t sz;
+
+		f->Pstart = pos;
+
+		if (!f->compressed)
+		{
+			memcpy(out->rom + pos, src, size);
+			pos = ALIGN16(pos + size);
+			continue;
+		}
+
+		if (f->header)
+		{
+			memcpy(out->rom + pos, src, 16);
+			pos += 16;
+			src += 16;
+			size -= 16;
+		}
+
+		sz = encode(src, size, scratch);
+
+		/* iQue files lack the 8b header */
+		if (layout == ROMGEN_IQUE)
+		{
+			memcpy(out->rom + pos, scratch + 8, sz - 8);
+			pos += sz - 8;
+		}
+		else
+		{
+			memcpy(out->rom + pos, scratch, sz);
+			pos += sz;
+		}
+
+		f->Pend = pos;
+		pos = ALIGN16(pos);
+	}
+
+	/* a retail rom is half the size of the decompressed one, if its
+	 * files fit; the decompressed size is derived from this, by doubling
+	 * it for each file ending beyond it */
+	romSz = pow2(pos);
+	if (romSz < decSz / 2)
+		romSz = decSz / 2;
+	if (romSz < decSz && files[num - 1].Vend <= romSz)
+		romSz = decSz;
+	if (!(mem = realloc(out->rom, romSz)))
+		goto L_nomem;
+	out->rom = mem;
+	memset(out->rom + pos, 0, romSz - pos);
+	if (romSz > decSz)
+	{
+		if (!(mem = realloc(out->dec, romSz)))
+			goto L_nomem;
+		out->dec = mem;
+		memset(out->dec + decSz, 0, romSz - decSz);
+		decSz = romSz;
+	}
+
+	/* dmadata in each */
+	dma_write(out->rom + files[2].Vstart, files, num, layout, 0);
+	dma_write(out->dec + files[2].Vstart, files, num, layout, 1);
+
+	n64crc(out->dec);
+
+	out->romSz = romSz;
+	out->decSz = decSz;
+	out->entries = layout == ROMGEN_DMAEXT ? num : (int)(dmaSz / 16);
+
+	free(scratch);
+	free(files);
+
+	return 0;
+
+L_nomem:
+	free(scratch);
+	free(files);
+	romgen_free(out);
+
+	return -1;
+}
+
+/* free a generated rom */
+void romgen_free(struct romgen_rom *rom)
+{
+	free(rom->rom);
+	free(rom->dec);
+	rom->rom = NULL;
+	rom->dec = NULL;
+}
@@ -0,0 +1,46 @@
+#ifndef Z64DECOMPRESS_BENCH_ROMGEN_H_INCLUDED
+#define Z64DECOMPRESS_BENCH_ROMGEN_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+#include "encode.h"
+
+/* how dmadata and the files it describes are laid out */
+enum romgen_layout
+{
+	ROMGEN_RETAIL,   /* ocarina/majora, files with 8b headers     */
+	ROMGEN_IQUE,     /* iQue, headerless zlib files               */
+	ROMGEN_DMAEXT,   /* ZZRTL dmaext, variable-length entries     */
+	ROMGEN_MAX
+};
+
+/* what to generate */
+struct romgen
+{
+	enum romgen_layout layout;
+	int                files;    /* files following makerom, boot, and dmadata */
+	size_t             fileSz;   /* average decompressed size of a file        */
+	encoder            encode;   /* ignored by ROMGEN_IQUE, which uses zlib    */
+	unsigned           seed;
+};
+
+/* a generated rom, and what decompressing it must produce */
+struct romgen_rom
+{
+	unsigned char     *rom;      /* compressed rom                             */
+	size_t             romSz;
+	unsigned char     *dec;      /* decompressed rom, with patched dmadata     */
+	size_t             decSz;    /* and a valid crc                            */
+	int                entries;  /* dma entries, as z64dec_rom_info() counts   */
+};
+
+/* name of a layout ("retail", "ique", "dmaext") */
+const char *romgen_name(enum romgen_layout layout);
+
+/* generate a rom; returns non-zero if memory ran out */
+int romgen_build(const struct romgen *cfg, struct romgen_rom *out);
+
+/* free a generated rom */
+void romgen_free(struct romgen_rom *rom);
+
+#endif /* Z64DECOMPRESS_BENCH_ROMGEN_H_INCLUDED */
@@ -0,0 +1,79 @@
+/*
+ * timer.c <z64.me>
+ *
+ * timing and statistics for the benchmarks
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef _WIN32
+ #include <windows.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+ #include <x86intrin.h>
+#endif
+
+#include "timer.h"
+
+/* seconds elapsed since some fixed point, from a monotonic clock */
+double timer_seconds(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, freq;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+
+	return (double)count.QuadPart / freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* cpu timestamp counter, or zero where there is none */
+unsigned long long timer_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static int compare(const void *a, const void *b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+/* summarize `n` measurements */
+void stats_compute(struct stats *stats, double *v, int n)
+{
+	double sum = 0;
+	double dev = 0;
+	int i;
+
+	qsort(v, n, sizeof(*v), compare);
+
+	for (i = 0; i < n; ++i)
+		sum += v[i];
+
+	stats->mean = sum / n;
+	stats->min = v[0];
+	stats->max = v[n - 1];
+	stats->median = n & 1 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+
+	for (i = 0; i < n; ++i)
+		dev += (v[i] - stats->mean) * (v[i] - stats->mean);
+
+	stats->stddev = n > 1 ? sqrt(dev / (n - 1)) : 0;
+}
@@ -0,0 +1,23 @@
+#ifndef Z64DECOMPRESS_BENCH_TIMER_H_INCLUDED
+#define Z64DECOMPRESS_BENCH_TIMER_H_INCLUDED
+
+/* seconds elapsed since some fixed point, from a monotonic clock */
+double timer_seconds(void);
+
+/* cpu timestamp counter, or zero where there is none */
+unsigned long long timer_cycles(void);
+
+/* summary of repeated measurements */
+struct stats
+{
+	double median;
+	double mean;
+	double min;
+	double max;
+	double stddev;
+};
+
+/* summarize `n` measurements (the array is sorted in the process) */
+void stats_compute(struct stats *stats, double *v, int n);
+
+#endif /* Z64DECOMPRESS_BENCH_TIMER_H_INCLUDED */
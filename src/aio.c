@@ -0,0 +1,539 @@
+/*
+ * aio.c <z64.me>
+ *
+ * loading and storing files in the background, through io_uring on
+ * Linux, or on a thread of its own
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __linux__
+ #include <errno.h>
+ #include <fcntl.h>
+ #include <unistd.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <sys/syscall.h>
+ #include <sys/eventfd.h>
+ #include <linux/io_uring.h>
+#endif
+
+#include "aio.h"
+#include "wow.h"
+
+/* largest single read or write; the rest of a file is resubmitted */
+#define AIO_CHUNK (1024 * 1024 * 1024)
+
+#ifdef __linux__
+
+/* an io_uring, set up without liburing the way counters.c opens perf
+ * events, since the kernel's interface is all that is needed */
+struct uring
+{
+	int                  fd;
+	int                  wakeFd;     /* eventfd aio_wake() writes to     */
+	uint64_t             wakeCount;  /* where reads of it go             */
+	unsigned            *sqHead;
+	unsigned            *sqTail;
+	unsigned            *sqMask;
+	unsigned            *sqArray;
+	unsigned             sqEntries;
+	struct io_uring_sqe *sqes;
+	unsigned            *cqHead;
+	unsigned            *cqTail;
+	unsigned            *cqMask;
+	struct io_uring_cqe *cqes;
+	void                *sqRing;
+	size_t               sqRingSz;
+	void                *cqRing;
+	size_t               cqRingSz;
+	size_t               sqesSz;
+	unsigned             pending;    /* sqes not yet handed to the kernel */
+};
+
+#endif /* __linux__ */
+
+struct aio
+{
+	enum aio_backend     backend;
+	pthread_mutex_t      lock;
+	pthread_cond_t       work;       /* the queue grew, or stopping     */
+	pthread_cond_t       cond;       /* the done list grew, or woken    */
+	pthread_t            thread;
+	struct aio_file     *queue;      /* waiting for the thread          */
+	struct aio_file     *queueTail;
+	struct aio_file     *done;       /* finished, waiting for aio_wait  */
+	struct aio_file     *doneTail;
+	int                  woken;
+	int                  stop;
+#ifdef __linux__
+	struct uring         ring;
+#endif
+};
+
+static void push(struct aio_file **head, struct aio_file **tail, struct aio_file *f)
+{
+	f->next = NULL;
+	if (*tail)
+		(*tail)->next = f;
+	else
+		*head = f;
+	*tail = f;
+}
+
+static struct aio_file *pop(struct aio_file **head, struct aio_file **tail)
+{
+	struct aio_file *f = *head;
+
+	if (f && !(*head = f->next))
+		*tail = NULL;
+
+	return f;
+}
+
+/* hand a finished file to aio_wait() */
+static void finish(struct aio *aio, struct aio_file *f, int error)
+{
+	f->error = error;
+	pthread_mutex_lock(&aio->lock);
+	push(&aio->done, &aio->doneTail, f);
+	pthread_cond_signal(&aio->cond);
+	pthread_mutex_unlock(&aio->lock);
+}
+
+/*
+ *
+ * the thread backend
+ *
+ */
+
+/* load or store a file with blocking reads and writes */
+static int blocking(struct aio_file *f)
+{
+	FILE *fp;
+	long end;
+	int err = AIO_OK;
+
+	if (f->store)
+	{
+		if (!(fp = wow_fopen(f->fn, "wb")))
+			return AIO_ERR_OPEN;
+		if (f->size && fwrite(f->data->data, 1, f->size, fp) != f->size)
+			err = AIO_ERR_IO;
+		if (fclose(fp))
+			err = AIO_ERR_IO;
+		return err;
+	}
+
+	if (!(fp = wow_fopen(f->fn, "rb")))
+		return AIO_ERR_OPEN;
+	if (fseek(fp, 0, SEEK_END) || (end = ftell(fp)) <= 0)
+	{
+		fclose(fp);
+		return AIO_ERR_EMPTY;
+	}
+	f->size = end;
+	arena_reserve(f->data, f->size, 0);
+	fseek(fp, 0, SEEK_SET);
+	if (fread(f->data->data, 1, f->size, fp) != f->size)
+		err = AIO_ERR_IO;
+	fclose(fp);
+
+	return err;
+}
+
+static void *aio_thread(void *udata)
+{
+	struct aio *aio = udata;
+
+	pthread_mutex_lock(&aio->lock);
+	for (;;)
+	{
+		struct aio_file *f;
+
+		while (!aio->queue && !aio->stop)
+			pthread_cond_wait(&aio->work, &aio->lock);
+		if (!(f = pop(&aio->queue, &aio->queueTail)))
+			break;
+		pthread_mutex_unlock(&aio->lock);
+
+		finish(aio, f, blocking(f));
+
+		pthread_mutex_lock(&aio->lock);
+	}
+	pthread_mutex_unlock(&aio->lock);
+
+	return NULL;
+}
+
+/*
+ *
+ * the io_uring backend
+ *
+ */
+
+#ifdef __linux__
+
+/* set up a ring for `entries` operations in flight (returns non-zero
+ * if the kernel doesn't allow it) */
+static int uring_setup(struct uring *r, unsigned entries)
+{
+	struct io_uring_params p;
+	unsigned char *sq;
+	unsigned char *cq;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+	r->fd = r->wakeFd = -1;
+
+	/* IORING_OP_READ and IORING_OP_WRITE arrived with fast poll, in 5.7 */
+	if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0
+		|| !(p.features & IORING_FEAT_FAST_POLL)
+	)
+		goto L_fail;
+
+	r->sqRingSz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cqRingSz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (r->cqRingSz > r->sqRingSz)
+			r->sqRingSz = r->cqRingSz;
+		r->cqRingSz = 0;
+	}
+
+	r->sqRing = mmap(NULL, r->sqRingSz, PROT_READ | PROT_WRITE
+		, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING
+	);
+	if (r->sqRing == MAP_FAILED)
+		goto L_fail;
+	r->cqRing = r->sqRing;
+	if (r->cqRingSz)
+	{
+		r->cqRing = mmap(NULL, r->cqRingSz, PROT_READ | PROT_WRITE
+			, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING
+		);
+		if (r->cqRing == MAP_FAILED)
+			goto L_fail;
+	}
+	r->sqesSz = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqesSz, PROT_READ | PROT_WRITE
+		, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES
+	);
+	if (r->sqes == MAP_FAILED)
+		goto L_fail;
+
+	sq = r->sqRing;
+	cq = r->cqRing;
+	r->sqHead = (unsigned *)(sq + p.sq_off.head);
+	r->sqTail = (unsigned *)(sq + p.sq_off.tail);
+	r->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sqArray = (unsigned *)(sq + p.sq_off.array);
+	r->sqEntries = p.sq_entries;
+	r->cqHead = (unsigned *)(cq + p.cq_off.head);
+	r->cqTail = (unsigned *)(cq + p.cq_off.tail);
+	r->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	if ((r->wakeFd = eventfd(0, EFD_CLOEXEC)) < 0)
+		goto L_fail;
+
+	return 0;
+
+L_fail:
+	if (r->sqes && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqesSz);
+	if (r->cqRingSz && r->cqRing && r->cqRing != MAP_FAILED)
+		munmap(r->cqRing, r->cqRingSz);
+	if (r->sqRing && r->sqRing != MAP_FAILED)
+		munmap(r->sqRing, r->sqRingSz);
+	if (r->fd >= 0)
+		close(r->fd);
+	return -1;
+}
+
+static void uring_free(struct uring *r)
+{
+	munmap(r->sqes, r->sqesSz);
+	if (r->cqRingSz)
+		munmap(r->cqRing, r->cqRingSz);
+	munmap(r->sqRing, r->sqRingSz);
+	close(r->fd);
+	close(r->wakeFd);
+}
+
+/* queue a read or write; it reaches the kernel on the next uring_enter() */
+static void uring_queue(struct uring *r, int opcode, int fd, void *buf, size_t len, uint64_t ofs, uint64_t udata)
+{
+	unsigned tail = *r->sqTail;
+	struct io_uring_sqe *sqe;
+
+	/* aio_new() sized the ring for every file that can be in flight */
+	if (tail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE) >= r->sqEntries)
+		die("io_uring submission queue full");
+
+	sqe = &r->sqes[tail & *r->sqMask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = ofs;
+	sqe->user_data = udata;
+	r->sqArray[tail & *r->sqMask] = tail & *r->sqMask;
+	__atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+	r->pending += 1;
+}
+
+/* hand queued operations to the kernel, waiting for `wait` to complete */
+static void uring_enter(struct uring *r, unsigned wait)
+{
+	int n;
+
+	do
+		n = syscall(__NR_io_uring_enter, r->fd, r->pending, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	while (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+
+	if (n < 0)
+		die("io_uring_enter failed: %s", strerror(errno));
+	r->pending -= n;
+}
+
+/* take a completion, if there is one (returns non-zero if there was) */
+static int uring_reap(struct uring *r, struct io_uring_cqe *cqe)
+{
+	unsigned head = *r->cqHead;
+
+	if (head == __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE))
+		return 0;
+
+	*cqe = r->cqes[head & *r->cqMask];
+	__atomic_store_n(r->cqHead, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+/* listen for aio_wake() */
+static void uring_arm(struct uring *r)
+{
+	uring_queue(r, IORING_OP_READ, r->wakeFd, &r->wakeCount, sizeof(r->wakeCount), 0, 0);
+}
+
+/* read or write the next part of a file */
+static void uring_next(struct uring *r, struct aio_file *f)
+{
+	size_t len = f->size - f->done;
+
+	if (len > AIO_CHUNK)
+		len = AIO_CHUNK;
+
+	uring_queue(r, f->store ? IORING_OP_WRITE : IORING_OP_READ
+		, f->fd, f->data->data + f->done, len, f->done, (uintptr_t)f
+	);
+}
+
+/* open a file and start loading or storing it */
+static void uring_submit(struct aio *aio, struct aio_file *f)
+{
+	struct stat st;
+
+	f->done = 0;
+	if (f->store)
+		f->fd = open(f->fn, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	else
+		f->fd = open(f->fn, O_RDONLY | O_CLOEXEC);
+
+	if (f->fd < 0)
+	{
+		finish(aio, f, AIO_ERR_OPEN);
+		return;
+	}
+
+	if (!f->store)
+	{
+		if (fstat(f->fd, &st) || st.st_size <= 0)
+		{
+			close(f->fd);
+			finish(aio, f, AIO_ERR_EMPTY);
+			return;
+		}
+		f->size = st.st_size;
+		arena_reserve(f->data, f->size, 0);
+	}
+	else if (!f->size)
+	{
+		close(f->fd);
+		finish(aio, f, AIO_OK);
+		return;
+	}
+
+	uring_next(&aio->ring, f);
+}
+
+static struct aio_file *uring_wait(struct aio *aio)
+{
+	struct uring *r = &aio->ring;
+
+	for (;;)
+	{
+		struct io_uring_cqe cqe;
+		struct aio_file *f;
+
+		/* those that finished without reaching the ring */
+		if ((f = pop(&aio->done, &aio->doneTail)))
+			return f;
+
+		if (!uring_reap(r, &cqe))
+		{
+			uring_enter(r, 1);
+			continue;
+		}
+
+		if (!cqe.user_data)
+		{
+			uring_arm(r);
+			return NULL;
+		}
+
+		f = (struct aio_file *)(uintptr_t)cqe.user_data;
+		if (cqe.res > 0)
+		{
+			f->done += cqe.res;
+			if (f->done < f->size)
+			{
+				uring_next(r, f);
+				continue;
+			}
+		}
+
+		f->error = cqe.res > 0 ? AIO_OK : AIO_ERR_IO;
+		if (close(f->fd) && f->store)
+			f->error = AIO_ERR_IO;
+		return f;
+	}
+}
+
+#endif /* __linux__ */
+
+/*
+ *
+ * either
+ *
+ */
+
+/* begin */
+struct aio *aio_new(enum aio_backend backend, int depth)
+{
+	struct aio *aio = calloc_safe(1, sizeof(*aio));
+
+	pthread_mutex_init(&aio->lock, NULL);
+	pthread_cond_init(&aio->work, NULL);
+	pthread_cond_init(&aio->cond, NULL);
+
+#ifdef __linux__
+	/* a file at a time each, and a read of the eventfd */
+	if (backend == AIO_URING && !uring_setup(&aio->ring, depth + 1))
+	{
+		aio->backend = AIO_URING;
+		uring_arm(&aio->ring);
+		return aio;
+	}
+#else
+	(void)depth;
+#endif
+
+	aio->backend = AIO_THREAD;
+	if (pthread_create(&aio->thread, NULL, aio_thread, aio))
+		die("failed to create i/o thread");
+
+	return aio;
+}
+
+/* the backend actually in use */
+enum aio_backend aio_backend(const struct aio *aio)
+{
+	return aio->backend;
+}
+
+/* start loading or storing a file */
+void aio_submit(struct aio *aio, struct aio_file *file)
+{
+#ifdef __linux__
+	if (aio->backend == AIO_URING)
+	{
+		uring_submit(aio, file);
+		return;
+	}
+#endif
+
+	pthread_mutex_lock(&aio->lock);
+	push(&aio->queue, &aio->queueTail, file);
+	pthread_cond_signal(&aio->work);
+	pthread_mutex_unlock(&aio->lock);
+}
+
+/* wait until a submitted file is loaded or stored */
+struct aio_file *aio_wait(struct aio *aio)
+{
+	struct aio_file *f;
+
+#ifdef __linux__
+	if (aio->backend == AIO_URING)
+		return uring_wait(aio);
+#endif
+
+	pthread_mutex_lock(&aio->lock);
+	while (!aio->done && !aio->woken)
+		pthread_cond_wait(&aio->cond, &aio->lock);
+	if (!(f = pop(&aio->done, &aio->doneTail)))
+		aio->woken = 0;
+	pthread_mutex_unlock(&aio->lock);
+
+	return f;
+}
+
+/* make aio_wait() return */
+void aio_wake(struct aio *aio)
+{
+#ifdef __linux__
+	if (aio->backend == AIO_URING)
+	{
+		uint64_t one = 1;
+
+		if (write(aio->ring.wakeFd, &one, sizeof(one)) != sizeof(one))
+			die("failed to wake i/o thread");
+		return;
+	}
+#endif
+
+	pthread_mutex_lock(&aio->lock);
+	aio->woken = 1;
+	pthread_cond_signal(&aio->cond);
+	pthread_mutex_unlock(&aio->lock);
+}
+
+/* stop */
+void aio_free(struct aio *aio)
+{
+#ifdef __linux__
+	if (aio->backend == AIO_URING)
+		uring_free(&aio->ring);
+	else
+#endif
+	{
+		pthread_mutex_lock(&aio->lock);
+		aio->stop = 1;
+		pthread_cond_signal(&aio->work);
+		pthread_mutex_unlock(&aio->lock);
+		pthread_join(aio->thread, NULL);
+	}
+
+	pthread_cond_destroy(&aio->cond);
+	pthread_cond_destroy(&aio->work);
+	pthread_mutex_destroy(&aio->lock);
+	free(aio);
+}
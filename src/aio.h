@@ -0,0 +1,67 @@
+#ifndef Z64DECOMPRESS_AIO_H_INCLUDED
+#define Z64DECOMPRESS_AIO_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+#include "arena.h"
+
+/* loading and storing whole files in the background, so that threads
+ * decompressing files don't stall on the disk; on Linux the reads and
+ * writes go through io_uring where the kernel allows it, and otherwise
+ * a thread of its own does them one after another */
+struct aio;
+
+/* ways the reads and writes can be done */
+enum aio_backend
+{
+	AIO_URING,       /* io_uring, or AIO_THREAD where unavailable */
+	AIO_THREAD,      /* blocking reads and writes on a thread     */
+};
+
+/* what went wrong with a file */
+enum aio_error
+{
+	AIO_OK,
+	AIO_ERR_OPEN,    /* it couldn't be opened                     */
+	AIO_ERR_EMPTY,   /* there was nothing in it to load           */
+	AIO_ERR_IO,      /* reading or writing it failed              */
+};
+
+/* a file to load or store; the fields below `udata` belong to aio until
+ * the file is returned by aio_wait() */
+struct aio_file
+{
+	const char    *fn;
+	struct arena  *data;     /* loaded into, or stored from          */
+	size_t         size;     /* bytes loaded, or to store            */
+	int            store;    /* non-zero to store instead of load    */
+	int            error;    /* an aio_error once it is returned     */
+	void          *udata;
+
+	int            fd;
+	size_t         done;     /* bytes transferred so far             */
+	struct aio_file *next;
+};
+
+/* begin; only one thread may submit and wait, and `depth` is the most
+ * files it will have submitted at once */
+struct aio *aio_new(enum aio_backend backend, int depth);
+
+/* the backend actually in use */
+enum aio_backend aio_backend(const struct aio *aio);
+
+/* start loading or storing a file; a load grows `data` to the file's
+ * size */
+void aio_submit(struct aio *aio, struct aio_file *file);
+
+/* wait until a submitted file is loaded or stored and return it, or
+ * return NULL early if aio_wake() was called since the last return */
+struct aio_file *aio_wait(struct aio *aio);
+
+/* make aio_wait() return; any thread may call this */
+void aio_wake(struct aio *aio);
+
+/* stop; every submitted file must have been returned by aio_wait() */
+void aio_free(struct aio *aio);
+
+#endif /* Z64DECOMPRESS_AIO_H_INCLUDED */
@@ -0,0 +1,274 @@
+/*
+ * archive.c <z64.me>
+ *
+ * reading roms out of gzip files and zip archives, inflated with the
+ * library's own zlib decoder
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "z64decompress.h"
+#include "archive.h"
+#include "wow.h"
+
+/* gzip header flags */
+#define GZIP_FHCRC    0x02
+#define GZIP_FEXTRA   0x04
+#define GZIP_FNAME    0x08
+#define GZIP_FCOMMENT 0x10
+
+/* zip record signatures */
+#define ZIP_LOCAL     0x04034b50
+#define ZIP_CENTRAL   0x02014b50
+#define ZIP_END       0x06054b50
+
+/* zip compression methods */
+#define ZIP_STORED    0
+#define ZIP_DEFLATED  8
+
+/* sizes of the fixed parts of zip records */
+#define ZIP_LOCAL_SZ   30
+#define ZIP_CENTRAL_SZ 46
+#define ZIP_END_SZ     22
+
+/* little-endian fields, as gzip and zip store them */
+static unsigned le16(const unsigned char *b)
+{
+	return b[0] | b[1] << 8;
+}
+
+static unsigned le32(const unsigned char *b)
+{
+	return b[0] | b[1] << 8 | b[2] << 16 | (unsigned)b[3] << 24;
+}
+
+/* the CRC-32 that gzip and zip keep of what they hold; the table is
+ * built on each call, which costs nothing next to a rom's worth of data */
+static unsigned long crc32(const unsigned char *data, size_t size)
+{
+	unsigned long table[256];
+	unsigned long crc = 0xffffffff;
+	unsigned i;
+	int k;
+
+	for (i = 0; i < 256; ++i)
+	{
+		unsigned long c = i;
+
+		for (k = 0; k < 8; ++k)
+			c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		table[i] = c;
+	}
+
+	while (size--)
+		crc = table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+	return ~crc & 0xffffffff;
+}
+
+/* whether the data begins like a gzip file or zip archive */
+int archive_detect(const void *data, size_t size)
+{
+	const unsigned char *b = data;
+
+	if (size < 4)
+		return 0;
+
+	return (b[0] == 0x1f && b[1] == 0x8b && b[2] == 8)
+		|| le32(b) == ZIP_LOCAL
+		|| le32(b) == ZIP_END
+	;
+}
+
+/* note why an archive couldn't be read (returns NULL) */
+static void *fail(const char **why, const char *reason)
+{
+	*why = reason;
+	return NULL;
+}
+
+/* take `size` bytes that gzip or zip stored or inflated, if their CRC-32
+ * is `crc` (frees them and returns NULL if it isn't) */
+static void *archive_check(void *data, size_t size, unsigned long crc, const char **why)
+{
+	if (crc32(data, size) != crc)
+	{
+		free(data);
+		return fail(why, "its crc32 doesn't match what it holds");
+	}
+
+	return data;
+}
+
+/* inflate raw deflate data into exactly `size` bytes of a new buffer */
+static void *archive_inflate(const unsigned char *src, size_t srcSz, size_t size, const char **why)
+{
+	unsigned char *dst;
+	z64dec_stream *stream;
+	size_t inDone = 0;
+	size_t outDone = 0;
+	int err;
+
+	if (!size)
+		return fail(why, "the file in it is empty");
+
+	dst = malloc_safe(size);
+
+	if ((err = z64dec_stream_open(&stream, Z64DEC_CODEC_ZLIB, 1)))
+	{
+		free(dst);
+		return fail(why, z64dec_strerror(err));
+	}
+
+	do
+	{
+		size_t in;
+		size_t out;
+
+		err = z64dec_stream_decode(stream
+			, src + inDone, srcSz - inDone, &in
+			, dst + outDone, size - outDone, &out
+		);
+		inDone += in;
+		outDone += out;
+
+		/* truncated, or longer than it claims to be */
+		if (err == Z64DEC_MORE && !in && !out)
+			err = Z64DEC_ERR_DATA;
+	} while (err == Z64DEC_MORE);
+	z64dec_stream_close(stream);
+
+	if (err || outDone != size)
+	{
+		free(dst);
+		return fail(why, z64dec_strerror(err ? err : Z64DEC_ERR_DATA));
+	}
+
+	return dst;
+}
+
+/* a gzip file holds one file, after a header of variable size */
+static void *archive_gzip(const unsigned char *data, size_t size, size_t *outSz, const char **why)
+{
+	unsigned flags = data[3];
+	size_t ofs = 10;
+	void *dst;
+
+	if (size < ofs + 8)
+		return fail(why, "not a valid gzip file");
+
+	if (flags & GZIP_FEXTRA)
+		ofs += 2 + le16(data + ofs);
+	if (flags & GZIP_FNAME)
+		while (ofs < size && data[ofs++])
+			;
+	if (flags & GZIP_FCOMMENT)
+		while (ofs < size && data[ofs++])
+			;
+	if (flags & GZIP_FHCRC)
+		ofs += 2;
+
+	/* the trailer holds the crc32 and size of what was inflated */
+	if (ofs + 8 > size)
+		return fail(why, "not a valid gzip file");
+	*outSz = le32(data + size - 4);
+
+	if (!(dst = archive_inflate(data + ofs, size - 8 - ofs, *outSz, why)))
+		return NULL;
+
+	return archive_check(dst, *outSz, le32(data + size - 8), why);
+}
+
+/* a zip archive's central directory, at its end, lists what it holds */
+static void *archive_zip(const unsigned char *data, size_t size, size_t *outSz, const char **why)
+{
+	const unsigned char *best = NULL;
+	const unsigned char *end = NULL;
+	const unsigned char *local;
+	void *dst;
+	size_t ofs;
+	size_t compSz;
+	unsigned count;
+	unsigned i;
+
+	/* the end record is followed by a comment of up to 64 KiB */
+	for (ofs = size - ZIP_END_SZ; size >= ZIP_END_SZ; --ofs)
+	{
+		if (le32(data + ofs) == ZIP_END)
+		{
+			end = data + ofs;
+			break;
+		}
+		if (!ofs || size - ofs >= ZIP_END_SZ + 0xffff)
+			break;
+	}
+	if (!end)
+		return fail(why, "not a valid zip archive");
+
+	/* take the largest file */
+	count = le16(end + 10);
+	ofs = le32(end + 16);
+	for (i = 0; i < count; ++i)
+	{
+		const unsigned char *c = data + ofs;
+
+		if (ofs + ZIP_CENTRAL_SZ > size || le32(c) != ZIP_CENTRAL)
+			return fail(why, "not a valid zip archive");
+
+		if (!best || le32(c + 24) > le32(best + 24))
+			best = c;
+
+		ofs += ZIP_CENTRAL_SZ + le16(c + 28) + le16(c + 30) + le16(c + 32);
+	}
+	if (!best || !le32(best + 24))
+		return fail(why, "the zip archive holds no files");
+
+	/* encrypted, or sizes only zip64 extensions can hold */
+	if ((le16(best + 8) & 1) || le32(best + 20) == 0xffffffff || le32(best + 24) == 0xffffffff)
+		return fail(why, "the zip archive is encrypted, or too large");
+
+	/* the file's data follows its local header */
+	ofs = le32(best + 42);
+	local = data + ofs;
+	if (ofs + ZIP_LOCAL_SZ > size || le32(local) != ZIP_LOCAL)
+		return fail(why, "not a valid zip archive");
+	ofs += ZIP_LOCAL_SZ + le16(local + 26) + le16(local + 28);
+	compSz = le32(best + 20);
+	*outSz = le32(best + 24);
+	if (ofs > size || compSz > size - ofs)
+		return fail(why, "not a valid zip archive");
+
+	switch (le16(best + 10))
+	{
+		case ZIP_STORED:
+			if (compSz != *outSz)
+				return fail(why, "not a valid zip archive");
+			dst = malloc_safe(*outSz);
+			memcpy(dst, data + ofs, *outSz);
+			break;
+
+		case ZIP_DEFLATED:
+			if (!(dst = archive_inflate(data + ofs, compSz, *outSz, why)))
+				return NULL;
+			break;
+
+		default:
+			return fail(why, "the zip archive uses an unsupported compression method");
+	}
+
+	/* the central directory holds the file's crc32 */
+	return archive_check(dst, *outSz, le32(best + 16), why);
+}
+
+/* inflate what a gzip file or zip archive holds */
+void *archive_unpack(const void *data, size_t size, size_t *outSz, const char **why)
+{
+	const unsigned char *b = data;
+
+	if (b[0] == 0x1f)
+		return archive_gzip(b, size, outSz, why);
+
+	return archive_zip(b, size, outSz, why);
+}
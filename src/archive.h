@@ -0,0 +1,19 @@
+#ifndef Z64DECOMPRESS_ARCHIVE_H_INCLUDED
+#define Z64DECOMPRESS_ARCHIVE_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+/* roms kept in .gz and .zip files are read without being extracted to
+ * disk first; what they hold is inflated straight into memory */
+
+/* whether `size` bytes of `data` begin like a gzip file or zip archive;
+ * four bytes are enough to tell */
+int archive_detect(const void *data, size_t size);
+
+/* inflate what the gzip file or zip archive loaded into `data` holds
+ * into a newly allocated buffer of *outSz bytes; of a zip archive holding
+ * several files, the largest is taken; returns NULL if it can't be read,
+ * with *why saying what is wrong */
+void *archive_unpack(const void *data, size_t size, size_t *outSz, const char **why);
+
+#endif /* Z64DECOMPRESS_ARCHIVE_H_INCLUDED */
@@ -0,0 +1,89 @@
+/*
+ * arena.c <z64.me>
+ *
+ * buffers that are reused from job to job instead of freed
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+ #include <windows.h>
+#else
+ #include <sys/mman.h>
+#endif
+
+#include "arena.h"
+#include "wow.h"
+
+/* mappings are made in multiples of this, which is also the size of a
+ * transparent huge page on x86-64 and arm64 */
+#define ARENA_GRANULE (2 * 1024 * 1024)
+
+/* set up an empty arena */
+void arena_init(struct arena *arena, int huge)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->huge = huge;
+}
+
+/* map `size` bytes of zeroes */
+static void *arena_map(size_t size, int huge)
+{
+	void *data;
+
+#ifdef _WIN32
+	(void)huge;
+	if (!(data = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE)))
+		die("memory error");
+#else
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+		die("memory error");
+ #ifdef MADV_HUGEPAGE
+	/* only a hint; without huge pages it works all the same */
+	if (huge)
+		madvise(data, size, MADV_HUGEPAGE);
+ #else
+	(void)huge;
+ #endif
+#endif
+
+	return data;
+}
+
+/* get at least `size` bytes; even none are mapped, so that a file that
+ * decompresses to nothing still has somewhere to go */
+void *arena_reserve(struct arena *arena, size_t size, int zero)
+{
+	if (size > arena->size || !arena->data)
+	{
+		arena_release(arena);
+		arena->size = ((size ? size : 1) + ARENA_GRANULE - 1) & ~(size_t)(ARENA_GRANULE - 1);
+		arena->data = arena_map(arena->size, arena->huge);
+		arena->fresh = 1;
+	}
+
+	/* a new mapping is already zero */
+	if (zero && !arena->fresh)
+		memset(arena->data, 0, size);
+	arena->fresh = 0;
+
+	return arena->data;
+}
+
+/* unmap an arena */
+void arena_release(struct arena *arena)
+{
+	if (!arena->data)
+		return;
+
+#ifdef _WIN32
+	VirtualFree(arena->data, 0, MEM_RELEASE);
+#else
+	munmap(arena->data, arena->size);
+#endif
+	arena->data = NULL;
+	arena->size = 0;
+}
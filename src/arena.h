@@ -0,0 +1,29 @@
+#ifndef Z64DECOMPRESS_ARENA_H_INCLUDED
+#define Z64DECOMPRESS_ARENA_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+/* a large buffer that stays mapped from one job to the next, so that
+ * running many jobs doesn't map, fault in, and unmap memory for each */
+struct arena
+{
+	unsigned char  *data;
+	size_t          size;    /* bytes mapped                        */
+	int             huge;    /* back it with transparent huge pages */
+	int             fresh;   /* non-zero until it is first reused   */
+};
+
+/* set up an empty arena; `huge` asks for transparent huge pages, where
+ * the system has them, to cut the page faults and tlb misses of
+ * walking through tens of megabytes */
+void arena_init(struct arena *arena, int huge);
+
+/* get at least `size` bytes; what they hold is lost if they had to be
+ * remapped, and otherwise is left over from the last job unless `zero`
+ * is given, in which case they are zero either way */
+void *arena_reserve(struct arena *arena, size_t size, int zero);
+
+/* unmap an arena */
+void arena_release(struct arena *arena);
+
+#endif /* Z64DECOMPRESS_ARENA_H_INCLUDED */
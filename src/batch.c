@@ -0,0 +1,515 @@
+/*
+ * batch.c <z64.me>
+ *
+ * decompressing many individual files in one run
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "z64decompress.h"
+#include "aio.h"
+#include "arena.h"
+#include "batch.h"
+#include "pool.h"
+#include "probes.h"
+#include "wow.h"
+
+/* where a slot is on its way through the pipeline */
+enum batchState
+{
+	SLOT_FREE,
+	SLOT_LOADING,    /* being read by the i/o thread      */
+	SLOT_LOADED,     /* waiting for a worker              */
+	SLOT_DECODING,
+	SLOT_DECODED,    /* waiting for the i/o thread        */
+	SLOT_STORING,    /* being written by the i/o thread   */
+};
+
+/* a file on its way from being loaded to being stored; its buffers are
+ * reused by the files that pass through it after */
+struct batchSlot
+{
+	struct aio_file  io;
+	struct arena     in;
+	struct arena     out;
+	size_t           decSz;
+	int              n;        /* index of the file it holds */
+	enum batchState  state;
+};
+
+/* state shared by the threads decompressing files */
+struct batchJob
+{
+	char           **files;
+	char           **names;    /* what each file is decompressed to  */
+	int              count;
+	const char      *dir;
+	int              codec;
+	struct aio      *aio;
+	struct batchSlot *slot;
+	int              slots;
+	pthread_mutex_t  lock;
+	pthread_cond_t   loaded;   /* a slot was loaded, or none will be */
+	int              next;     /* next file to load                  */
+	int              unloaded; /* files not loaded yet               */
+	int              finished; /* files stored, or that failed       */
+	int              failed;   /* files that failed                  */
+};
+
+static int byName(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* list the individual files named by paths */
+int batch_list(char **paths, int count, char ***files)
+{
+	int num = 0;
+	int cap = 16;
+	int i;
+
+	*files = malloc_safe(sizeof(**files) * cap);
+
+	for (i = 0; i < count; ++i)
+	{
+		struct dirent *ent;
+		DIR *dir;
+		int first = num;
+
+		if (!wow_is_dir(paths[i]))
+		{
+			if (num == cap)
+				*files = realloc_safe(*files, sizeof(**files) * (cap *= 2));
+			(*files)[num++] = strdup_safe(paths[i]);
+			continue;
+		}
+
+		if (!(dir = opendir(paths[i])))
+			die("failed to open directory '%s'", paths[i]);
+
+		while ((ent = readdir(dir)))
+		{
+			char *fn;
+
+			if (*ent->d_name == '.')
+				continue;
+
+			fn = malloc_safe(strlen(paths[i]) + strlen(ent->d_name) + 2);
+			sprintf(fn, "%s/%s", paths[i], ent->d_name);
+			if (wow_is_dir(fn))
+			{
+				free(fn);
+				continue;
+			}
+
+			if (num == cap)
+				*files = realloc_safe(*files, sizeof(**files) * (cap *= 2));
+			(*files)[num++] = fn;
+		}
+		closedir(dir);
+
+		qsort(*files + first, num - first, sizeof(**files), byName);
+	}
+
+	return num;
+}
+
+/* free a list made by batch_list() */
+void batch_free(char **files, int count)
+{
+	while (count--)
+		free(files[count]);
+	free(files);
+}
+
+/* name of the file that `in` is decompressed to in dir */
+char *batch_name(const char *dir, const char *in)
+{
+	const char *name = in;
+	const char *ext;
+	const char *c;
+	char *out;
+
+	/* drop the directories */
+	for (c = in; *c; ++c)
+		if (*c == '/' || *c == '\\')
+			name = c + 1;
+
+	/* and the extension */
+	if (!(ext = strrchr(name, '.')) || ext == name)
+		ext = name + strlen(name);
+
+	out = malloc_safe(strlen(dir) + (ext - name) + 8);
+	sprintf(out, "%s/%.*s.bin", dir, (int)(ext - name), name);
+
+	return out;
+}
+
+/* a file's output name, for finding files decompressed to the same one */
+struct batchName
+{
+	const char *name;
+	int         n;
+};
+
+static int byOutput(const void *a, const void *b)
+{
+	const struct batchName *x = a;
+	const struct batchName *y = b;
+	int d = strcmp(x->name, y->name);
+
+	return d ? d : x->n - y->n;
+}
+
+/* name the files' outputs in job->names, leaving out any file that would
+ * be decompressed to the same file as one listed before it, as files
+ * differing only in their extension or directory are; those are
+ * reported (returns how many were left out) */
+static int batchNames(struct batchJob *job, char **files, int count)
+{
+	struct batchName *sorted = malloc_safe(sizeof(*sorted) * count);
+	char *skip = calloc_safe(count, 1);
+	int skipped = 0;
+	int first = 0;
+	int i;
+
+	for (i = 0; i < count; ++i)
+	{
+		sorted[i].name = batch_name(job->dir, files[i]);
+		sorted[i].n = i;
+	}
+	qsort(sorted, count, sizeof(*sorted), byOutput);
+
+	/* the first of each run of the same name is kept */
+	for (i = 1; i < count; ++i)
+	{
+		if (strcmp(sorted[i].name, sorted[first].name))
+		{
+			first = i;
+			continue;
+		}
+
+		fprintf(stderr, "WARNING: '%s' and '%s' would both be decompressed to '%s'\n"
+			, files[sorted[first].n], files[sorted[i].n], sorted[first].name
+		);
+		skip[sorted[i].n] = 1;
+		++skipped;
+	}
+
+	job->files = malloc_safe(sizeof(*job->files) * count);
+	job->names = malloc_safe(sizeof(*job->names) * count);
+	for (i = 0; i < count; ++i)
+	{
+		if (skip[sorted[i].n])
+			free((char*)sorted[i].name);
+		else
+			job->names[sorted[i].n] = (char*)sorted[i].name;
+	}
+	for (i = 0; i < count; ++i)
+	{
+		if (skip[i])
+			continue;
+		job->files[job->count] = files[i];
+		job->names[job->count] = job->names[i];
+		++job->count;
+	}
+
+	free(sorted);
+	free(skip);
+
+	return skipped;
+}
+
+/* fit the slots, and the workers decompressing in them, within `budget`
+ * bytes; every slot's buffers grow to hold the largest file loaded and
+ * the largest decompressed, whose sizes are read from the files' headers
+ * (returns the number of workers) */
+static int batchBudget(struct batchJob *job, size_t budget, int workers)
+{
+	size_t inMax = 0;
+	size_t outMax = 0;
+	size_t fit;
+	int i;
+
+	for (i = 0; i < job->count; ++i)
+	{
+		unsigned char header[16];
+		size_t size;
+		size_t decSz;
+		FILE *fp;
+
+		if (!(fp = wow_fopen(job->files[i], "rb")))
+			continue;
+		if (fread(header, 1, sizeof(header), fp) != sizeof(header)
+			|| z64dec_file_size(header, sizeof(header), &decSz)
+		)
+			decSz = Z64DEC_FILE_MAX;
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		fclose(fp);
+
+		if (size > inMax)
+			inMax = size;
+		if (decSz > outMax)
+			outMax = decSz;
+	}
+
+	/* no files, or none that could be opened, which the i/o thread
+	 * reports as it fails to load them */
+	if (!inMax && !outMax)
+		return workers;
+
+	if (inMax + outMax > budget)
+		die("ERROR: this needs %lu bytes, more than --max-memory allows"
+			, (unsigned long)(inMax + outMax)
+		);
+	fit = budget / (inMax + outMax);
+
+	/* fewer slots loading and storing ahead first, then fewer workers */
+	if ((size_t)job->slots > fit)
+	{
+		job->slots = fit;
+		if (workers > job->slots)
+		{
+			workers = job->slots;
+			fprintf(stderr, "using %d thread%s to stay within --max-memory\n", workers, workers == 1 ? "" : "s");
+		}
+	}
+
+	return workers;
+}
+
+/* decompress a loaded file into its slot's output buffer (returns
+ * non-zero if it failed) */
+static int batchDecode(struct batchJob *job, struct batchSlot *slot)
+{
+	const char *fn = job->files[slot->n];
+	unsigned char *dst;
+	size_t dstSz;
+	int err;
+
+	if (z64dec_file_size(slot->in.data, slot->io.size, &dstSz))
+		dstSz = Z64DEC_FILE_MAX;
+	dst = arena_reserve(&slot->out, dstSz, 0);
+	if ((err = z64dec_file(slot->in.data, slot->io.size, dst, dstSz, &slot->decSz, job->codec)))
+	{
+		fprintf(stderr, "WARNING: '%s': %s\n", fn, z64dec_strerror(err));
+		return 1;
+	}
+
+	return 0;
+}
+
+/* take loaded files and decompress them until there are none left */
+static void batchWorker(void *udata, int worker)
+{
+	struct batchJob *job = udata;
+
+	(void)worker;
+
+	for (;;)
+	{
+		struct batchSlot *slot = NULL;
+		int i;
+
+		/* the earliest file that has been loaded */
+		pthread_mutex_lock(&job->lock);
+		for (;;)
+		{
+			for (i = 0; i < job->slots; ++i)
+				if (job->slot[i].state == SLOT_LOADED && (!slot || job->slot[i].n < slot->n))
+					slot = &job->slot[i];
+			if (slot || !job->unloaded)
+				break;
+			pthread_cond_wait(&job->loaded, &job->lock);
+		}
+		if (!slot)
+		{
+			pthread_mutex_unlock(&job->lock);
+			break;
+		}
+		slot->state = SLOT_DECODING;
+		pthread_mutex_unlock(&job->lock);
+
+		if (batchDecode(job, slot))
+		{
+			pthread_mutex_lock(&job->lock);
+			job->failed += 1;
+			job->finished += 1;
+			slot->state = SLOT_FREE;
+		}
+		else
+		{
+			pthread_mutex_lock(&job->lock);
+			slot->state = SLOT_DECODED;
+		}
+		pthread_mutex_unlock(&job->lock);
+
+		/* the i/o thread has a slot to store or refill */
+		aio_wake(job->aio);
+	}
+}
+
+/* a file failed to load or store */
+static void batchIoFailed(struct batchJob *job, const struct aio_file *io)
+{
+	static const char *what[2][AIO_ERR_IO + 1] = {
+		{ "", "failed to open '%s' for reading", "size of file '%s' is zero", "failed to read contents of '%s'" },
+		{ "", "failed to open '%s' for writing", "", "failed to write contents of '%s'" },
+	};
+
+	fprintf(stderr, "WARNING: ");
+	fprintf(stderr, what[io->store != 0][io->error], io->fn);
+	fprintf(stderr, "\n");
+	job->failed += 1;
+}
+
+/* keep files loading into free slots, and decompressed files storing,
+ * while the workers decompress */
+static void *batchIo(void *udata)
+{
+	struct batchJob *job = udata;
+	int i;
+
+	pthread_mutex_lock(&job->lock);
+	while (job->finished < job->count)
+	{
+		struct batchSlot *slot;
+		struct aio_file *io;
+
+		/* only this thread touches free and decoded slots, so the lock
+		 * needn't be held while they are submitted */
+		for (i = 0; i < job->slots; ++i)
+		{
+			slot = &job->slot[i];
+
+			if (slot->state == SLOT_FREE && job->next < job->count)
+			{
+				slot->n = job->next++;
+				slot->state = SLOT_LOADING;
+				slot->io.fn = job->files[slot->n];
+				slot->io.data = &slot->in;
+				slot->io.store = 0;
+			}
+			else if (slot->state == SLOT_DECODED)
+			{
+				slot->state = SLOT_STORING;
+				slot->io.fn = job->names[slot->n];
+				slot->io.data = &slot->out;
+				slot->io.size = slot->decSz;
+				slot->io.store = 1;
+				PROBE2(write__start, slot->n, slot->decSz);
+			}
+			else
+				continue;
+
+			pthread_mutex_unlock(&job->lock);
+			aio_submit(job->aio, &slot->io);
+			pthread_mutex_lock(&job->lock);
+		}
+		pthread_mutex_unlock(&job->lock);
+
+		io = aio_wait(job->aio);
+
+		pthread_mutex_lock(&job->lock);
+		if (!io)
+			continue;
+
+		slot = io->udata;
+		if (io->error)
+			batchIoFailed(job, io);
+
+		if (!io->store)
+		{
+			if (io->error)
+			{
+				job->finished += 1;
+				slot->state = SLOT_FREE;
+			}
+			else
+				slot->state = SLOT_LOADED;
+
+			/* once nothing is left to load, idle workers can stop */
+			job->unloaded -= 1;
+			if (!job->unloaded)
+				pthread_cond_broadcast(&job->loaded);
+			else if (!io->error)
+				pthread_cond_signal(&job->loaded);
+		}
+		else
+		{
+			PROBE2(write__done, slot->n, slot->decSz);
+			job->finished += 1;
+			slot->state = SLOT_FREE;
+		}
+	}
+	pthread_mutex_unlock(&job->lock);
+
+	return NULL;
+}
+
+/* decompress individual files into dir */
+int batch_files(char **files, int count, const char *dir, int codec, int huge, enum aio_backend io, size_t budget, struct pool *pool)
+{
+	struct batchJob job;
+	pthread_t ioThread;
+	int workers = pool_threads(pool);
+	int i;
+
+	if (!wow_is_dir(dir) && wow_mkdir(dir))
+		die("failed to create directory '%s'", dir);
+
+	memset(&job, 0, sizeof(job));
+	job.dir = dir;
+	job.codec = codec;
+	job.failed = batchNames(&job, files, count);
+	job.unloaded = job.count;
+
+	if (workers > job.count)
+		workers = job.count;
+
+	/* besides one slot per worker, as many again are loading the next
+	 * files or storing the last ones, so the disk is kept busy while
+	 * every worker is decompressing */
+	job.slots = workers * 2 + 2;
+	if (budget)
+		workers = batchBudget(&job, budget, workers);
+	job.slot = calloc_safe(job.slots, sizeof(*job.slot));
+	for (i = 0; i < job.slots; ++i)
+	{
+		arena_init(&job.slot[i].in, huge);
+		arena_init(&job.slot[i].out, huge);
+		job.slot[i].io.udata = &job.slot[i];
+	}
+	job.aio = aio_new(io, job.slots);
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.loaded, NULL);
+
+	/* workers take files as they are loaded, so a few large files don't
+	 * hold up the rest */
+	if (pthread_create(&ioThread, NULL, batchIo, &job))
+		die("failed to create i/o thread");
+	pool_for(pool, workers, batchWorker, &job);
+	pthread_join(ioThread, NULL);
+
+	pthread_cond_destroy(&job.loaded);
+	pthread_mutex_destroy(&job.lock);
+	aio_free(job.aio);
+	for (i = 0; i < job.slots; ++i)
+	{
+		arena_release(&job.slot[i].in);
+		arena_release(&job.slot[i].out);
+	}
+	free(job.slot);
+	for (i = 0; i < job.count; ++i)
+		free(job.names[i]);
+	free(job.names);
+	free(job.files);
+
+	return job.failed;
+}
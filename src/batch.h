@@ -0,0 +1,27 @@
+#ifndef Z64DECOMPRESS_BATCH_H_INCLUDED
+#define Z64DECOMPRESS_BATCH_H_INCLUDED
+
+#include "aio.h"
+
+struct pool;
+
+/* list the individual files named by `paths`: files as-is, and every
+ * file in directories, in name order (returns the number listed) */
+int batch_list(char **paths, int count, char ***files);
+
+/* free a list made by batch_list() */
+void batch_free(char **files, int count);
+
+/* name of the file that `in` is decompressed to in dir: its name with
+ * the extension replaced by .bin */
+char *batch_name(const char *dir, const char *in);
+
+/* decompress individual files into dir across the threads in `pool`,
+ * while a thread of its own loads the next files and stores finished
+ * ones through the `io` backend; the buffers are arenas reused from file
+ * to file, with huge pages if `huge` is set, and kept within `budget`
+ * bytes by running fewer threads if it isn't 0; failures are reported
+ * on stderr (returns the number of files that failed) */
+int batch_files(char **files, int count, const char *dir, int codec, int huge, enum aio_backend io, size_t budget, struct pool *pool);
+
+#endif /* Z64DECOMPRESS_BATCH_H_INCLUDED */
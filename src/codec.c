@@ -0,0 +1,69 @@
+/*
+ * codec.c <z64.me>
+ *
+ * the decompression codecs z64decompress knows about
+ *
+ */
+
+#include <string.h>
+
+#include "decoder/decoder.h"
+#include "decoder/reader.h"
+#include "codec.h"
+
+const CodecInfo decCodecInfo[CODEC_MAX] = {
+	[CODEC_YAZ0]  = { "yaz"  , "Yaz0", yazdec , yazstream , 0x1000 },
+	[CODEC_LZO]   = { "lzo"  , "LZO0", lzodec , lzostream , 0xC000 },
+	[CODEC_UCL]   = { "ucl"  , "UCL0", ucldec , uclstream , 0      },
+	[CODEC_APLIB] = { "aplib", "APL0", apldec , aplstream , 0      },
+	[CODEC_ZLIB ] = { "zlib" , "ZLIB", zlibdec, zlibstream, 0x8000 },
+};
+
+Codec get_codec_type_from_name(const char *name)
+{
+	for (int i = 0; i < CODEC_MAX; i++)
+	{
+		if (!strcmp(name, decCodecInfo[i].name))
+		{
+			return (Codec)i;
+		}
+	}
+	return CODEC_NONE;
+}
+
+Codec get_codec_type_from_header(const void *header) {
+    for (int i = 0; i < CODEC_MAX; i++)
+    {
+        if (!memcmp(decCodecInfo[i].header, header, 4))
+        {
+            return (Codec)i;
+        }
+    }
+    return CODEC_NONE;
+}
+
+/* determine which codec a compressed file uses (CODEC_NONE if unknown) */
+Codec pick_codec(const void *src, Codec codecOverride)
+{
+	/* override codec if requested rather than autodetecting it */
+	if (codecOverride != CODEC_NONE)
+		return codecOverride;
+	
+	/* the codec header is the first 4 bytes of the file */
+	return get_codec_type_from_header(src);
+}
+
+/* decompress with a codec's one-shot decoder */
+int codec_decode(Codec codec, const struct decreader *src, void *dst, size_t *decSz)
+{
+	switch (decCodecInfo[codec].decode(src, dst, decSz))
+	{
+		case DECODE_OK:
+			return Z64DEC_OK;
+
+		case DECODE_ERR_READ:
+			return Z64DEC_ERR_READ;
+	}
+
+	return Z64DEC_ERR_DATA;
+}
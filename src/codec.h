@@ -0,0 +1,45 @@
+#ifndef Z64DECOMPRESS_CODEC_H_INCLUDED
+#define Z64DECOMPRESS_CODEC_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+#include "z64decompress.h"
+
+typedef enum {
+	CODEC_NONE  = Z64DEC_CODEC_AUTO,
+	CODEC_YAZ0  = Z64DEC_CODEC_YAZ,
+	CODEC_LZO   = Z64DEC_CODEC_LZO,
+	CODEC_UCL   = Z64DEC_CODEC_UCL,
+	CODEC_APLIB = Z64DEC_CODEC_APLIB,
+	CODEC_ZLIB  = Z64DEC_CODEC_ZLIB,
+	CODEC_MAX   = Z64DEC_CODEC_MAX
+} Codec;
+
+struct decreader;
+struct decstream;
+
+typedef struct {
+	const char *name; /* name used for program args */
+	const char *header; /* identifer used in the headers of compressed files */
+	int (*decode)(const struct decreader *src, void *dst, size_t *decSz); /* decompression handler function */
+	int (*stream)(struct decstream *s); /* incremental decompression handler function */
+	unsigned window; /* most distant back reference (0 = unlimited) */
+} CodecInfo;
+
+extern const CodecInfo decCodecInfo[CODEC_MAX];
+
+/* get codec by the name used for program args */
+Codec get_codec_type_from_name(const char *name);
+
+/* get codec from the header of a compressed file */
+Codec get_codec_type_from_header(const void *header);
+
+/* determine which codec a compressed file uses (CODEC_NONE if unknown) */
+Codec pick_codec(const void *src, Codec codecOverride);
+
+/* decompress the file `src` reads into dst, which has room for
+ * src->dst_size bytes; *decSz receives the bytes decompressed, which
+ * with zlib may be more than fit (returns Z64DEC_ERR_*) */
+int codec_decode(Codec codec, const struct decreader *src, void *dst, size_t *decSz);
+
+#endif /* Z64DECOMPRESS_CODEC_H_INCLUDED */
@@ -0,0 +1,452 @@
+/*
+ * counters.c <z64.me>
+ *
+ * hardware performance counters around each file's decompression, to
+ * tell whether a codec is bound by branch mispredictions, cache misses,
+ * or plain instruction count
+ *
+ */
+
+#ifdef __linux__
+ #define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef __linux__
+ #include <unistd.h>
+ #include <sys/ioctl.h>
+ #include <sys/syscall.h>
+ #include <linux/perf_event.h>
+#endif
+
+#include "counters.h"
+#include "stats.h"
+#include "wow.h"
+#include "threadlocal.h"
+
+/* the counters read, in the order they are opened */
+enum counter
+{
+	COUNTER_CYCLES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_BRANCH_MISSES,
+	COUNTER_CACHE_MISSES,
+	COUNTER_DTLB_MISSES,
+	COUNTER_MAX
+};
+
+/* counts, or how far they advanced */
+struct sample
+{
+	uint64_t       v[COUNTER_MAX];
+};
+
+/* a dma entry */
+struct file
+{
+	double         start;      /* when it began decompressing       */
+	double         seconds;
+	struct sample  begin;      /* counts when it began              */
+	struct sample  count;      /* counts spent decompressing it     */
+	size_t         decSz;
+	unsigned       vstart;
+	int            index;
+	int            codec;      /* Z64DEC_CODEC_AUTO if copied       */
+	int            done;       /* non-zero once it has been taken   */
+};
+
+/* the counters of one thread, which only count that thread */
+struct group
+{
+	int            fd[COUNTER_MAX];   /* -1 if unavailable          */
+	int            leader;            /* fd the group is read from  */
+	int            pos[COUNTER_MAX];  /* position of each in reads  */
+	int            opened;
+	struct group  *next;
+};
+
+struct counters
+{
+	pthread_mutex_t lock;
+	struct group   *groups;    /* every thread's, to close them     */
+	struct file    *file;      /* one per dma entry                 */
+	int             files;
+	int             error;     /* errno if nothing could be opened  */
+	int             have[COUNTER_MAX];  /* opened on any thread     */
+};
+
+/* names of counters, as printed */
+static const char *counterName[COUNTER_MAX] = {
+	[COUNTER_CYCLES]        = "cycles",
+	[COUNTER_INSTRUCTIONS]  = "instructions",
+	[COUNTER_BRANCH_MISSES] = "branch-misses",
+	[COUNTER_CACHE_MISSES]  = "cache-misses",
+	[COUNTER_DTLB_MISSES]   = "dTLB-load-misses",
+};
+
+/* the calling thread's counters, opened when it first decompresses;
+ * there is only one struct counters per process */
+static THREADLOCAL struct group *threadGroup;
+
+#ifdef __linux__
+
+/* open one counter of the calling thread, in user space only so that
+ * the default perf_event_paranoid setting allows it */
+static int counter_open(enum counter which, int leader)
+{
+	static const struct
+	{
+		uint32_t  type;
+		uint64_t  config;
+	} counter[COUNTER_MAX] = {
+		[COUNTER_CYCLES]        = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		[COUNTER_INSTRUCTIONS]  = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		[COUNTER_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		[COUNTER_CACHE_MISSES]  = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		[COUNTER_DTLB_MISSES]   = { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB
+			| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+			| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+		},
+	};
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = counter[which].type;
+	attr.config = counter[which].config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.disabled = leader < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+/* open the calling thread's counters as one group, so they are all
+ * counting at the same time and can be read at once */
+static void group_open(struct counters *counters, struct group *g)
+{
+	int err = 0;
+	int i;
+
+	g->leader = -1;
+	for (i = 0; i < COUNTER_MAX; ++i)
+	{
+		g->pos[i] = -1;
+		if ((g->fd[i] = counter_open(i, g->leader)) < 0)
+		{
+			err = errno;
+			continue;
+		}
+		if (g->leader < 0)
+			g->leader = g->fd[i];
+		g->pos[i] = g->opened++;
+	}
+
+	pthread_mutex_lock(&counters->lock);
+	if (g->leader < 0 && !counters->error)
+		counters->error = err ? err : ENOENT;
+	for (i = 0; i < COUNTER_MAX; ++i)
+		counters->have[i] |= g->fd[i] >= 0;
+	pthread_mutex_unlock(&counters->lock);
+
+	if (g->leader >= 0)
+		ioctl(g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/* read the calling thread's counters */
+static void group_read(const struct group *g, struct sample *s)
+{
+	uint64_t buf[1 + COUNTER_MAX];
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	if (g->leader < 0 || read(g->leader, buf, sizeof(buf)) < (ssize_t)sizeof(*buf))
+		return;
+
+	for (i = 0; i < COUNTER_MAX; ++i)
+		if (g->pos[i] >= 0 && (uint64_t)g->pos[i] < buf[0])
+			s->v[i] = buf[1 + g->pos[i]];
+}
+
+static void group_close(struct group *g)
+{
+	int i;
+
+	for (i = 0; i < COUNTER_MAX; ++i)
+		if (g->fd[i] >= 0)
+			close(g->fd[i]);
+}
+
+#else /* !__linux__ */
+
+static void group_open(struct counters *counters, struct group *g)
+{
+	int i;
+
+	g->leader = -1;
+	for (i = 0; i < COUNTER_MAX; ++i)
+		g->fd[i] = g->pos[i] = -1;
+
+	pthread_mutex_lock(&counters->lock);
+	counters->error = ENOSYS;
+	pthread_mutex_unlock(&counters->lock);
+}
+
+static void group_read(const struct group *g, struct sample *s)
+{
+	(void)g;
+	memset(s, 0, sizeof(*s));
+}
+
+static void group_close(struct group *g)
+{
+	(void)g;
+}
+
+#endif /* __linux__ */
+
+/* the calling thread's counters */
+static struct group *thread_group(struct counters *counters)
+{
+	struct group *g = threadGroup;
+
+	if (g)
+		return g;
+
+	g = calloc_safe(1, sizeof(*g));
+	group_open(counters, g);
+
+	pthread_mutex_lock(&counters->lock);
+	g->next = counters->groups;
+	counters->groups = g;
+	pthread_mutex_unlock(&counters->lock);
+
+	return threadGroup = g;
+}
+
+/* begin counting */
+struct counters *counters_new(void)
+{
+	struct counters *counters = calloc_safe(1, sizeof(*counters));
+
+	pthread_mutex_init(&counters->lock, NULL);
+
+	return counters;
+}
+
+/* count each file decompressed from `rom` */
+void counters_attach(struct counters *counters, const z64dec_rom *rom)
+{
+	struct z64dec_info info;
+	int i;
+
+	if (!counters)
+		return;
+
+	z64dec_rom_info(rom, &info);
+	counters->files = info.entries;
+	counters->file = calloc_safe(info.entries + 1, sizeof(*counters->file));
+
+	for (i = 0; i < info.entries; ++i)
+	{
+		struct file *f = &counters->file[i];
+		struct z64dec_entry e;
+
+		z64dec_rom_entry(rom, i, &e);
+		f->index = i;
+		f->vstart = e.vstart;
+		f->decSz = e.vend - e.vstart;
+	}
+}
+
+/* library events: each file is counted on the thread decompressing it,
+ * and only its own slot is written (see z64dec_rom_set_events()) */
+void counters_event(struct counters *counters, const struct z64dec_event *event)
+{
+	struct file *f;
+	struct sample now;
+	int i;
+
+	if (!counters
+		|| (event->type != Z64DEC_EVENT_ENTRY_BEGIN && event->type != Z64DEC_EVENT_ENTRY_END)
+	)
+		return;
+
+	f = &counters->file[event->index];
+
+	/* the clock is read outside of the counted span */
+	if (event->type == Z64DEC_EVENT_ENTRY_BEGIN)
+	{
+		struct group *g = thread_group(counters);
+
+		f->start = stats_now();
+		group_read(g, &f->begin);
+		return;
+	}
+
+	group_read(threadGroup, &now);
+	f->seconds = stats_now() - f->start;
+	for (i = 0; i < COUNTER_MAX; ++i)
+		f->count.v[i] = now.v[i] - f->begin.v[i];
+	f->codec = event->codec;
+	f->done = !event->error;
+}
+
+/* files that took the most cycles first */
+static int most_cycles(const void *a, const void *b)
+{
+	const struct file *fa = a;
+	const struct file *fb = b;
+
+	if (fa->done != fb->done)
+		return fb->done - fa->done;
+
+	if (fa->count.v[COUNTER_CYCLES] != fb->count.v[COUNTER_CYCLES])
+		return fa->count.v[COUNTER_CYCLES] < fb->count.v[COUNTER_CYCLES] ? 1 : -1;
+
+	if (fa->seconds != fb->seconds)
+		return fa->seconds < fb->seconds ? 1 : -1;
+
+	return fa->index - fb->index;
+}
+
+/* print one row: throughput, then each counter relative to the bytes
+ * decompressed, with instructions per cycle in place of instructions */
+static void print_row(const struct counters *counters, const struct sample *s, size_t decSz, double seconds)
+{
+	const uint64_t *v = s->v;
+	double kb = decSz / 1024.0;
+	int i;
+
+	fprintf(stderr, " %10.2f", seconds > 0 ? decSz / (seconds * 1e6) : 0);
+
+	if (counters->have[COUNTER_CYCLES] && decSz)
+		fprintf(stderr, " %10.2f", (double)v[COUNTER_CYCLES] / decSz);
+	else
+		fprintf(stderr, " %10s", "-");
+
+	if (counters->have[COUNTER_CYCLES] && counters->have[COUNTER_INSTRUCTIONS] && v[COUNTER_CYCLES])
+		fprintf(stderr, " %6.2f", (double)v[COUNTER_INSTRUCTIONS] / v[COUNTER_CYCLES]);
+	else
+		fprintf(stderr, " %6s", "-");
+
+	for (i = COUNTER_BRANCH_MISSES; i <= COUNTER_DTLB_MISSES; ++i)
+	{
+		if (counters->have[i] && kb > 0)
+			fprintf(stderr, " %14.2f", v[i] / kb);
+		else
+			fprintf(stderr, " %14s", "-");
+	}
+
+	fprintf(stderr, "\n");
+}
+
+/* print the counts per codec and for the files that took the most cycles */
+void counters_print(struct counters *counters, int top)
+{
+	struct sample codecCount[Z64DEC_CODEC_MAX + 1] = { { { 0 } } };
+	double codecTime[Z64DEC_CODEC_MAX + 1] = { 0 };
+	size_t codecDec[Z64DEC_CODEC_MAX + 1] = { 0 };
+	int codecFiles[Z64DEC_CODEC_MAX + 1] = { 0 };
+	int i;
+	int k;
+
+	if (!counters)
+		return;
+
+	/* nothing could be counted; say why */
+	if (counters->error)
+	{
+		fprintf(stderr, "\nhardware counters unavailable: %s", strerror(counters->error));
+#ifdef __linux__
+		if (counters->error == EACCES || counters->error == EPERM)
+			fprintf(stderr, " (see /proc/sys/kernel/perf_event_paranoid)");
+#endif
+		fprintf(stderr, "\n");
+		return;
+	}
+
+	/* sum up the files; slot 0 holds those that were copied */
+	for (i = 0; i < counters->files; ++i)
+	{
+		const struct file *f = &counters->file[i];
+		int slot = f->codec - Z64DEC_CODEC_AUTO;
+
+		if (!f->done)
+			continue;
+
+		for (k = 0; k < COUNTER_MAX; ++k)
+			codecCount[slot].v[k] += f->count.v[k];
+		codecTime[slot] += f->seconds;
+		codecDec[slot] += f->decSz;
+		codecFiles[slot] += 1;
+	}
+
+	/* some counters may be missing, such as cache misses in some vms */
+	for (k = 0; k < COUNTER_MAX; ++k)
+		if (!counters->have[k])
+			fprintf(stderr, "\nhardware counter '%s' unavailable", counterName[k]);
+
+	fprintf(stderr, "\n%-10s %6s %10s %10s %6s %14s %14s %14s\n"
+		, "codec", "files", "MB/s", "cycles/B", "IPC", "br-misses/KB", "c-misses/KB", "tlb-misses/KB"
+	);
+	for (i = 0; i <= Z64DEC_CODEC_MAX; ++i)
+	{
+		if (!codecFiles[i])
+			continue;
+
+		fprintf(stderr, "%-10s %6d"
+			, i ? z64dec_codec_name(i + Z64DEC_CODEC_AUTO) : "copy", codecFiles[i]
+		);
+		print_row(counters, &codecCount[i], codecDec[i], codecTime[i]);
+	}
+
+	qsort(counters->file, counters->files, sizeof(*counters->file), most_cycles);
+	if (top > counters->files)
+		top = counters->files;
+	while (top > 0 && !counters->file[top - 1].done)
+		--top;
+
+	if (top)
+		fprintf(stderr, "\n%-6s %-10s %-6s %10s %10s %6s %14s %14s %14s\n"
+			, "index", "vstart", "codec", "MB/s", "cycles/B", "IPC", "br-misses/KB", "c-misses/KB", "tlb-misses/KB"
+		);
+	for (i = 0; i < top; ++i)
+	{
+		const struct file *f = &counters->file[i];
+
+		fprintf(stderr, "%-6d 0x%08X %-6s"
+			, f->index, f->vstart
+			, f->codec == Z64DEC_CODEC_AUTO ? "copy" : z64dec_codec_name(f->codec)
+		);
+		print_row(counters, &f->count, f->decSz, f->seconds);
+	}
+}
+
+/* stop counting */
+void counters_free(struct counters *counters)
+{
+	struct group *next;
+	struct group *g;
+
+	if (!counters)
+		return;
+
+	for (g = counters->groups; g; g = next)
+	{
+		next = g->next;
+		group_close(g);
+		free(g);
+	}
+
+	pthread_mutex_destroy(&counters->lock);
+	free(counters->file);
+	free(counters);
+}
@@ -0,0 +1,33 @@
+#ifndef Z64DECOMPRESS_COUNTERS_H_INCLUDED
+#define Z64DECOMPRESS_COUNTERS_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+#include "z64decompress.h"
+
+/* hardware performance counters (cycles, instructions, branch misses,
+ * cache misses, and data tlb misses) around each file's decompression, summed per codec and
+ * per dma entry; on Linux these come from perf_event_open(), and where
+ * they can't be had the reason is reported instead; every function may
+ * be called from several threads at once, and does nothing when given
+ * a NULL counters */
+struct counters;
+
+/* begin counting */
+struct counters *counters_new(void);
+
+/* count each file decompressed from `rom`; the rom's events must then
+ * be passed to counters_event() */
+void counters_attach(struct counters *counters, const z64dec_rom *rom);
+
+/* handle an event reported by z64dec_rom_set_events() */
+void counters_event(struct counters *counters, const struct z64dec_event *event);
+
+/* print the counts per codec and for the `top` files that took the most
+ * cycles on stderr */
+void counters_print(struct counters *counters, int top);
+
+/* stop counting */
+void counters_free(struct counters *counters);
+
+#endif /* Z64DECOMPRESS_COUNTERS_H_INCLUDED */
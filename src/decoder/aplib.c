@@ -12,13 +12,18 @@
  */
 
 #include "private.h"
+#include "stream.h"
 
 struct decoder
 {
-	unsigned char   buf[1024];   /* intermediate buffer for loading  */
+	unsigned char   defbuf[DECREADER_BUF_DEFAULT]; /* `buf` if reader lacks one */
+	unsigned char  *buf;         /* intermediate buffer for loading  */
+	unsigned int    buf_size;    /* size of `buf`                    */
+	const struct decreader *reader; /* source of compressed data     */
+	int             err;         /* first DECODE_ERR_* met           */
 	unsigned char  *buf_end;     /* pointer that exists for the sole *
 	                              * purpose of getting size of `buf` */
-	unsigned char  *pstart;      /* offset of next read from rom     */
+	size_t          pstart;      /* offset of next read from file    */
 	unsigned int    remaining;   /* remaining size of file           */
 	unsigned char  *buf_limit;   /* points to end of scannable area  *
 	                              * of buf; this prevents yaz parser *
@@ -36,7 +41,11 @@ struct APDSTATE {
 	unsigned int bitcount;
 };
 
-static struct decoder dec;
+static THREADLOCAL struct decoder dec;
+
+/* most compressed bytes one iteration of the main loop consumes; its
+ * two gamma codes alone can span a dozen bytes */
+#define LOOKAHEAD 32
 
 static void *refill(unsigned char *ip)
 {
@@ -44,22 +53,26 @@ static void *refill(unsigned char *ip)
 	unsigned size;
 	
 	/* intermediate buffer is not yet due for a refill */
-	if (ip < dec.buf_end - 8)
+	if (ip < dec.buf_end - LOOKAHEAD)
 		return ip;
 	
-	/* the number 8 is used throughout to ensure *
-	 * dma transfers are always 8 byte aligned   */
+	/* the file ended before its end marker */
+	if (DECREADER_PAST_END(dec.buf_end - ip) && !dec.err)
+		dec.err = DECODE_ERR_DATA;
+	
+	/* LOOKAHEAD is a multiple of 8 to ensure *
+	 * dma transfers are always 8 byte aligned */
 	offset = dec.buf_end - ip;
-	size = sizeof(dec.buf) - 8;
+	size = dec.buf_size - LOOKAHEAD;
 	
-	/* the last eight bytes wrap around */
-	Bcopy(dec.buf_end - 8, dec.buf, 8);
+	/* the last bytes wrap around */
+	Bcopy(dec.buf_end - LOOKAHEAD, dec.buf, LOOKAHEAD);
 	
 	/* transfer data from rom */
-	DMARomToRam(dec.pstart, dec.buf + 8, size);
+	DMARomToRam(dec.pstart, dec.buf + LOOKAHEAD, size);
 	dec.pstart += size;
 	
-	return dec.buf + (8 - offset);
+	return dec.buf + (LOOKAHEAD - offset);
 }
 
 static unsigned int aP_getbit(struct APDSTATE *ud)
@@ -84,16 +97,26 @@ static unsigned int aP_getgamma(struct APDSTATE *ud)
 {
 	unsigned int result = 1;
 
-	/* input gamma2-encoded bits */
+	/* input gamma2-encoded bits; more than 32 of them can only come
+	 * from corrupt data, and would run past LOOKAHEAD */
 	do {
+		if (result & 0x80000000)
+		{
+			if (!dec.err)
+				dec.err = DECODE_ERR_DATA;
+			break;
+		}
 		result = (result << 1) + aP_getbit(ud);
 	} while (aP_getbit(ud));
 
 	return result;
 }
 
-static inline void *aP_depack(void *source, unsigned char *destination)
+/* decompress into [destination, end); *err is left DECODE_OK if the end
+ * of the data was reached without a match reaching outside of them */
+static inline void *aP_depack(void *source, unsigned char *destination, unsigned char *end, int *err)
 {
+	unsigned char *start = destination;
 	struct APDSTATE ud;
 	unsigned int offs, len, R0, LWM;
 	int done;
@@ -113,10 +136,13 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 	ud.source += 8;
 
 	/* first byte verbatim */
+	if (destination == end)
+		goto L_fail;
 	*destination++ = *ud.source++;
 
-	/* main decompression loop */
-	while (!done) {
+	/* main decompression loop, until the end marker, zeros past the end
+	 * of the data, or corrupt data */
+	while (!done && !dec.err) {
 		ud.source = refill(ud.source);
 		if (aP_getbit(&ud)) {
 			if (aP_getbit(&ud)) {
@@ -127,6 +153,9 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 						offs = (offs << 1) + aP_getbit(&ud);
 					}
 
+					if (destination == end || offs > (size_t)(destination - start))
+						goto L_fail;
+
 					if (offs) {
 						*destination = *(destination - offs);
 						destination++;
@@ -145,6 +174,9 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 					offs >>= 1;
 
 					if (offs) {
+						if (len > (size_t)(end - destination) || offs > (size_t)(destination - start))
+							goto L_fail;
+
 						for (; len; len--) {
 							*destination = *(destination - offs);
 							destination++;
@@ -166,6 +198,9 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 
 					len = aP_getgamma(&ud);
 
+					if (len > (size_t)(end - destination) || offs > (size_t)(destination - start))
+						goto L_fail;
+
 					for (; len; len--) {
 						*destination = *(destination - offs);
 						destination++;
@@ -194,6 +229,9 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 						len += 2;
 					}
 
+					if (len > (size_t)(end - destination) || offs > (size_t)(destination - start))
+						goto L_fail;
+
 					for (; len; len--) {
 						*destination = *(destination - offs);
 						destination++;
@@ -206,28 +244,179 @@ static inline void *aP_depack(void *source, unsigned char *destination)
 			}
 		}
 		else {
+			if (destination == end)
+				goto L_fail;
 			*destination++ = *ud.source++;
 			LWM = 0;
 		}
 	}
 	
+	/* a failed read, or an end marker read from past the end */
+	if (dec.err)
+		*err = dec.err;
+	else if (DECREADER_PAST_END(dec.buf_end - ud.source))
+		*err = DECODE_ERR_DATA;
+	else
+		*err = DECODE_OK;
+	return destination;
+
+L_fail:
+	*err = dec.err ? dec.err : DECODE_ERR_DATA;
 	return destination;
 }
 
 /* main driver */
-size_t apldec(void *src, void *_dst, size_t sz)
+int apldec(const struct decreader *src, void *_dst, size_t *decSz)
 {
 	unsigned char* dst = _dst;
+	int err;
 	
-	dec.pstart = src;
-	dec.buf_end = dec.buf + sizeof(dec.buf);
-	dst = aP_depack(dec.buf_end, dst);
-	(void)sz; /* unused parameter */
+	DECREADER_BEGIN(src);
+	dec.buf_end = dec.buf + dec.buf_size;
+	dst = aP_depack(dec.buf_end, dst, dst + src->dst_size, &err);
 #if MAJORA
 	dec.dst_end = dst;
 	dec.buf_end = 0;
 #endif
 	/* get the final decompressed size */
-	return dst - (unsigned char*)_dst;
+	*decSz = dst - (unsigned char*)_dst;
+	
+	return err;
 }
 
+
+/* get next bit in the incremental driver's tag */
+#define STREAM_GETBIT(VAR) \
+	do { \
+		if (!s->u.apl.bitcount--) \
+		{ \
+			STREAM_GETBYTE(s->u.apl.tag); \
+			s->u.apl.bitcount = 7; \
+		} \
+		VAR = (s->u.apl.tag >> 7) & 1; \
+		s->u.apl.tag <<= 1; \
+	} while (0)
+
+/* get gamma2-encoded value (one bit is read per loop, so it yields once) */
+#define STREAM_GETGAMMA(VAR) \
+	do { \
+		VAR = 1; \
+		s->u.apl.gamma = 0; \
+		for (;;) \
+		{ \
+			STREAM_GETBIT(s->u.apl.bit); \
+			if ((s->u.apl.gamma ^= 1)) \
+				VAR = (VAR << 1) + s->u.apl.bit; \
+			else if (!s->u.apl.bit) \
+				break; \
+		} \
+	} while (0)
+
+/* incremental driver; expects the 8-byte header to be skipped already */
+int aplstream(struct decstream *s)
+{
+	STREAM_BEGIN
+	
+	s->u.apl.bitcount = 0;
+	s->u.apl.R0 = (unsigned int) -1;
+	s->u.apl.LWM = 0;
+	
+	/* first byte verbatim */
+	STREAM_GETBYTE(s->u.apl.b);
+	STREAM_PUTBYTE(s->u.apl.b);
+	
+	/* main decompression loop */
+	for (;;)
+	{
+		STREAM_GETBIT(s->u.apl.bit);
+		
+		/* literal */
+		if (!s->u.apl.bit)
+		{
+			STREAM_GETBYTE(s->u.apl.b);
+			STREAM_PUTBYTE(s->u.apl.b);
+			s->u.apl.LWM = 0;
+			continue;
+		}
+		
+		STREAM_GETBIT(s->u.apl.bit);
+		
+		/* gamma-coded offset and length */
+		if (!s->u.apl.bit)
+		{
+			STREAM_GETGAMMA(s->u.apl.offs);
+			
+			if (s->u.apl.LWM == 0 && s->u.apl.offs == 2)
+			{
+				s->dist = s->u.apl.R0;
+				STREAM_GETGAMMA(s->len);
+			}
+			else
+			{
+				s->u.apl.offs -= s->u.apl.LWM ? 2 : 3;
+				s->u.apl.offs <<= 8;
+				STREAM_GETBYTE(s->u.apl.b);
+				s->u.apl.offs += s->u.apl.b;
+				
+				STREAM_GETGAMMA(s->len);
+				
+				if (s->u.apl.offs >= 32000)
+					s->len++;
+				if (s->u.apl.offs >= 1280)
+					s->len++;
+				if (s->u.apl.offs < 128)
+					s->len += 2;
+				
+				s->dist = s->u.apl.R0 = s->u.apl.offs;
+			}
+			
+			STREAM_MATCH();
+			s->u.apl.LWM = 1;
+			continue;
+		}
+		
+		STREAM_GETBIT(s->u.apl.bit);
+		
+		/* short match, with 7-bit offset */
+		if (!s->u.apl.bit)
+		{
+			STREAM_GETBYTE(s->u.apl.offs);
+			
+			s->len = 2 + (s->u.apl.offs & 0x0001);
+			s->u.apl.offs >>= 1;
+			
+			/* end of stream */
+			if (!s->u.apl.offs)
+				break;
+			
+			s->dist = s->u.apl.R0 = s->u.apl.offs;
+			STREAM_MATCH();
+			s->u.apl.LWM = 1;
+			continue;
+		}
+		
+		/* single byte, with 4-bit offset */
+		s->u.apl.offs = 0;
+		for (s->u.apl.i = 4; s->u.apl.i; s->u.apl.i--)
+		{
+			STREAM_GETBIT(s->u.apl.bit);
+			s->u.apl.offs = (s->u.apl.offs << 1) + s->u.apl.bit;
+		}
+		
+		if (s->u.apl.offs)
+		{
+			s->dist = s->u.apl.offs;
+			s->len = 1;
+			STREAM_MATCH();
+		}
+		else
+		{
+			s->u.apl.b = 0;
+			STREAM_PUTBYTE(s->u.apl.b);
+		}
+		
+		s->u.apl.LWM = 0;
+	}
+	
+	STREAM_END
+}
@@ -1,11 +1,21 @@
 #ifndef Z64DECOMPRESS_DECODER_H_INCLUDED
 #define Z64DECOMPRESS_DECODER_H_INCLUDED
 
-size_t yazdec(void *src, void *dst, size_t sz);
-size_t lzodec(void *src, void *dst, size_t sz);
-size_t ucldec(void *src, void *dst, size_t sz);
-size_t apldec(void *src, void *dst, size_t sz);
-size_t zlibdec(void *src, void *dst, size_t sz);
+/* one-shot decoders; see reader.h */
+struct decreader;
+int yazdec(const struct decreader *src, void *dst, size_t *decSz);
+int lzodec(const struct decreader *src, void *dst, size_t *decSz);
+int ucldec(const struct decreader *src, void *dst, size_t *decSz);
+int apldec(const struct decreader *src, void *dst, size_t *decSz);
+int zlibdec(const struct decreader *src, void *dst, size_t *decSz);
+
+/* incremental decoders; see stream.h */
+struct decstream;
+int yazstream(struct decstream *s);
+int lzostream(struct decstream *s);
+int uclstream(struct decstream *s);
+int aplstream(struct decstream *s);
+int zlibstream(struct decstream *s);
 
 #endif /* Z64DECOMPRESS_DECODER_H_INCLUDED */
 
@@ -1,6 +1,7 @@
 /* <z64.me> adapted from lzo1x_d.ch */
 
 #include "private.h"
+#include "stream.h"
 
 /* negative indexing distance */
 #define NINDEX 2
@@ -10,10 +11,14 @@
 
 struct decoder
 {
-	unsigned char   buf[1024];   /* intermediate buffer for loading  */
+	unsigned char   defbuf[DECREADER_BUF_DEFAULT]; /* `buf` if reader lacks one */
+	unsigned char  *buf;         /* intermediate buffer for loading  */
+	unsigned int    buf_size;    /* size of `buf`                    */
+	const struct decreader *reader; /* source of compressed data     */
+	int             err;         /* first DECODE_ERR_* met           */
 	unsigned char  *buf_end;     /* pointer that exists for the sole *
 	                              * purpose of getting size of `buf` */
-	unsigned char  *pstart;      /* offset of next read from rom     */
+	size_t          pstart;      /* offset of next read from file    */
 	unsigned int    remaining;   /* remaining size of file           */
 	unsigned char  *buf_limit;   /* points to end of scannable area  *
 	                              * of buf; this prevents yaz parser *
@@ -23,7 +28,7 @@ struct decoder
 #endif
 };
 
-static struct decoder dec;
+static THREADLOCAL struct decoder dec;
 
 /* block copy, with desired overlapping behavior */
 static void *ocopy(void *_src, void *_dst, unsigned n)
@@ -47,6 +52,10 @@ static unsigned char *refill(unsigned char *ip)
 	if (ip < dec.buf_end - 32)
 		return ip;
 	
+	/* the file ended before its end marker */
+	if (DECREADER_PAST_END(dec.buf_end - ip) && !dec.err)
+		dec.err = DECODE_ERR_DATA;
+	
 	ip -= NINDEX;
 	
 	/* the weird alignment stuff ensures dma *
@@ -54,7 +63,7 @@ static unsigned char *refill(unsigned char *ip)
 	offset = dec.buf_end - ip;
 	align = 8 - (offset & 7);
 	offset += align;
-	size = sizeof(dec.buf) - offset;
+	size = dec.buf_size - offset;
 	
 	/* the last bytes wrap around */
 	ocopy(dec.buf_end - offset, dec.buf, offset);
@@ -69,17 +78,17 @@ static unsigned char *refill(unsigned char *ip)
 
 
 /* main driver */
-size_t lzodec(void *_src, void *_dst, size_t sz)
+int lzodec(const struct decreader *src, void *_dst, size_t *decSz)
 {
-	unsigned char *pstart = _src;
 	unsigned char *op = _dst;
+	unsigned char *op_end = op + src->dst_size;
 	unsigned char *m_pos;
+	int err = DECODE_ERR_DATA;
 	unsigned char *ip;
 	int t;
-	(void)sz; /* unused parameter */
 	
-	dec.pstart = pstart;
-	dec.buf_end = dec.buf + sizeof(dec.buf);
+	DECREADER_BEGIN(src);
+	dec.buf_end = dec.buf + dec.buf_size;
 	ip = dec.buf_end;
 	
 	/* initial buffer fill */
@@ -93,6 +102,8 @@ size_t lzodec(void *_src, void *_dst, size_t sz)
 		t = *ip++ - 17;
 		if (t < 4)
 			goto match_next;
+		if (t > op_end - op)
+			goto L_done;
 		op = ocopy(ip, op, t);
 		ip += t;
 		goto first_literal_run;
@@ -110,12 +121,20 @@ size_t lzodec(void *_src, void *_dst, size_t sz)
 			{
 				t += 255;
 				ip++;
+				ip = refill(ip);
+				
+				/* zeros past the end of the data, or a run too long
+				 * for the output */
+				if (dec.err || t > op_end - op)
+					goto L_done;
 			}
 			t += 15 + *ip++;
 		}
 		/* copy literals */
 		{
 			t += 3;
+			if (t > op_end - op)
+				goto L_done;
 			/* this loop can advance any number of bytes (4k+) */
 			do
 			{
@@ -135,6 +154,8 @@ first_literal_run:
 		m_pos -= ip[0] << 2;
 		ip++;
 		
+		if (m_pos < (unsigned char*)_dst || op_end - op < 3)
+			goto L_done;
 		op = ocopy(m_pos, op, 3);
 		goto match_done;
 
@@ -161,6 +182,9 @@ match:
 					{
 						t += 255;
 						ip++;
+						ip = refill(ip);
+						if (dec.err || t > op_end - op)
+							goto L_done;
 					}
 					t += 31 + *ip++;
 				}
@@ -180,13 +204,20 @@ match:
 					{
 						t += 255;
 						ip++;
+						ip = refill(ip);
+						if (dec.err || t > op_end - op)
+							goto L_done;
 					}
 					t += 7 + *ip++;
 				}
 				m_pos -= (ip[0] >> 2) + (ip[1] << 6);
 				/* end of compressed file */
 				if (m_pos == op)
+				{
+					ip += 2;
+					err = DECODE_OK;
 					goto L_done;
+				}
 				m_pos -= 0x4000;
 				ip += 2;
 			}
@@ -195,12 +226,16 @@ match:
 				m_pos -= t >> 2;
 				m_pos -= ip[0] << 2;
 				ip += 1;
+				if (m_pos < (unsigned char*)_dst || op_end - op < 2)
+					goto L_done;
 				op = ocopy(m_pos, op, 2);
 				goto match_done;
 			}
 
-			/* copy match */
+			/* copy match, which must lie within the output */
 			t += 2;
+			if (m_pos < (unsigned char*)_dst || t > op_end - op)
+				goto L_done;
 			op = ocopy(m_pos, op, t);
 
 
@@ -214,17 +249,157 @@ match_done:
 			/* copy literals */
 			/* this never advances more than 4 bytes */
 match_next:
+			if (t > op_end - op)
+				goto L_done;
 			op = ocopy(ip, op, t);
 			ip += t;
 			t = *ip++;
 		}
 	}
-L_done: do{}while(0);	
+L_done:
+	/* a failed read, or an end marker read from past the end */
+	if (dec.err)
+		err = dec.err;
+	else if (DECREADER_PAST_END(dec.buf_end - ip))
+		err = DECODE_ERR_DATA;
 #if MAJORA
 	dec.dst_end = op;
 	dec.buf_end = 0;
 #endif
 
-	return op - (unsigned char*)_dst;
+	*decSz = op - (unsigned char*)_dst;
+
+	return err;
 }
 
+
+/* incremental driver; expects the 8-byte header to be skipped already */
+int lzostream(struct decstream *s)
+{
+	STREAM_BEGIN
+	
+	STREAM_GETBYTE(s->u.lzo.t);
+	if (s->u.lzo.t > 17)
+	{
+		s->len = s->u.lzo.t - 17;
+		if (s->len < 4)
+			goto match_next;
+		STREAM_LITERALS();
+		goto first_literal_run;
+	}
+	goto first_instruction;
+	
+	for (;;)
+	{
+		STREAM_GETBYTE(s->u.lzo.t);
+first_instruction:
+		if (s->u.lzo.t >= 16)
+			goto match;
+		/* a literal run */
+		if (s->u.lzo.t == 0)
+		{
+			for (;;)
+			{
+				STREAM_GETBYTE(s->u.lzo.b1);
+				if (s->u.lzo.b1)
+					break;
+				s->u.lzo.t += 255;
+			}
+			s->u.lzo.t += 15 + s->u.lzo.b1;
+		}
+		/* copy literals */
+		s->len = s->u.lzo.t + 3;
+		STREAM_LITERALS();
+		
+first_literal_run:
+		STREAM_GETBYTE(s->u.lzo.t);
+		if (s->u.lzo.t >= 16)
+			goto match;
+		STREAM_GETBYTE(s->u.lzo.b1);
+		s->dist = 1 + M2_MAX_OFFSET + (s->u.lzo.t >> 2) + (s->u.lzo.b1 << 2);
+		s->len = 3;
+		s->u.lzo.last = s->u.lzo.t;
+		STREAM_MATCH();
+		goto match_done;
+		
+		/* handle matches */
+		for (;;)
+		{
+match:
+			if (s->u.lzo.t >= 64)           /* M2 match */
+			{
+				STREAM_GETBYTE(s->u.lzo.b1);
+				s->dist = 1 + ((s->u.lzo.t >> 2) & 7) + (s->u.lzo.b1 << 3);
+				s->len = (s->u.lzo.t >> 5) + 1;
+				s->u.lzo.last = s->u.lzo.t;
+			}
+			else if (s->u.lzo.t >= 32)      /* M3 match */
+			{
+				s->u.lzo.t &= 31;
+				if (s->u.lzo.t == 0)
+				{
+					for (;;)
+					{
+						STREAM_GETBYTE(s->u.lzo.b1);
+						if (s->u.lzo.b1)
+							break;
+						s->u.lzo.t += 255;
+					}
+					s->u.lzo.t += 31 + s->u.lzo.b1;
+				}
+				STREAM_GETBYTE(s->u.lzo.b1);
+				STREAM_GETBYTE(s->u.lzo.b2);
+				s->dist = 1 + (s->u.lzo.b1 >> 2) + (s->u.lzo.b2 << 6);
+				s->len = s->u.lzo.t + 2;
+				s->u.lzo.last = s->u.lzo.b1;
+			}
+			else if (s->u.lzo.t >= 16)      /* M4 match */
+			{
+				s->dist = (s->u.lzo.t & 8) << 11;
+				s->u.lzo.t &= 7;
+				if (s->u.lzo.t == 0)
+				{
+					for (;;)
+					{
+						STREAM_GETBYTE(s->u.lzo.b1);
+						if (s->u.lzo.b1)
+							break;
+						s->u.lzo.t += 255;
+					}
+					s->u.lzo.t += 7 + s->u.lzo.b1;
+				}
+				STREAM_GETBYTE(s->u.lzo.b1);
+				STREAM_GETBYTE(s->u.lzo.b2);
+				s->dist += (s->u.lzo.b1 >> 2) + (s->u.lzo.b2 << 6);
+				/* end of compressed file */
+				if (s->dist == 0)
+					return DECSTREAM_DONE;
+				s->dist += 0x4000;
+				s->len = s->u.lzo.t + 2;
+				s->u.lzo.last = s->u.lzo.b1;
+			}
+			else                            /* M1 match */
+			{
+				STREAM_GETBYTE(s->u.lzo.b1);
+				s->dist = 1 + (s->u.lzo.t >> 2) + (s->u.lzo.b1 << 2);
+				s->len = 2;
+				s->u.lzo.last = s->u.lzo.t;
+			}
+			
+			/* copy match */
+			STREAM_MATCH();
+			
+match_done:
+			s->len = s->u.lzo.last & 3;
+			if (s->len == 0)
+				break;
+			
+			/* copy literals */
+match_next:
+			STREAM_LITERALS();
+			STREAM_GETBYTE(s->u.lzo.t);
+		}
+	}
+	
+	STREAM_END
+}
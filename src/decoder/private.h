@@ -3,8 +3,36 @@
 
 #include <string.h> /* memcpy */
 
+#include "reader.h"
+#include "../threadlocal.h" /* per-thread decoder state */
+
 #define Bcopy(SRC, DST, LEN) memcpy(DST, SRC, LEN)
-#define DMARomToRam(SRC, DST, LEN) memcpy(DST, SRC, LEN)
+
+/* SRC is an offset into the compressed file; every decoder names its
+ * state `dec`, and keeps the reader it was given in `dec.reader` and the
+ * first read that failed in `dec.err` */
+#define DMARomToRam(SRC, DST, LEN) \
+	do { \
+		if (decreader_fill(dec.reader, SRC, DST, LEN) && !dec.err) \
+			dec.err = DECODE_ERR_READ; \
+	} while (0)
+
+/* whether the decoder has consumed bytes past the end of the file, with
+ * LEFT bytes of what was read from before dec.pstart yet to consume; a
+ * decoder reading the zeros there was given a truncated file */
+#define DECREADER_PAST_END(LEFT) (dec.pstart > dec.reader->size + (LEFT))
+
+/* start reading the compressed file through reader R, using its refill
+ * buffer, or the decoder's own `defbuf` if it has none */
+#define DECREADER_BEGIN(R) \
+	do { \
+		dec.reader = (R); \
+		dec.buf = (R)->buf ? (R)->buf : dec.defbuf; \
+		dec.buf_size = (R)->buf ? (R)->buf_size : sizeof(dec.defbuf); \
+		dec.pstart = 0; \
+		dec.err = DECODE_OK; \
+	} while (0)
+
 
 /* XXX casting like *(unsigned int*) is used in n64 code but
  *     that assumes a big-endian build target; adapt to BE32()
@@ -0,0 +1,11 @@
+/* <z64.me> built-in readers for the one-shot decoders */
+
+#include "reader.h"
+
+/* the source is already in memory */
+size_t decreader_memory(void *udata, size_t ofs, void *dst, size_t len)
+{
+	memcpy(dst, (const unsigned char*)udata + ofs, len);
+
+	return len;
+}
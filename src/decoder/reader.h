@@ -0,0 +1,71 @@
+#ifndef Z64DECOMPRESS_DECODER_READER_H_INCLUDED
+#define Z64DECOMPRESS_DECODER_READER_H_INCLUDED
+
+/* <z64.me> where the one-shot decoders get compressed data from
+ *
+ * like on the n64, the decoders never touch the compressed file directly;
+ * they refill a small intermediate buffer through `read`, which may copy
+ * from memory, pread() a file, or anything else, so only that buffer and
+ * the decompressed file need to be resident while decoding
+ */
+
+#include <stddef.h> /* size_t */
+#include <string.h> /* memset */
+
+/* smallest refill buffer the decoders work with; lzo's first literal
+ * run, for one, is copied from a single buffer's worth of data */
+#define DECREADER_BUF_MIN      512
+
+/* size of the refill buffer used when `buf` is NULL */
+#define DECREADER_BUF_DEFAULT  1024
+
+struct decreader
+{
+	/* copy up to `len` bytes at offset `ofs` of the source into `dst`;
+	 * returns the number of bytes copied */
+	size_t        (*read)(void *udata, size_t ofs, void *dst, size_t len);
+	void           *udata;
+	size_t          ofs;       /* offset of compressed file in source */
+	size_t          size;      /* size of compressed file             */
+	unsigned char  *buf;       /* refill buffer, or NULL for default  */
+	unsigned        buf_size;  /* multiple of 8, >= DECREADER_BUF_MIN */
+	size_t          dst_size;  /* room for decompressed data; decoders *
+	                            * fail rather than write past it       */
+};
+
+/* what the one-shot decoders return; what they decompressed is counted
+ * in *decSz either way */
+#define DECODE_OK          0
+#define DECODE_ERR_DATA   -1  /* corrupt, truncated, or larger than *
+                               * dst_size                           */
+#define DECODE_ERR_READ   -2  /* `read` copied less than asked      */
+
+/* `read` for sources that are already in memory; udata points to them */
+size_t decreader_memory(void *udata, size_t ofs, void *dst, size_t len);
+
+/* transfer `len` bytes from `pos` bytes into the compressed file to dst;
+ * anything past the end of the file, or that couldn't be read, is zero,
+ * so decoders reading ahead needn't stop at the end (returns
+ * DECODE_ERR_READ if `read` copied less of the file than asked) */
+static inline int decreader_fill(const struct decreader *r, size_t pos, void *dst, size_t len)
+{
+	size_t want = 0;
+	size_t n = 0;
+
+	if (pos < r->size)
+	{
+		want = r->size - pos;
+		if (want > len)
+			want = len;
+		n = r->read(r->udata, r->ofs + pos, dst, want);
+		if (n > want)
+			n = 0;
+	}
+
+	if (n < len)
+		memset((unsigned char*)dst + n, 0, len - n);
+
+	return n < want ? DECODE_ERR_READ : DECODE_OK;
+}
+
+#endif /* Z64DECOMPRESS_DECODER_READER_H_INCLUDED */
@@ -0,0 +1,176 @@
+#ifndef Z64DECOMPRESS_DECODER_STREAM_H_INCLUDED
+#define Z64DECOMPRESS_DECODER_STREAM_H_INCLUDED
+
+/* <z64.me> incremental decoding
+ *
+ * the *stream() decoders decode as much as the input and output buffers
+ * given in `struct decstream` allow, then return so they can be resumed
+ * where they left off once more input or output space is provided; back
+ * references are resolved using `win`, a ring buffer holding the most
+ * recent output, so neither the whole compressed nor decompressed file
+ * needs to be in memory at once
+ */
+
+/* return values */
+#define DECSTREAM_DONE    0  /* file has been decoded completely */
+#define DECSTREAM_INPUT   1  /* all input consumed, provide more */
+#define DECSTREAM_OUTPUT  2  /* output buffer full, provide more */
+#define DECSTREAM_ERROR  -1  /* corrupt data                     */
+
+struct z64dec_profile;
+
+struct decstream
+{
+	const unsigned char *in;       /* next compressed byte              */
+	const unsigned char *in_end;   /* end of compressed bytes           */
+	unsigned char       *out;      /* next decompressed byte            */
+	unsigned char       *out_end;  /* end of output buffer              */
+	unsigned char       *win;      /* ring buffer of most recent output */
+	unsigned             mask;     /* size of `win` minus one (pow2)    */
+	unsigned             pos;      /* bytes decompressed so far         */
+	unsigned             size;     /* decompressed size (from header)   */
+	unsigned             dist;     /* distance of current back ref      */
+	unsigned             len;      /* bytes left in current copy        */
+	int                  line;     /* where to resume (zero = start)    */
+	struct z64dec_profile *profile; /* tallies tokens, or NULL          */
+	unsigned             run;      /* literals since the last back ref  */
+	union
+	{
+		struct {
+			unsigned code;         /* current code byte                 */
+			unsigned bits;         /* bits left in code byte            */
+			unsigned b1, b2;       /* bytes of current back ref         */
+		} yaz;
+		struct {
+			unsigned t;            /* current instruction               */
+			unsigned b1, b2;       /* bytes of current back ref         */
+			unsigned last;         /* byte whose low bits count the     *
+			                        * literals following a match        */
+		} lzo;
+		struct {
+			unsigned bitbuf;       /* bit buffer                        */
+			unsigned bit;
+			unsigned off;          /* offset being decoded              */
+			unsigned last_off;
+			unsigned mlen;         /* match length being decoded        */
+			unsigned b;
+		} ucl;
+		struct {
+			unsigned tag;          /* bit buffer                        */
+			unsigned bitcount;     /* bits left in `tag`                */
+			unsigned bit;
+			unsigned gamma;        /* odd while reading gamma's         *
+			                        * continuation bit                  */
+			unsigned offs;
+			unsigned R0;           /* last offset                       */
+			unsigned LWM;
+			unsigned i;
+			unsigned b;
+		} apl;
+		struct {
+			void    *state;        /* zeroed, zlibstream_state_size()   */
+			unsigned drained;      /* bytes of `win` copied to `out`    */
+			int      done;         /* end of stream reached             */
+		} zlib;
+	} u;
+};
+
+/* bytes needed for zlibstream()'s s->u.zlib.state */
+unsigned long zlibstream_state_size(void);
+
+/* tally tokens in s->profile as they're decoded (see profile.c) */
+void decstream_tally_literals(struct decstream *s, unsigned n);
+void decstream_tally_match(struct decstream *s, unsigned len, unsigned dist);
+void decstream_tally_end(struct decstream *s);
+void decstream_tally_block(struct decstream *s, unsigned type, unsigned stored);
+void decstream_tally_codes(struct decstream *s, const unsigned char *lit, unsigned nlit, const unsigned char *dist, unsigned ndist);
+
+/* append a decompressed byte to the output and the window */
+static inline void decstream_put(struct decstream *s, unsigned char b)
+{
+	s->win[s->pos++ & s->mask] = b;
+	*s->out++ = b;
+}
+
+/* copy as much of the current back reference as fits in the output */
+static inline void decstream_match(struct decstream *s)
+{
+	unsigned n = s->out_end - s->out;
+
+	if (n > s->len)
+		n = s->len;
+	s->len -= n;
+
+	while (n--)
+		decstream_put(s, s->win[(s->pos - s->dist) & s->mask]);
+}
+
+/* copy as many of the current literals as are available and fit */
+static inline void decstream_literals(struct decstream *s)
+{
+	unsigned n = s->out_end - s->out;
+
+	if (n > (unsigned)(s->in_end - s->in))
+		n = s->in_end - s->in;
+	if (n > s->len)
+		n = s->len;
+	s->len -= n;
+
+	while (n--)
+		decstream_put(s, *s->in++);
+}
+
+/* coroutine helpers; locals don't survive a yield, so decoders keep
+ * everything in `s`, and no two yields may share a line of source */
+#define STREAM_BEGIN  switch (s->line) { case 0:
+#define STREAM_END    } return DECSTREAM_DONE;
+#define STREAM_YIELD(X) \
+	do { s->line = __LINE__; return (X); case __LINE__:; } while (0)
+
+/* read the next compressed byte into VAR */
+#define STREAM_GETBYTE(VAR) \
+	do { \
+		while (s->in == s->in_end) \
+			STREAM_YIELD(DECSTREAM_INPUT); \
+		VAR = *s->in++; \
+	} while (0)
+
+/* write a literal byte; B must not be a local variable */
+#define STREAM_PUTBYTE(B) \
+	do { \
+		while (s->out == s->out_end) \
+			STREAM_YIELD(DECSTREAM_OUTPUT); \
+		if (s->profile) \
+			decstream_tally_literals(s, 1); \
+		decstream_put(s, B); \
+	} while (0)
+
+/* copy s->len bytes from s->dist bytes back */
+#define STREAM_MATCH() \
+	do { \
+		if (s->profile) \
+			decstream_tally_match(s, s->len, s->dist); \
+		if (s->dist > s->pos || s->dist - 1 > s->mask) \
+			return DECSTREAM_ERROR; \
+		while (s->len) \
+		{ \
+			while (s->out == s->out_end) \
+				STREAM_YIELD(DECSTREAM_OUTPUT); \
+			decstream_match(s); \
+		} \
+	} while (0)
+
+/* copy s->len bytes straight from the input */
+#define STREAM_LITERALS() \
+	do { \
+		if (s->profile) \
+			decstream_tally_literals(s, s->len); \
+		while (s->len) \
+		{ \
+			while (s->in == s->in_end || s->out == s->out_end) \
+				STREAM_YIELD(s->in == s->in_end ? DECSTREAM_INPUT : DECSTREAM_OUTPUT); \
+			decstream_literals(s); \
+		} \
+	} while (0)
+
+#endif /* Z64DECOMPRESS_DECODER_STREAM_H_INCLUDED */
@@ -1,20 +1,24 @@
 /* <z64.me> ucl decompression using intermediate buffer */
 
 #include "private.h"
+#include "stream.h"
 
 struct decoder
 {
-	unsigned char   buf[1024];   /* intermediate buffer for loading  */
+	unsigned char   defbuf[DECREADER_BUF_DEFAULT]; /* `buf` if reader lacks one */
+	unsigned char  *buf;         /* intermediate buffer for loading  */
+	unsigned int    buf_size;    /* size of `buf`                    */
+	const struct decreader *reader; /* source of compressed data     */
+	int             err;         /* first DECODE_ERR_* met           */
 	unsigned int    bb;          /* ucl: bit buffer                  */
-	unsigned char  *pstart;      /* offset of next read from rom     */
-	unsigned int    remaining;   /* compressed bytes not yet read    */
+	size_t          pstart;      /* offset of next read from file    */
 	unsigned int    ilen;        /* ucl: bytes processed in `buf`    */
 #if MAJORA
 	unsigned char  *dst_end;     /* end of decompressed block        */
 #endif
 };
 
-static struct decoder dec;
+static THREADLOCAL struct decoder dec;
 
 /* these are used often, so shorten their names with a macro */
 #define ilen   dec.ilen
@@ -37,10 +41,10 @@ static struct decoder dec;
 static inline unsigned int refill(void)
 {
 	/* if we have exceeded the intermediate buffer, refill it */
-	if (ilen >= sizeof(dec.buf) - 32)
+	if (ilen >= dec.buf_size - 32)
 	{
-		unsigned size = sizeof(dec.buf);
-		int offset = sizeof(dec.buf) - ilen;
+		unsigned size = dec.buf_size;
+		int offset = dec.buf_size - ilen;
 		int Nilen;
 		
 		/* bcopy src and dst must be aligned */
@@ -55,18 +59,13 @@ static inline unsigned int refill(void)
 		}
 		ilen = Nilen;
 		
-		/* if it exceeds remaining file size, use that */
-		if (dec.remaining < size)
-			size = dec.remaining;
+		/* the file ended before its end marker */
+		if (DECREADER_PAST_END(offset) && !dec.err)
+			dec.err = DECODE_ERR_DATA;
 		
-		/* read file from rom */
-		if (size != 0)
-		{
-			DMARomToRam(dec.pstart, dec.buf + offset + Nilen, size);
-			
-			dec.pstart += size;
-			dec.remaining -= size;
-		}
+		/* read file from rom; past its end, the rest is zeros */
+		DMARomToRam(dec.pstart, dec.buf + offset + Nilen, size);
+		dec.pstart += size;
 	}
 	
 	return dec.buf[(ilen)++];
@@ -105,41 +104,52 @@ static int (getbit_dma_unsafe)(void)
 }
 
 /* adapted from ucl/n2b_d.c */
-size_t ucldec(void *_src, void *_dst, size_t sz)
+int ucldec(const struct decreader *src, void *_dst, size_t *decSz)
 {
-	unsigned char *pstart = _src;
 	unsigned char *dst = _dst;
+	unsigned char *dst_end = dst + src->dst_size;
 	int last_m_off = 1;
-	
-	/* skip the 8-byte header */
-	pstart += 8;
-	sz -= 8;
+	int err = DECODE_ERR_DATA;
 	
 	/* initialize decoder structure */
-	dec.pstart = pstart;
-	dec.remaining = sz;
+	DECREADER_BEGIN(src);
+	
+	/* skip the 8-byte header */
+	dec.pstart = 8;
 	bb = 0;
-	ilen = sizeof(dec.buf);
+	ilen = dec.buf_size;
 
-	for (;;)
+	/* until the end marker, or zeros past the end of the data */
+	while (!dec.err)
 	{
 		int m_off;
 		int m_len;
 
 		while (getbit(bb))
+		{
+			if (dst == dst_end)
+				goto L_done;
 			*dst++ = dec.buf[ilen++];
+		}
 		
 		m_off = 1;
 		do {
 			m_off = m_off*2 + getbit(bb);
+			if (m_off > 0xffffff + 3)
+				goto L_done;
 		} while (!getbit(bb));
 		if (m_off == 2)
 			m_off = last_m_off;
 		else
 		{
-			m_off = (m_off-3)*256 + dec.buf[ilen++];
+			/* unsigned, so the end marker's overflow to -1 isn't
+			 * undefined behavior the optimizer can assume away */
+			m_off = (int)((unsigned)(m_off-3)*256 + dec.buf[ilen++]);
 			if (m_off == -1)
+			{
+				err = DECODE_OK;
 				break;
+			}
 			last_m_off = ++m_off;
 		}
 		
@@ -150,10 +160,18 @@ size_t ucldec(void *_src, void *_dst, size_t sz)
 			m_len++;
 			do {
 				m_len = m_len*2 + getbit_unsafe_F(bb);
+				if ((unsigned)m_len > (size_t)(dst_end - dst))
+					goto L_done;
 			} while (!getbit_unsafe_F(bb));
 			m_len += 2;
 		}
 		m_len += (m_off > 0xd00);
+		
+		/* the match must lie within the output */
+		if ((unsigned)m_off > (size_t)(dst - (unsigned char*)_dst)
+			|| (unsigned)m_len + 1 > (size_t)(dst_end - dst)
+		)
+			goto L_done;
 		{
 			unsigned char *m_pos;
 			m_pos = dst - m_off;
@@ -186,12 +204,98 @@ size_t ucldec(void *_src, void *_dst, size_t sz)
 		}
 	}
 	
+L_done:
+	/* a failed read, or an end marker read from past the end */
+	if (dec.err)
+		err = dec.err;
+	else if (DECREADER_PAST_END(dec.buf_size - ilen))
+		err = DECODE_ERR_DATA;
 #if MAJORA
 	dec.dst_end = dst;
 	bb = 0;
 #endif
 
 	/* get the final decompressed size */
-	return dst - (unsigned char*)_dst;
+	*decSz = dst - (unsigned char*)_dst;
+	
+	return err;
 }
 
+
+/* get next bit in the incremental driver's bit buffer */
+#define STREAM_GETBIT(VAR) \
+	do { \
+		if (s->u.ucl.bitbuf & 0x7f) \
+			s->u.ucl.bitbuf *= 2; \
+		else \
+		{ \
+			STREAM_GETBYTE(s->u.ucl.bitbuf); \
+			s->u.ucl.bitbuf = s->u.ucl.bitbuf * 2 + 1; \
+		} \
+		VAR = (s->u.ucl.bitbuf >> 8) & 1; \
+	} while (0)
+
+/* incremental driver; expects the 8-byte header to be skipped already */
+int uclstream(struct decstream *s)
+{
+	STREAM_BEGIN
+	
+	s->u.ucl.bitbuf = 0;
+	s->u.ucl.last_off = 1;
+	
+	for (;;)
+	{
+		for (;;)
+		{
+			STREAM_GETBIT(s->u.ucl.bit);
+			if (!s->u.ucl.bit)
+				break;
+			STREAM_GETBYTE(s->u.ucl.b);
+			STREAM_PUTBYTE(s->u.ucl.b);
+		}
+		
+		s->u.ucl.off = 1;
+		for (;;)
+		{
+			STREAM_GETBIT(s->u.ucl.bit);
+			s->u.ucl.off = s->u.ucl.off * 2 + s->u.ucl.bit;
+			STREAM_GETBIT(s->u.ucl.bit);
+			if (s->u.ucl.bit)
+				break;
+		}
+		if (s->u.ucl.off == 2)
+			s->u.ucl.off = s->u.ucl.last_off;
+		else
+		{
+			STREAM_GETBYTE(s->u.ucl.b);
+			s->u.ucl.off = (s->u.ucl.off - 3) * 256 + s->u.ucl.b;
+			if (s->u.ucl.off == 0xffffffff)
+				break;
+			s->u.ucl.last_off = ++s->u.ucl.off;
+		}
+		
+		STREAM_GETBIT(s->u.ucl.mlen);
+		STREAM_GETBIT(s->u.ucl.bit);
+		s->u.ucl.mlen = s->u.ucl.mlen * 2 + s->u.ucl.bit;
+		if (s->u.ucl.mlen == 0)
+		{
+			s->u.ucl.mlen = 1;
+			for (;;)
+			{
+				STREAM_GETBIT(s->u.ucl.bit);
+				s->u.ucl.mlen = s->u.ucl.mlen * 2 + s->u.ucl.bit;
+				STREAM_GETBIT(s->u.ucl.bit);
+				if (s->u.ucl.bit)
+					break;
+			}
+			s->u.ucl.mlen += 2;
+		}
+		s->u.ucl.mlen += (s->u.ucl.off > 0xd00);
+		
+		s->dist = s->u.ucl.off;
+		s->len = s->u.ucl.mlen + 1;
+		STREAM_MATCH();
+	}
+	
+	STREAM_END
+}
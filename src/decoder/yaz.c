@@ -1,14 +1,18 @@
 /* <z64.me> yaz decompression using intermediate buffer */
 
 #include "private.h"
+#include "stream.h"
 
 struct decoder
 {
-	unsigned char   buf[1024];   /* intermediate buffer for loading  */
+	unsigned char   defbuf[DECREADER_BUF_DEFAULT]; /* `buf` if reader lacks one */
+	unsigned char  *buf;         /* intermediate buffer for loading  */
+	unsigned int    buf_size;    /* size of `buf`                    */
+	const struct decreader *reader; /* source of compressed data     */
+	int             err;         /* first DECODE_ERR_* met           */
 	unsigned char  *buf_end;     /* pointer that exists for the sole *
 	                              * purpose of getting size of `buf` */
-	unsigned char  *pstart;      /* offset of next read from rom     */
-	unsigned int    remaining;   /* remaining size of file           */
+	size_t          pstart;      /* offset of next read from file    */
 	unsigned char  *buf_limit;   /* points to end of scannable area  *
 	                              * of buf; this prevents yaz parser *
 	                              * from overflowing                 */
@@ -17,7 +21,7 @@ struct decoder
 #endif
 };
 
-static struct decoder dec;
+static THREADLOCAL struct decoder dec;
 
 /* initialize yaz */
 static inline unsigned char *init(void)
@@ -26,21 +30,15 @@ static inline unsigned char *init(void)
 	
 	dec.buf_limit = dec.buf_end - 25;
 	
-	/* default size = decompression buffer size */
+	/* size = decompression buffer size; past the end of the file, the
+	 * rest is zeros */
 	size = dec.buf_end - dec.buf;
 	
-	/* if remaining file size is less than default, use that */
-	if (dec.remaining < size)
-		size = dec.remaining;
-	
 	DMARomToRam(dec.pstart, dec.buf, size);
 	
 	/* advance pstart */
 	dec.pstart += size;
 	
-	/* decrease remaining sz */
-	dec.remaining -= size;
-	
 	return dec.buf;
 }
 
@@ -66,48 +64,41 @@ static inline unsigned char *refill(unsigned char *src)
 	/* calculate size for next read */
 	size = (dec.buf_end - dst) - length;
 	
-	/* if it exceeds remaining file size, use that */
-	if (dec.remaining < size)
-		size = dec.remaining;
-	
-	/* read file from rom */
-	if (size != 0)
-	{
-		DMARomToRam(dec.pstart, dst + length, size);
-		
-		dec.pstart += size;
-		dec.remaining -= size;
-		
-		if (dec.remaining == 0)
-			dec.buf_limit = dst + length + size;
-	}
+	/* read file from rom; past its end, the rest is zeros */
+	DMARomToRam(dec.pstart, dst + length, size);
+	dec.pstart += size;
 	
 	return dst;
 }
 
 /* decompress yaz data */
 /* yaz0dec by thakis was referenced for this */
-static inline size_t decompress(unsigned char *src, unsigned char *_dst)
+static inline int decompress(unsigned char *src, unsigned char *_dst, size_t dst_size, size_t *decSz)
 {
 	unsigned char *dst = _dst;
+	unsigned char *dst_end;
 	unsigned int currCodeByte;
 	unsigned int nmult;
 	int validBitCount = 0;
-	int uncomp_sz;
+	size_t uncomp_sz;
 	
 	/* get decompressed size from header */
-	uncomp_sz = BE32(src + 4);
+	uncomp_sz = (unsigned)BE32(src + 4);
+	*decSz = 0;
+	if (uncomp_sz > dst_size)
+		return DECODE_ERR_DATA;
+	dst_end = dst + uncomp_sz;
 	
 	/* skip header */
 	src += 16;
 	
-	/* infinite loop */
-	do
+	/* until the size is reached, which may be right away */
+	while (dst < dst_end)
 	{
 		if (validBitCount == 0)
 		{
 			/* refill intermediate buffer if needed */
-			if (dec.buf_limit < src && dec.remaining != 0)
+			if (dec.buf_limit < src)
 				src = refill(src);
 			
 			currCodeByte = *src;
@@ -136,6 +127,13 @@ static inline size_t decompress(unsigned char *src, unsigned char *_dst)
 			else
 				numBytes += 2;
 			
+			/* the match must lie within the output */
+			if (numBytes > (size_t)(dst_end - dst) || dist >= (size_t)(dst - _dst))
+			{
+				*decSz = dst - _dst;
+				return dec.err ? dec.err : DECODE_ERR_DATA;
+			}
+			
 		/* NOTE: this is unrolled to maximize performance */
 			
 			/* get remaining bytes to a multiple of 4 */
@@ -174,32 +172,86 @@ static inline size_t decompress(unsigned char *src, unsigned char *_dst)
 L_skip:
 		validBitCount -= 1;
 		currCodeByte <<= 1;
-	} while (dst != _dst + uncomp_sz);
+	}
 	
 #if MAJORA
 	dec.dst_end = dst;
 #endif
 
-	return uncomp_sz;
+	*decSz = uncomp_sz;
+	
+	/* a failed read, or data read from past the end of the file */
+	if (dec.err)
+		return dec.err;
+	if (DECREADER_PAST_END(dec.buf_end - src))
+		return DECODE_ERR_DATA;
+	
+	return DECODE_OK;
 }
 
 /* main driver */
-size_t yazdec(void *src, void *dst, size_t sz)
+int yazdec(const struct decreader *src, void *dst, size_t *decSz)
 {
-	size_t uncomp_sz;
+	int err;
 
 	/* initialize decoder structure */
-	dec.buf_end = dec.buf + sizeof(dec.buf);
-	dec.pstart = src;
-	dec.remaining = sz;
+	DECREADER_BEGIN(src);
+	dec.buf_end = dec.buf + dec.buf_size;
 	
 	/* decompress file */
-	uncomp_sz = decompress(init(), dst);
+	err = decompress(init(), dst, src->dst_size, decSz);
 	
 #if MAJORA
 	dec.buf_end = 0;
 #endif
 
-	return uncomp_sz;
+	return err;
 }
 
+
+/* incremental driver; expects the 16-byte header to be skipped already */
+int yazstream(struct decstream *s)
+{
+	STREAM_BEGIN
+	
+	while (s->pos < s->size)
+	{
+		if (s->u.yaz.bits == 0)
+		{
+			STREAM_GETBYTE(s->u.yaz.code);
+			s->u.yaz.bits = 8;
+		}
+		
+		/* straight copy */
+		if (s->u.yaz.code & 0x80)
+		{
+			STREAM_GETBYTE(s->u.yaz.b1);
+			STREAM_PUTBYTE(s->u.yaz.b1);
+		}
+		
+		/* back reference */
+		else
+		{
+			STREAM_GETBYTE(s->u.yaz.b1);
+			STREAM_GETBYTE(s->u.yaz.b2);
+			
+			s->dist = (((s->u.yaz.b1 & 0xF) << 8) | s->u.yaz.b2) + 1;
+			s->len = s->u.yaz.b1 >> 4;
+			
+			if (s->len == 0)
+			{
+				STREAM_GETBYTE(s->len);
+				s->len += 0x12;
+			}
+			else
+				s->len += 2;
+			
+			STREAM_MATCH();
+		}
+		
+		s->u.yaz.bits -= 1;
+		s->u.yaz.code <<= 1;
+	}
+	
+	STREAM_END
+}
@@ -1,6 +1,7 @@
 /* <z64.me> oot style zlib decompression using intermediate buffer */
 
 #include "private.h"
+#include "stream.h"
 
 /*
  * tinflate.c -- tiny inflate library
@@ -210,7 +211,9 @@ typedef struct DecompressionState_ {
         READ_SYMBOL,
         READ_LENGTH,
         READ_DISTANCE,
-        READ_DISTANCE_EXTRA
+        READ_DISTANCE_EXTRA,
+        WRITE_LITERAL,  /* Waiting for output space (ring buffer only). */
+        WRITE_REPEAT  /* Waiting for output space (ring buffer only). */
     } state;
 
     /* in_ptr: Pointer to the next byte to be read from the input buffer. */
@@ -223,6 +226,11 @@ typedef struct DecompressionState_ {
     unsigned long out_ofs;
     /* out_size: Total number of bytes in the output buffer. */
     unsigned long out_size;
+    /* out_mask: ~0 for a linear output buffer.  Otherwise, the output
+     * buffer is a ring buffer of out_mask+1 bytes (a power of two), and
+     * out_size is the offset at which to stop and return 2 to let the
+     * caller consume some of it, rather than discarding any output. */
+    unsigned long out_mask;
 
     /* crc: Current CRC value. */
 #ifdef WANT_CRC
@@ -250,6 +258,9 @@ typedef struct DecompressionState_ {
     unsigned int last_value;
     /* repeat_length: Length of a repeated string. */
     unsigned int repeat_length;
+    /* distance: Distance of a repeated string (only valid when
+     * state == WRITE_REPEAT). */
+    unsigned int distance;
 
     /* len: Length of an uncompressed block. */
     unsigned int len;
@@ -295,6 +306,9 @@ typedef struct DecompressionState_ {
      * each symbol in each alphabet. */
     unsigned char literal_len[288], distance_len[32], codelen_len[19];
 
+    /* profiled: Stream whose tokens are tallied, or NULL. */
+    struct decstream *profiled;
+
 } DecompressionState;
 
 /* Local function declarations. */
@@ -388,10 +402,11 @@ static const unsigned long crc32_table[256] = {
  *                           less than the value returned by
  *                           tinflate_state_size().
  * Return value:
- *     Zero when the data has been completely decompressed; an unspecified
- *     positive value if the end of the input data is reached before
- *     decompression is complete; or an unspecified negative value if an
- *     error occurs.  (A full output buffer is not considered an error.)
+ *     Zero when the data has been completely decompressed; 1 if the end
+ *     of the input data is reached before decompression is complete; 2 if
+ *     the output is a ring buffer (see "out_mask") that has reached
+ *     out_size; or an unspecified negative value if an error occurs.  (A
+ *     full linear output buffer is not considered an error.)
  * Notes:
  *     The returned CRC value is only valid after the entire stream of data
  *     has been decompressed, and only when the decompressed data fits
@@ -517,11 +532,11 @@ int tinflate_partial(const void *compressed_data, long compressed_size,
  * Parameters:
  *     state: Decompression state buffer.
  * Return value:
- *     Zero on success, an unspecified positive value if the end of the
- *     input data is reached before decompression of the block is complete,
- *     or an unspecified negative value if an error other than reaching
- *     the end of the input data occurs.  (A full output buffer is not
- *     considered an error.)
+ *     Zero on success, 1 if the end of the input data is reached before
+ *     decompression of the block is complete, 2 if a ring output buffer
+ *     has reached out_size, or an unspecified negative value if an error
+ *     other than reaching the end of the input data occurs.  (A full
+ *     linear output buffer is not considered an error.)
  * Preconditions:
  *     state != NULL
  */
@@ -534,8 +549,10 @@ static inline int tinflate_block(DecompressionState *state)
           unsigned char *out_base  = state->out_base;
           unsigned long  out_ofs   = state->out_ofs;
           unsigned long  out_size  = state->out_size;
+    const unsigned long  out_mask  = state->out_mask;
           unsigned long  bit_accum = state->bit_accum;
           unsigned int   num_bits  = state->num_bits;
+    struct decstream    *profiled  = state->profiled;
 
 #ifdef WANT_CRC
     /* icrc: Inverted (one's-complement) value of the running CRC for the
@@ -600,7 +617,7 @@ static inline int tinflate_block(DecompressionState *state)
     do {                                        \
         const unsigned char __byte = (byte);    \
         if (LIKELY(out_ofs < out_size)) {       \
-            out_base[out_ofs] = __byte;         \
+            out_base[out_ofs & out_mask] = __byte; \
         }                                       \
         out_ofs++;                              \
         UPDATECRC(__byte);                      \
@@ -614,11 +631,15 @@ static inline int tinflate_block(DecompressionState *state)
 #define PUTBYTE_SAFE(byte)                      \
     do {                                        \
         const unsigned char __byte = (byte);    \
-        out_base[out_ofs] = __byte;             \
+        out_base[out_ofs & out_mask] = __byte;  \
         out_ofs++;                              \
         UPDATECRC(__byte);                      \
     } while (0)
 
+    /* The RING macro evaluates to nonzero if the output buffer is a ring
+     * buffer, in which case the decoder stops when out_size is reached. */
+#define RING  (out_mask != ~0UL)
+
     /* The UPDATECRC macro updates the Adler32 CRC value stored in the
      * "crc" variable for the given output byte.  Note that the local
      * variable "__val" is renamed from "__byte" to avoid a name conflict
@@ -659,6 +680,8 @@ static inline int tinflate_block(DecompressionState *state)
         CHECK_STATE(READ_LENGTH);
         CHECK_STATE(READ_DISTANCE);
         CHECK_STATE(READ_DISTANCE_EXTRA);
+        CHECK_STATE(WRITE_LITERAL);
+        CHECK_STATE(WRITE_REPEAT);
         case INITIAL:
         case PARTIAL_ZLIB_HEADER:
           /* Both of these are impossible, since tinflate_partial() handles
@@ -683,6 +706,9 @@ static inline int tinflate_block(DecompressionState *state)
     if (state->block_type == 3) {
         goto error_return;
     }
+    if (profiled && state->block_type != 0) {
+        decstream_tally_block(profiled, state->block_type, 0);
+    }
 
     /* Check for uncompressed blocks, and just copy them to the output
      * buffer. */
@@ -698,6 +724,9 @@ static inline int tinflate_block(DecompressionState *state)
             /* Length values don't match, so the stream must be corrupted. */
             goto error_return;
         }
+        if (profiled) {
+            decstream_tally_block(profiled, 0, state->len);
+        }
         /* Copy bytes to the output buffer. */
         state->nread = 0;
         state->state = UNCOMPRESSED_DATA;
@@ -706,6 +735,9 @@ static inline int tinflate_block(DecompressionState *state)
             if (in_ptr >= in_top) {
                 goto out_of_data;
             }
+            if (UNLIKELY(RING && out_ofs >= out_size)) {
+                goto out_of_space;
+            }
             PUTBYTE(*in_ptr++);
             state->nread++;
         }
@@ -832,6 +864,11 @@ static inline int tinflate_block(DecompressionState *state)
                                state->distance_table)) {
             goto error_return;
         }
+        if (profiled) {
+            decstream_tally_codes(profiled,
+                                  state->literal_len, state->literal_count,
+                                  state->distance_len, state->distance_count);
+        }
 
     } else {  /* Static tables. */
 
@@ -916,12 +953,22 @@ static inline int tinflate_block(DecompressionState *state)
 
         state->state = READ_SYMBOL;
       state_READ_SYMBOL:
-        /* Read a compressed symbol from the block. */
+        /* Read a compressed symbol from the block.  Room for a literal
+         * is only needed once one is read, so that the end of the block
+         * can be reached when the output is exactly full. */
         GETHUFF(state->symbol, state->literal_table);
 
         /* If the symbol is a literal, add it to the buffer and continue
          * with the next code. */
         if (state->symbol < 256) {
+            if (UNLIKELY(profiled)) {
+                decstream_tally_literals(profiled, 1);
+            }
+            state->state = WRITE_LITERAL;
+          state_WRITE_LITERAL:
+            if (UNLIKELY(RING && out_ofs >= out_size)) {
+                goto out_of_space;
+            }
             PUTBYTE(state->symbol);
             continue;
         }
@@ -976,10 +1023,29 @@ static inline int tinflate_block(DecompressionState *state)
 
         /* Ensure that the distance does not exceed the amount of data in
          * the output buffer.  If it does, return an error. */
-        if (UNLIKELY(out_ofs < distance)) {
+        if (UNLIKELY(out_ofs < distance || distance - 1 > out_mask)) {
             goto error_return;
         }
 
+        /* With a ring buffer, copy as much as fits before out_size, and
+         * resume the copy once the caller has made more room. */
+        if (RING) {
+            if (profiled) {
+                decstream_tally_match(profiled, state->repeat_length, distance);
+            }
+            state->distance = distance;
+            state->state = WRITE_REPEAT;
+          state_WRITE_REPEAT:
+            while (state->repeat_length > 0) {
+                if (out_ofs >= out_size) {
+                    goto out_of_space;
+                }
+                PUTBYTE_SAFE(out_base[(out_ofs - state->distance) & out_mask]);
+                state->repeat_length--;
+            }
+            continue;
+        }
+
         /* Copy bytes from the input buffer to the output buffer.  Since
          * the output pointer advances with each byte written, we can
          * simply use a constant offset (the value of "distance") from the
@@ -1036,6 +1102,19 @@ static inline int tinflate_block(DecompressionState *state)
     state->num_bits  = num_bits;
     return 1;
 
+    /**** Update the state buffer with our local state variables, ****
+     **** and return an out-of-space result (ring buffer only).    ****/
+
+  out_of_space:
+    state->in_ptr    = in_ptr;
+    state->out_ofs   = out_ofs;
+#ifdef WANT_CRC
+    state->crc       = ~icrc & 0xFFFFFFFFUL;
+#endif
+    state->bit_accum = bit_accum;
+    state->num_bits  = num_bits;
+    return 2;
+
     /**** Update the state buffer with our local state variables, ****
      **** and return an error result.                             ****/
 
@@ -1191,10 +1270,14 @@ static int gen_huffman_table(unsigned int symbols,
 
 struct decoder
 {
-	unsigned char   buf[1024];   /* intermediate buffer for loading  */
+	unsigned char   defbuf[DECREADER_BUF_DEFAULT]; /* `buf` if reader lacks one */
+	unsigned char  *buf;         /* intermediate buffer for loading  */
+	unsigned int    buf_size;    /* size of `buf`                    */
+	const struct decreader *reader; /* source of compressed data     */
+	int             err;         /* first DECODE_ERR_* met           */
 	unsigned char  *buf_end;     /* pointer that exists for the sole *
 	                              * purpose of getting size of `buf` */
-	unsigned char  *pstart;      /* offset of next read from rom     */
+	size_t          pstart;      /* offset of next read from file    */
 	unsigned int    remaining;   /* remaining size of file           */
 	unsigned char  *buf_limit;   /* points to end of scannable area  *
 	                              * of buf; this prevents yaz parser *
@@ -1204,7 +1287,7 @@ struct decoder
 #endif
 };
 
-static struct decoder dec;
+static THREADLOCAL struct decoder dec;
 
 /* request more compressed data */
 static inline unsigned refill(void)
@@ -1213,7 +1296,7 @@ static inline unsigned refill(void)
 	unsigned char  *dst = dec.buf;
 	
 	/* calculate size for next read */
-	size = sizeof(dec.buf);
+	size = dec.buf_size;
 	
 	/* if it exceeds remaining file size, use that */
 	if (dec.remaining < size)
@@ -1229,40 +1312,47 @@ static inline unsigned refill(void)
 }
 
 /* main driver */
-size_t zlibdec(void *src_, void *dst_, size_t sz)
+int zlibdec(const struct decreader *src, void *dst_, size_t *decSz)
 {
 	unsigned char *dst = dst_;
-	unsigned char *src = src_;
 	DecompressionState state;
-	
-	/* skip header */
-	src += 8;
-	sz -= 8;
+	int err = DECODE_ERR_DATA;
 	
 	/* initialize decoder structure */
-	dec.buf_end = dec.buf + sizeof(dec.buf);
-	dec.pstart = src;
-	dec.remaining = sz;
+	DECREADER_BEGIN(src);
+	dec.buf_end = dec.buf + dec.buf_size;
+	dec.remaining = src->size;
+	
+	/* skip header */
+	dec.pstart = 8;
+	dec.remaining -= dec.remaining < 8 ? dec.remaining : 8;
 
 	/* clear decompression state buffer */
 	state.state	    = INITIAL;
 	state.out_ofs   = 0;
+	state.out_mask  = ~0UL;
 #ifdef WANT_CRC
 	state.crc	    = 0;
 #endif
 	state.bit_accum = 0;
 	state.num_bits  = 0;
 	state.final	    = 0;
+	state.profiled  = 0;
 	/* no other fields need to be cleared */
 	
 	while (1)
 	{
-		int dstMax = 1024 * 1024 * 32; /* max size of any file: 32mb */
+		long dstMax = src->dst_size;
 		unsigned long size = 0; /* XXX must be zero-initialized */
 		unsigned long crc_ret;
 		unsigned readSize;
 		int result;
 		readSize = refill();
+		
+		/* the stream is truncated */
+		if (!readSize)
+			break;
+		
 		result = tinflate_partial(
 			dec.buf, readSize,
 			dst, dstMax,
@@ -1270,14 +1360,104 @@ size_t zlibdec(void *src_, void *dst_, size_t sz)
 			&state, sizeof(state)
 		);
 		dst += size;
+		
+		/* the data is corrupt */
+		if (result < 0)
+			break;
+		
+		/* the end of the stream */
 		if (!result)
+		{
+			err = DECODE_OK;
 			break;
+		}
 	}
 	
 #if MAJORA
 	dec.buf_end = 0;
 #endif
-	return dst - (unsigned char *)dst_;
+	*decSz = dst - (unsigned char *)dst_;
+	return dec.err ? dec.err : err;
 }
 
 
+
+/* bytes needed for zlibstream()'s s->u.zlib.state */
+unsigned long zlibstream_state_size(void)
+{
+	return sizeof(DecompressionState);
+}
+
+/* incremental driver; expects the 8-byte header to be skipped already */
+int zlibstream(struct decstream *s)
+{
+	DecompressionState *state = s->u.zlib.state;
+	static const unsigned char none;
+	
+	/* tinflate decodes straight into the window */
+	if (s->line == 0)
+	{
+		state->out_mask = s->mask;
+		state->profiled = s->profile ? s : 0;
+		s->line = 1;
+	}
+	
+	for (;;)
+	{
+		unsigned long limit;
+		int result;
+		
+		/* copy pending output from the window */
+		while (s->u.zlib.drained != state->out_ofs && s->out != s->out_end)
+		{
+			unsigned ofs = s->u.zlib.drained & s->mask;
+			unsigned n = state->out_ofs - s->u.zlib.drained;
+			
+			/* contiguous part of the ring buffer */
+			if (n > s->mask + 1 - ofs)
+				n = s->mask + 1 - ofs;
+			if (n > (unsigned)(s->out_end - s->out))
+				n = s->out_end - s->out;
+			
+			memcpy(s->out, s->win + ofs, n);
+			s->out += n;
+			s->u.zlib.drained += n;
+		}
+		s->pos = s->u.zlib.drained;
+		
+		if (s->u.zlib.drained != state->out_ofs)
+			return DECSTREAM_OUTPUT;
+		
+		if (s->u.zlib.done)
+			return DECSTREAM_DONE;
+		
+		/* decode no more than fits in the window, or the output; with
+		 * the output full, this still reads the end of the data */
+		limit = s->out_end - s->out;
+		if (limit > s->mask + 1UL)
+			limit = s->mask + 1UL;
+		result = tinflate_partial(
+			s->in ? s->in : &none, s->in_end - s->in,
+			s->win, state->out_ofs + limit,
+			0, 0,
+			state, zlibstream_state_size()
+		);
+		
+		if (result < 0)
+			return DECSTREAM_ERROR;
+		
+		/* a full window hands back its remaining input */
+		s->in = result == 2 ? state->in_ptr : s->in_end;
+		
+		if (result == 0)
+			s->u.zlib.done = 1;
+		
+		/* nothing was decoded, and all input was consumed */
+		else if (result == 1 && s->u.zlib.drained == state->out_ofs)
+			return DECSTREAM_INPUT;
+		
+		/* nothing more can be decoded without room for it */
+		else if (result == 2 && s->u.zlib.drained == state->out_ofs)
+			return DECSTREAM_OUTPUT;
+	}
+}
@@ -0,0 +1,599 @@
+/*
+ * dma.c <z64.me>
+ *
+ * locating and parsing dmadata
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "dma.h"
+
+#define STRIDE 16 /* bytes per dmadata entry */
+#define IDX    2  /* dmadata references itself at table[IDX] */
+#define DMA_DELETED 0xffffffff /* aka UINT32_MAX */
+
+/* dmaext Pstart flags */
+#define COMPRESSED (1u << 31)
+#define OVERLAP    (1u <<  0)
+#define HEADER     (1u <<  1)
+#define PMASK      (~(COMPRESSED | OVERLAP | HEADER))
+
+/* macros for accessing dmaext entries */
+#define Vstart(X)   (beU32(((const unsigned char *)X) + 0 * 4))
+#define Pbits(X)    (beU32(((const unsigned char *)X) + 1 * 4))
+#define Vend(X)     (beU32(((const unsigned char *)X) + 2 * 4))
+#define Traverse(X) X = (((const unsigned char *)X) + ((Pbits(X) & OVERLAP) ? 2 : 3) * 4)
+
+/* bytes of rom searched at once while locating dmadata */
+#define SCAN_CHUNK 0x10000
+
+/* a window into the rom, for searching it without loading all of it */
+struct scan
+{
+	const struct decreader *rom;
+	unsigned char  *buf;         /* SCAN_CHUNK bytes                  */
+	size_t          ofs;         /* rom offset of buf[0]              */
+	size_t          len;         /* bytes of rom in buf               */
+	int             err;         /* non-zero if a read failed         */
+};
+
+/* read all of rom[ofs, ofs + len) */
+static int rom_read(const struct decreader *rom, size_t ofs, void *dst, size_t len)
+{
+	if (ofs > rom->size || len > rom->size - ofs)
+		return Z64DEC_ERR_RANGE;
+
+	if (rom->read(rom->udata, ofs, dst, len) != len)
+		return Z64DEC_ERR_READ;
+
+	return Z64DEC_OK;
+}
+
+static int scan_open(struct scan *scan, const struct decreader *rom)
+{
+	memset(scan, 0, sizeof(*scan));
+	scan->rom = rom;
+	scan->buf = malloc(SCAN_CHUNK);
+
+	return scan->buf ? Z64DEC_OK : Z64DEC_ERR_NOMEM;
+}
+
+/* get `len` bytes at rom offset `ofs`, or NULL if they lie beyond the end
+ * of the rom or couldn't be read; works best with ascending offsets */
+static const unsigned char *scan_peek(struct scan *scan, size_t ofs, size_t len)
+{
+	const struct decreader *rom = scan->rom;
+
+	if (ofs > rom->size || len > rom->size - ofs || len > SCAN_CHUNK)
+		return NULL;
+
+	if (ofs < scan->ofs || ofs + len > scan->ofs + scan->len)
+	{
+		scan->ofs = ofs;
+		scan->len = rom->size - ofs;
+		if (scan->len > SCAN_CHUNK)
+			scan->len = SCAN_CHUNK;
+		if ((scan->err = rom_read(rom, ofs, scan->buf, scan->len)))
+		{
+			scan->len = 0;
+			return NULL;
+		}
+	}
+
+	return scan->buf + (ofs - scan->ofs);
+}
+
+/* update the entries in the copy of dmadata to describe the decompressed rom */
+static void dma_patch(struct dmaTable *table)
+{
+	int i;
+
+	for (i = 0; i < table->num; ++i)
+	{
+		struct dmaEntry *e = &table->entry[i];
+		unsigned char *row = table->patched + e->row;
+
+		if (table->ext)
+		{
+			wbeU32(row + 4
+				, (e->overlap ? OVERLAP : 0)
+				| (e->header ? HEADER : 0)
+				| e->Vstart
+			);
+		}
+		else if (e->valid)
+		{
+			wbeU32(row +  8, e->Vstart);
+			wbeU32(row + 12, 0);
+		}
+	}
+}
+
+/* dmadata is itself a file; replace the part of an uncompressed file
+ * transferred to dst that overlaps dmadata with the patched entries */
+static void dma_overlay(const struct dmaTable *table, unsigned Pstart, unsigned char *dst, size_t size)
+{
+	size_t lo = Pstart > table->start ? Pstart : table->start;
+	size_t hi = Pstart + size < table->end ? Pstart + size : table->end;
+
+	if (lo < hi)
+		memcpy(dst + (lo - Pstart), table->patched + (lo - table->start), hi - lo);
+}
+
+/* locate and parse dmadata in a retail or iQue rom (returns Z64DEC_ERR_*) */
+int dma_find(struct dmaTable *table, const struct decreader *rom)
+{
+	const unsigned char *dma;
+	struct scan scan;
+	size_t romSz = rom->size;
+	size_t ofs;
+	int found = 0;
+	int err;
+	int i;
+
+	memset(table, 0, sizeof(*table));
+
+	/* too small to contain dmadata */
+	if (romSz < 64)
+		return Z64DEC_ERR_NODMA;
+
+	if ((err = scan_open(&scan, rom)))
+		return err;
+
+	/* find dmadata in rom; each candidate is examined up to the end of
+	 * table[IDX].Vend */
+	for (ofs = 0; ofs < romSz - 32; ofs += STRIDE)
+	{
+		/* table always starts like so */
+		static const unsigned char dmaStartMagic[] = {
+			0x00,0x00,0x00,0x00   /* Vstart */
+			, 0x00,0x00,0x10,0x60 /* Vend   */
+			, 0x00,0x00,0x00,0x00 /* Pstart */
+			, 0x00,0x00,0x00,0x00 /* Pend   */
+			, 0x00,0x00,0x10,0x60 /* Vstart (next) */
+		};
+		/* iQue has the hard-coded value x1050 instead of x1060 */
+		static const unsigned char dmaStartiQue[] = {
+			0x00,0x00,0x00,0x00   /* Vstart */
+			, 0x00,0x00,0x10,0x50 /* Vend   */
+			, 0x00,0x00,0x00,0x00 /* Pstart */
+			, 0x00,0x00,0x00,0x00 /* Pend   */
+			, 0x00,0x00,0x10,0x50 /* Vstart (next) */
+		};
+		unsigned Vend;
+
+		if (!(dma = scan_peek(&scan, ofs, STRIDE * IDX + 8)))
+			break;
+
+		/* data matches iQue */
+		table->iQue = !memcmp(dma, dmaStartiQue, sizeof(dmaStartiQue));
+
+		/* data doesn't match */
+		if (!table->iQue && memcmp(dma, dmaStartMagic, sizeof(dmaStartMagic)))
+			continue;
+
+		/* table[IDX].Vstart isn't current rom offset */
+		if (beU32(dma + STRIDE * IDX) != ofs)
+			continue;
+
+		/* table[IDX].Vend must lie within the rom */
+		Vend = beU32(dma + STRIDE * IDX + 4);
+		if (Vend <= ofs || Vend > romSz)
+			continue;
+
+		/* all tests passed; this is dmadata */
+		table->start = ofs;
+		table->headerless = table->iQue;
+		table->num = (Vend - ofs) / STRIDE;
+		table->end = ofs + table->num * STRIDE;
+		found = 1;
+		break;
+	}
+
+	free(scan.buf);
+	if (scan.err)
+		return scan.err;
+
+	/* failed to locate dmadata in rom */
+	if (!found)
+		return Z64DEC_ERR_NODMA;
+
+	/* add one for the terminator; entries are parsed from the copy of
+	 * dmadata, which is then patched */
+	table->entry = calloc(table->num + 1, sizeof(*table->entry));
+	table->patched = malloc(table->end - table->start + 1);
+	if (!table->entry || !table->patched)
+		return Z64DEC_ERR_NOMEM;
+	if ((err = rom_read(rom, table->start, table->patched, table->end - table->start)))
+		return err;
+
+	/* determine distal end of decompressed rom */
+	table->decSz = romSz;
+	for (dma = table->patched; dma < table->patched + (table->end - table->start); dma += STRIDE)
+	{
+		unsigned Vend = beU32(dma + 4);
+		if (Vend > table->decSz)
+			table->decSz *= 2;
+	}
+
+	/* parse entries */
+	for (i = 0, dma = table->patched; i < table->num; dma += STRIDE, ++i)
+	{
+		struct dmaEntry *e = &table->entry[i];
+
+		e->row    = dma - table->patched;
+		e->Vstart = beU32(dma +  0); /* virtual addresses */
+		e->Vend   = beU32(dma +  4);
+		e->Pstart = beU32(dma +  8); /* physical addresses */
+		e->Pend   = beU32(dma + 12);
+		e->compressed = e->Pend != 0;
+
+		/* unused or invalid entry */
+		e->valid = !(e->Pstart == DMA_DELETED
+			|| e->Vstart == DMA_DELETED
+			|| e->Pend == DMA_DELETED
+			|| e->Vend == DMA_DELETED
+			|| e->Vend <= e->Vstart /* sizes must be > 0 */
+			|| (e->Pend && e->Pend == e->Pstart)
+		);
+	}
+
+	dma_patch(table);
+
+	return Z64DEC_OK;
+}
+
+/* locate and parse dmadata in a rom that uses the ZZRTL dmaext hack */
+int dma_find_ext(struct dmaTable *table, const struct decreader *rom)
+{
+	const unsigned char *dmaCur;
+	const unsigned char *dmaEnd;
+	struct scan scan;
+	size_t romSz = rom->size;
+	size_t ofs;
+	size_t sz;
+	int err;
+	int i;
+
+	memset(table, 0, sizeof(*table));
+	table->ext = 1;
+
+	/* too small to contain dmadata */
+	if (romSz < 64)
+		return Z64DEC_ERR_NODMA;
+
+	if ((err = scan_open(&scan, rom)))
+		return err;
+
+	/* find dmadata in rom */
+	for (ofs = 0; ofs < romSz - 32; ofs += 0x10)
+	{
+		/* it is expected that dmaext dmadata will start with this entry */
+		static unsigned char dmaExtStartMagic[] = {
+			0x00, 0x00, 0x00, 0x00,
+			0x00, 0x00, 0x00, 0x01,
+			0x00, 0x00, 0x10, 0x60,
+			0x00, 0x00, 0x10, 0x61,
+		};
+
+		if (!(dmaCur = scan_peek(&scan, ofs, sizeof(dmaExtStartMagic))))
+			break;
+
+		/* check if the magic value is found */
+		if (!memcmp(dmaCur, dmaExtStartMagic, sizeof(dmaExtStartMagic)))
+		{
+			/* found the start */
+			table->start = ofs;
+			break;
+		}
+	}
+
+	free(scan.buf);
+	if (scan.err)
+		return scan.err;
+	if (ofs >= romSz - 32 || !dmaCur)
+		return Z64DEC_ERR_NODMA;
+
+	/* dmadata is confirmed to be found, now let's find the end of dmadata;
+	 * its length isn't known in advance, so read more of it until the
+	 * terminator turns up (or the end of the rom is reached) */
+	for (sz = 0x1000; ; sz *= 2)
+	{
+		unsigned char *buf;
+
+		if (sz > romSz - table->start)
+			sz = romSz - table->start;
+
+		if (!(buf = realloc(table->patched, sz)))
+			return Z64DEC_ERR_NOMEM;
+		table->patched = buf;
+		if ((err = rom_read(rom, table->start, buf, sz)))
+			return err;
+
+		/* we will also determine the end of the rom in this loop by finding the
+		   largest decompressed end address of all the files */
+		table->decSz = romSz;
+		table->num = 1;
+		dmaEnd = buf + sz;
+		for (dmaCur = buf, Traverse(dmaCur); dmaCur + 12 <= dmaEnd && Vstart(dmaCur) != 0; Traverse(dmaCur))
+		{
+			/* determine the "distal" end of the rom */
+			if (table->decSz < Vend(dmaCur))
+				table->decSz *= 2;
+			table->num += 1;
+		}
+		if (dmaCur + 12 <= dmaEnd)
+		{
+			table->end = table->start + (dmaCur - buf);
+			break;
+		}
+
+		/* the start and end of dmadata must both be found */
+		if (sz == romSz - table->start)
+			return Z64DEC_ERR_NODMA;
+	}
+
+	/* add one for the terminator */
+	table->entry = calloc(table->num + 1, sizeof(*table->entry));
+	if (!table->entry)
+		return Z64DEC_ERR_NOMEM;
+
+	/* parse entries, including the terminator */
+	for (i = 0, dmaCur = table->patched; i <= table->num; ++i, Traverse(dmaCur))
+	{
+		struct dmaEntry *e = &table->entry[i];
+		unsigned Pbits = Pbits(dmaCur);
+
+		e->row        = dmaCur - table->patched;
+		e->Vstart     = Vstart(dmaCur);
+		e->Vend       = Vend(dmaCur);
+		e->Pstart     = Pbits & PMASK;
+		e->compressed = (Pbits & COMPRESSED) != 0;
+		e->header     = (Pbits & HEADER) != 0;
+		e->overlap    = (Pbits & OVERLAP) != 0;
+		e->valid      = i < table->num;
+	}
+
+	dma_patch(table);
+
+	return Z64DEC_OK;
+}
+
+/* find the valid entry containing a virtual address (returns -1 if none) */
+int dma_lookup(const struct dmaTable *table, unsigned vaddr)
+{
+	int i;
+
+	for (i = 0; i < table->num; ++i)
+	{
+		const struct dmaEntry *e = &table->entry[i];
+
+		if (e->valid && vaddr >= e->Vstart && vaddr < e->Vend)
+			return i;
+	}
+
+	return -1;
+}
+
+/* locate the compressed data of entry `e` within rom: `file` receives a
+ * reader of it, starting where the decoders expect its header to be */
+static int dma_file(const struct dmaTable *table, const struct dmaEntry *e, const struct decreader *rom, struct decreader *file)
+{
+	unsigned char header[4];
+	size_t romSz = rom->size;
+	size_t src = e->Pstart;
+	size_t sz;
+	int err;
+	
+	/* dmaext entries don't store the compressed size */
+	if (table->ext)
+	{
+		/* a z64ext header precedes the compressed data */
+		if (e->header)
+		{
+			if (romSz - e->Pstart < 0x14)
+				return Z64DEC_ERR_RANGE;
+			src += 0x10;
+		}
+		else if (romSz - e->Pstart < 4)
+			return Z64DEC_ERR_RANGE;
+		
+		/* the compressed size can't extend beyond the rom */
+		if ((err = rom_read(rom, src, header, 4)))
+			return err;
+		sz = beU32(header);
+		if (sz > romSz - src)
+			sz = romSz - src;
+	}
+	else
+	{
+		/* files are headerless */
+		if (table->headerless)
+		{
+			if (e->Pstart < 8)
+				return Z64DEC_ERR_RANGE;
+			src -= 8;
+		}
+		
+		if (e->Pend > romSz || e->Pend <= src)
+			return Z64DEC_ERR_RANGE;
+		sz = e->Pend - src;
+	}
+	
+	*file = *rom;
+	file->ofs = src;
+	file->size = sz;
+	
+	return Z64DEC_OK;
+}
+
+/* locate the compressed data of entry `index`, for decoding with a stream */
+int dma_source(const struct dmaTable *table, int index, const struct decreader *rom, struct decreader *file)
+{
+	const struct dmaEntry *e;
+	int err;
+	
+	if (index < 0 || index >= table->num || !table->entry[index].valid)
+		return Z64DEC_ERR_ENTRY;
+	
+	e = &table->entry[index];
+	if (e->Pstart >= rom->size)
+		return Z64DEC_ERR_RANGE;
+	
+	if (!e->compressed)
+		return Z64DEC_ERR_CODEC;
+	
+	if ((err = dma_file(table, e, rom, file)))
+		return err;
+	
+	/* the one-shot decoders skip a header that isn't there */
+	if (!table->ext && table->headerless)
+	{
+		file->ofs += 8;
+		file->size -= 8;
+	}
+	
+	return Z64DEC_OK;
+}
+
+/* locate the bytes of rom that entry `index` is transferred from */
+int dma_extent(const struct dmaTable *table, int index, const struct decreader *rom, size_t *ofs, size_t *size)
+{
+	const struct dmaEntry *e;
+	struct decreader file;
+	int err;
+	
+	if (index < 0 || index >= table->num || !table->entry[index].valid)
+		return Z64DEC_ERR_ENTRY;
+	
+	e = &table->entry[index];
+	if (e->Pstart >= rom->size)
+		return Z64DEC_ERR_RANGE;
+	
+	/* not compressed */
+	if (!e->compressed)
+	{
+		if (e->Vend - e->Vstart > rom->size - e->Pstart)
+			return Z64DEC_ERR_RANGE;
+		*ofs = e->Pstart;
+		*size = e->Vend - e->Vstart;
+		return Z64DEC_OK;
+	}
+	
+	if ((err = dma_file(table, e, rom, &file)))
+		return err;
+	
+	/* dmaext: the z64ext header is copied too */
+	if (table->ext && e->header)
+	{
+		file.size += file.ofs - e->Pstart;
+		file.ofs = e->Pstart;
+	}
+	
+	*ofs = file.ofs;
+	*size = file.size;
+	
+	return Z64DEC_OK;
+}
+
+/* transfer entry `index` from rom to dst, decompressing it if needed; *codec
+ * receives the codec used, or CODEC_NONE if it wasn't compressed */
+int dma_decode(const struct dmaTable *table, int index, const struct decreader *rom, unsigned char *dst, size_t dstSz, Codec codecOverride, Codec *codec)
+{
+	const struct dmaEntry *e;
+	struct decreader file;
+	unsigned char header[16];
+	size_t romSz = rom->size;
+	size_t size;
+	size_t decSz;
+	int err;
+	
+	*codec = CODEC_NONE;
+	
+	if (index < 0 || index >= table->num || !table->entry[index].valid)
+		return Z64DEC_ERR_ENTRY;
+	
+	e = &table->entry[index];
+	size = e->Vend - e->Vstart;
+	
+	if (e->Vend < e->Vstart || dstSz < size)
+		return Z64DEC_ERR_SPACE;
+	
+	if (e->Pstart >= romSz)
+		return Z64DEC_ERR_RANGE;
+	
+	/* not compressed */
+	if (!e->compressed)
+	{
+		if (size > romSz - e->Pstart)
+			return Z64DEC_ERR_RANGE;
+		
+		if ((err = rom_read(rom, e->Pstart, dst, size)))
+			return err;
+		dma_overlay(table, e->Pstart, dst, size);
+		return Z64DEC_OK;
+	}
+	
+	if ((err = dma_file(table, e, rom, &file)))
+		return err;
+	
+	/* dmaext: copy z64ext header, then decompress while accounting for it */
+	if (table->ext && e->header)
+	{
+		if (size < 0x10)
+			return Z64DEC_ERR_RANGE;
+		
+		if ((err = rom_read(rom, e->Pstart, dst, 0x10)))
+			return err;
+		dst += 0x10;
+		size -= 0x10;
+	}
+	
+	/* the codec is identified by the file's header */
+	if (decreader_fill(&file, 0, header, sizeof(header)))
+		return Z64DEC_ERR_READ;
+	
+	*codec = pick_codec(header, codecOverride);
+	if (*codec == CODEC_NONE)
+		return Z64DEC_ERR_CODEC;
+	
+	/* decompressed size in header must fit in the entry, not just in
+	 * dst; the decoders stop at the entry's end regardless, but a file
+	 * that says it's too large is reported as such */
+	if (!table->ext && table->headerless)
+	{
+		/* yaz has only its header to tell it where to stop */
+		if (*codec == CODEC_YAZ0)
+			return Z64DEC_ERR_CODEC;
+	}
+	else if (beU32(header + 4) > size)
+		return Z64DEC_ERR_SPACE;
+	
+	/* each call gets its own refill buffer, so entries can be decoded
+	 * from several threads at once */
+	if (!file.buf && file.buf_size && !(file.buf = malloc(file.buf_size)))
+		return Z64DEC_ERR_NOMEM;
+	
+	file.dst_size = size;
+	err = codec_decode(*codec, &file, dst, &decSz);
+	
+	if (file.buf != rom->buf)
+		free(file.buf);
+	
+	/* zlib stops writing at the entry's end, but counts what didn't fit */
+	if (!err && decSz > size)
+		return Z64DEC_ERR_SPACE;
+	
+	return err;
+}
+
+/* free the parsed entries */
+void dma_free(struct dmaTable *table)
+{
+	free(table->entry);
+	free(table->patched);
+	table->entry = NULL;
+	table->patched = NULL;
+}
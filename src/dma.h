@@ -0,0 +1,82 @@
+#ifndef Z64DECOMPRESS_DMA_H_INCLUDED
+#define Z64DECOMPRESS_DMA_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+#include "codec.h"
+#include "decoder/reader.h"
+
+/* big-endian bytes to u32 */
+static inline unsigned beU32(const void *bytes)
+{
+	const unsigned char *b = bytes;
+	return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+/* write u32 as big-endian bytes */
+static inline void wbeU32(void *bytes, unsigned v)
+{
+	unsigned char *b = bytes;
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >>  8;
+	b[3] = v;
+}
+
+/* a file described by dmadata */
+struct dmaEntry
+{
+	unsigned        Vstart;      /* virtual addresses (decompressed)  */
+	unsigned        Vend;
+	unsigned        Pstart;      /* physical addresses (rom)          */
+	unsigned        Pend;        /* zero if unknown or uncompressed   */
+	unsigned char   compressed;  /* non-zero if file is compressed    */
+	unsigned char   header;      /* dmaext: z64ext header precedes it */
+	unsigned char   overlap;     /* dmaext: entry is only two words   */
+	unsigned char   valid;       /* zero if unused or invalid entry   */
+	unsigned        row;         /* offset of entry within dmadata    */
+};
+
+/* dmadata located within a rom */
+struct dmaTable
+{
+	struct dmaEntry *entry;      /* `num` entries, plus a terminator  */
+	int              num;        /* number of dma entries             */
+	size_t           start;      /* offset of dmadata in rom          */
+	size_t           end;        /* offset of end of dmadata in rom   */
+	unsigned char   *patched;    /* dmadata describing decompressed   *
+	                              * rom; at least start..end long     */
+	size_t           decSz;      /* size of decompressed rom          */
+	char             iQue;       /* non-zero if iQue edition          */
+	char             headerless; /* non-zero if files lack 8b header  */
+	char             ext;        /* non-zero if ZZRTL dmaext hack     */
+};
+
+/* locate and parse dmadata in a retail or iQue rom (returns Z64DEC_ERR_*);
+ * `rom` describes the whole rom, so its `ofs` is zero and `size` its size */
+int dma_find(struct dmaTable *table, const struct decreader *rom);
+
+/* locate and parse dmadata in a rom that uses the ZZRTL dmaext hack */
+int dma_find_ext(struct dmaTable *table, const struct decreader *rom);
+
+/* find the valid entry containing a virtual address (returns -1 if none) */
+int dma_lookup(const struct dmaTable *table, unsigned vaddr);
+
+/* locate the compressed data of entry `index` in rom, for decoding with
+ * a stream (so without the 8-byte header of headerless roms' files);
+ * returns Z64DEC_ERR_CODEC if the entry isn't compressed */
+int dma_source(const struct dmaTable *table, int index, const struct decreader *rom, struct decreader *file);
+
+/* locate the bytes of rom that entry `index` is transferred from, which
+ * for compressed files includes any header the decoders read */
+int dma_extent(const struct dmaTable *table, int index, const struct decreader *rom, size_t *ofs, size_t *size);
+
+/* transfer entry `index` from rom to dst, decompressing it if needed; *codec
+ * receives the codec used, or CODEC_NONE if it wasn't compressed; if `rom`
+ * has no `buf` but a `buf_size`, a refill buffer that large is allocated */
+int dma_decode(const struct dmaTable *table, int index, const struct decreader *rom, unsigned char *dst, size_t dstSz, Codec codecOverride, Codec *codec);
+
+/* free the parsed entries */
+void dma_free(struct dmaTable *table);
+
+#endif /* Z64DECOMPRESS_DMA_H_INCLUDED */
@@ -1,6 +1,73 @@
+#ifdef __linux__
+ #define _GNU_SOURCE /* vmsplice */
+#endif
+
 #include <assert.h>
+#include <string.h>
+#include <errno.h>
 
+#include "z64decompress.h"
+#include "file.h"
+#include "archive.h"
 #include "wow.h"
+#ifdef _WIN32
+ #include <io.h> /* _get_osfhandle, _chsize_s, _setmode */
+ #include <fcntl.h> /* _O_BINARY */
+#else
+ #include <unistd.h> /* ftruncate */
+#endif
+#ifdef __linux__
+ #include <fcntl.h>
+ #include <sys/stat.h>
+ #include <sys/uio.h>
+#endif
+
+/* whether a file name stands for stdin or stdout */
+int file_is_std(const char *fn)
+{
+	return fn[0] == '-' && !fn[1];
+}
+
+/* stdin and stdout carry bytes, not text */
+static void file_std_binary(FILE *fp)
+{
+#ifdef _WIN32
+	_setmode(_fileno(fp), _O_BINARY);
+#else
+	(void)fp;
+#endif
+}
+
+/* read all of stdin, which may be a pipe, a chunk at a time; this uses
+ * the plain fread, as wow_fread seeks to find how much is left */
+static void *file_load_stdin(size_t *sz)
+{
+	unsigned char *dst;
+	size_t cap = 1024 * 1024;
+	
+	file_std_binary(stdin);
+	dst = malloc_safe(cap);
+	*sz = 0;
+	for (;;)
+	{
+		size_t got;
+		
+		if (*sz == cap)
+			dst = realloc_safe(dst, cap *= 2);
+		
+		if (!(got = fread(dst + *sz, 1, cap - *sz, stdin)))
+			break;
+		*sz += got;
+	}
+	
+	if (ferror(stdin))
+		die("failed to read contents of '-'");
+	if (!*sz)
+		die("size of file '-' is zero");
+	
+	return dst;
+}
+
 #undef   fopen
 #undef   fread
 #undef   fwrite
@@ -10,6 +77,41 @@
 #define  fwrite  wow_fwrite
 #define  remove  wow_remove
 
+/* write to stdout; with `mapped`, a pipe is handed the pages themselves
+ * on Linux instead of copies of them */
+static void file_write_stdout(const void *data, size_t size, int mapped)
+{
+	const unsigned char *src = data;
+	size_t done = 0;
+#ifdef __linux__
+	struct stat st;
+	
+	if (mapped && !fstat(STDOUT_FILENO, &st) && S_ISFIFO(st.st_mode))
+	{
+		fflush(stdout);
+		while (done < size)
+		{
+			struct iovec iov = { (void *)(src + done), size - done };
+			ssize_t n = vmsplice(STDOUT_FILENO, &iov, 1, 0);
+			
+			if (n < 0 && errno == EINTR)
+				continue;
+			
+			/* not allowed here; just write the rest */
+			if (n <= 0)
+				break;
+			done += n;
+		}
+	}
+#endif
+	
+	file_std_binary(stdout);
+	if ((done < size && fwrite(src + done, 1, size - done, stdout) != size - done)
+		|| fflush(stdout)
+	)
+		die("failed to write contents of '-'");
+}
+
 /* get size of a file; returns 0 if fopen fails */
 unsigned file_size(const char *fn)
 {
@@ -27,6 +129,16 @@ unsigned file_size(const char *fn)
 	return sz;
 }
 
+/* name of the file that dma entry `index` is extracted to */
+char *file_entry_name(const char *dir, int index, unsigned vstart)
+{
+	char *out = malloc_safe(strlen(dir) + 32);
+
+	sprintf(out, "%s%s%04d_%08X.bin", dir, *dir ? "/" : "", index, vstart);
+
+	return out;
+}
+
 /* load a file into an existing buffer */
 void *file_load_into(const char *fn, size_t *sz, void *dst)
 {
@@ -58,6 +170,40 @@ void *file_load_into(const char *fn, size_t *sz, void *dst)
 	return dst;
 }
 
+/* swap a loaded gzip file or zip archive for what it holds (returns
+ * NULL if it can't be read) */
+static void *file_unpack(const char *fn, void *data, size_t *sz)
+{
+	const char *why;
+	void *out;
+	
+	if (!archive_detect(data, *sz))
+		return data;
+	
+	if (!(out = archive_unpack(data, *sz, sz, &why)))
+		fprintf(stderr, "failed to unpack '%s': %s\n", fn, why);
+	free(data);
+	
+	return out;
+}
+
+/* whether a file is a gzip file or zip archive */
+int file_is_archive(const char *fn)
+{
+	unsigned char magic[4];
+	FILE *fp;
+	int is;
+	
+	if (file_is_std(fn) || !(fp = fopen(fn, "rb")))
+		return 0;
+	
+	is = (fread(magic, 1, sizeof(magic), fp) == sizeof(magic))
+		&& archive_detect(magic, sizeof(magic));
+	fclose(fp);
+	
+	return is;
+}
+
 /* load a file */
 void *file_load(const char *fn, size_t *sz)
 {
@@ -66,17 +212,82 @@ void *file_load(const char *fn, size_t *sz)
 	assert(fn);
 	assert(sz);
 	
-	*sz = file_size(fn);
-	if (!*sz)
-		die("failed to get size of file '%s'", fn);
+	if (file_is_std(fn))
+		dst = file_load_stdin(sz);
+	else
+	{
+		*sz = file_size(fn);
+		if (!*sz)
+			die("failed to get size of file '%s'", fn);
+		
+		dst = file_load_into(fn, sz, malloc_safe(*sz));
+	}
 	
-	dst = malloc_safe(*sz);
+	if (!(dst = file_unpack(fn, dst, sz)))
+		exit(EXIT_FAILURE);
 	
-	return file_load_into(fn, sz, dst);
+	return dst;
 }
 
-/* write file */
-unsigned file_write(const char *fn, void *data, unsigned data_sz)
+/* whether `size` bytes are all zero */
+static int file_zero(const unsigned char *p, size_t size)
+{
+	return !*p && !memcmp(p, p + 1, size - 1);
+}
+
+/* write to a file that holds nothing past `ofs`, skipping pages of zeros */
+int file_write_sparse(FILE *fp, size_t ofs, const void *data, size_t size)
+{
+	const unsigned char *src = data;
+	size_t i = 0;
+	
+	while (i < size)
+	{
+		size_t run = FILE_PAGE - (ofs + i) % FILE_PAGE;
+		size_t start;
+		
+		/* pages of zeros are left unwritten */
+		if (run > size - i)
+			run = size - i;
+		if (run == FILE_PAGE && file_zero(src + i, run))
+		{
+			i += run;
+			continue;
+		}
+		
+		/* as is everything up to the next one */
+		start = i;
+		for (i += run; i < size; i += run)
+		{
+			run = size - i < FILE_PAGE ? size - i : FILE_PAGE;
+			if (run == FILE_PAGE && file_zero(src + i, run))
+				break;
+		}
+		
+		if (fseek(fp, ofs + start, SEEK_SET)
+			|| fwrite(src + start, 1, i - start, fp) != i - start
+		)
+			return -1;
+	}
+	
+	return 0;
+}
+
+/* make a file `size` bytes long */
+int file_truncate(FILE *fp, size_t size)
+{
+	if (fflush(fp))
+		return -1;
+	
+#ifdef _WIN32
+	return _chsize_s(_fileno(fp), size) ? -1 : 0;
+#else
+	return ftruncate(fileno(fp), size);
+#endif
+}
+
+/* write file, handing the pages to a pipe on stdout if `mapped` */
+static unsigned file_write_to(const char *fn, void *data, unsigned data_sz, int mapped)
 {
 	FILE *fp;
 	
@@ -84,15 +295,235 @@ unsigned file_write(const char *fn, void *data, unsigned data_sz)
 	assert(data);
 	assert(data_sz);
 	
+	if (file_is_std(fn))
+	{
+		file_write_stdout(data, data_sz, mapped);
+		return data_sz;
+	}
+	
 	fp = fopen(fn, "wb");
 	if (!fp)
 		die("failed to open '%s' for writing", fn);
 	
-	if (fwrite(data, 1, data_sz, fp) != data_sz)
+	if (file_write_sparse(fp, 0, data, data_sz)
+		|| file_truncate(fp, data_sz)
+		|| fclose(fp)
+	)
 		die("failed to write contents of '%s'", fn);
 	
+	return data_sz;
+}
+
+/* write file */
+unsigned file_write(const char *fn, void *data, unsigned data_sz)
+{
+	return file_write_to(fn, data, data_sz, 0);
+}
+
+/* write file from memory that is unmapped once written */
+unsigned file_write_mapped(const char *fn, void *data, unsigned data_sz)
+{
+	return file_write_to(fn, data, data_sz, 1);
+}
+
+/* rewrite only the parts of an existing file that differ */
+size_t file_update(const char *fn, void *data, size_t data_sz)
+{
+	const unsigned char *src = data;
+	unsigned char *old;
+	size_t changed = 0;
+	size_t oldSz;
+	size_t ofs;
+	FILE *fp;
+	long end;
+	
+	assert(fn);
+	assert(data);
+	assert(data_sz);
+	
+	/* nothing to compare against */
+	if (!(fp = fopen(fn, "r+b")))
+		return file_write(fn, data, data_sz);
+	
+	if (fseek(fp, 0, SEEK_END) || (end = ftell(fp)) < 0)
+		die("failed to get size of file '%s'", fn);
+	oldSz = end;
+	
+	/* the contents are compared as they are read, a chunk at a time;
+	 * holding the new contents in memory, that is cheaper than hashing
+	 * both sides */
+	old = malloc_safe(FILE_CHUNK);
+	for (ofs = 0; ofs < data_sz && ofs < oldSz; ofs += FILE_CHUNK)
+	{
+		size_t n = data_sz - ofs < FILE_CHUNK ? data_sz - ofs : FILE_CHUNK;
+		size_t have = oldSz - ofs < n ? oldSz - ofs : n;
+		
+		if (fseek(fp, ofs, SEEK_SET) || fread(old, 1, have, fp) != have)
+			die("failed to read contents of '%s'", fn);
+		
+		if (have == n && !memcmp(old, src + ofs, n))
+			continue;
+		
+		if (fseek(fp, ofs, SEEK_SET) || fwrite(src + ofs, 1, n, fp) != n)
+			die("failed to write contents of '%s'", fn);
+		changed += n;
+	}
+	free(old);
+	
+	/* the part past the end of the old file */
+	if (ofs < data_sz)
+	{
+		if (fseek(fp, ofs, SEEK_SET) || fwrite(src + ofs, 1, data_sz - ofs, fp) != data_sz - ofs)
+			die("failed to write contents of '%s'", fn);
+		changed += data_sz - ofs;
+	}
+	
+	/* or the part of the old file past the new end */
+	if (oldSz > data_sz)
+	{
+		if (file_truncate(fp, data_sz))
+			die("failed to write contents of '%s'", fn);
+		changed += oldSz - data_sz;
+	}
+	
+	if (fclose(fp))
+		die("failed to write contents of '%s'", fn);
+	
+	return changed;
+}
+
+/* z64dec_read_func for files opened by file_reader(); reads at an
+ * explicit offset, so several threads can share the file */
+static size_t file_pread(void *udata, size_t ofs, void *dst, size_t len)
+{
+	size_t done = 0;
+#ifdef _WIN32
+	HANDLE h = (HANDLE)_get_osfhandle(_fileno(udata));
+	
+	while (done < len)
+	{
+		OVERLAPPED at = {0};
+		DWORD got;
+		
+		at.Offset = (DWORD)(ofs + done);
+		at.OffsetHigh = (DWORD)((unsigned long long)(ofs + done) >> 32);
+		if (!ReadFile(h, (char*)dst + done, len - done, &got, &at) || !got)
+			break;
+		done += got;
+	}
+#else
+	int fd = fileno(udata);
+	
+	while (done < len)
+	{
+		ssize_t got = pread(fd, (char*)dst + done, len - done, ofs + done);
+		
+		if (got <= 0)
+			break;
+		done += got;
+	}
+#endif
+	
+	return done;
+}
+
+/* stdin, or a gzip file or zip archive, loaded, as it can't be read at
+ * offsets */
+struct file_memory
+{
+	unsigned char *data;
+	size_t         size;
+};
+
+/* z64dec_read_func for a loaded file */
+static size_t file_mread(void *udata, size_t ofs, void *dst, size_t len)
+{
+	const struct file_memory *m = udata;
+	
+	if (ofs >= m->size)
+		return 0;
+	if (len > m->size - ofs)
+		len = m->size - ofs;
+	memcpy(dst, m->data + ofs, len);
+	
+	return len;
+}
+
+/* open a file for decompressing without loading it into memory */
+int file_reader_open(const char *fn, struct z64dec_reader *reader, unsigned bufSz)
+{
+	FILE *fp;
+	
+	assert(fn);
+	assert(reader);
+	
+	if (file_is_std(fn) || file_is_archive(fn))
+	{
+		struct file_memory *m = malloc_safe(sizeof(*m));
+		
+		if (file_is_std(fn))
+			m->data = file_load_stdin(&m->size);
+		else
+			m->data = file_load_into(fn, &m->size, malloc_safe(file_size(fn)));
+		if (!(m->data = file_unpack(fn, m->data, &m->size)))
+		{
+			free(m);
+			return -1;
+		}
+		reader->size = m->size;
+		reader->udata = m;
+		reader->read = file_mread;
+		reader->bufSz = bufSz;
+		return 0;
+	}
+	
+	fp = fopen(fn, "rb");
+	if (!fp)
+		return -1;
+	
+	fseek(fp, 0, SEEK_END);
+	reader->size = ftell(fp);
+	
+	if (!reader->size || reader->size == (size_t)-1)
+	{
+		fclose(fp);
+		return -1;
+	}
+	
+	reader->read = file_pread;
+	reader->udata = fp;
+	reader->bufSz = bufSz;
+	
+	return 0;
+}
+
+void file_reader(const char *fn, struct z64dec_reader *reader, unsigned bufSz)
+{
+	FILE *fp;
+	
+	if (!file_reader_open(fn, reader, bufSz))
+		return;
+	
+	if (!(fp = fopen(fn, "rb")))
+		die("failed to open '%s' for reading", fn);
 	fclose(fp);
 	
-	return data_sz;
+	/* it has said why */
+	if (file_is_archive(fn))
+		exit(EXIT_FAILURE);
+	die("size of file '%s' is zero", fn);
 }
 
+/* close a file opened by file_reader() */
+void file_reader_close(struct z64dec_reader *reader)
+{
+	if (reader->read == file_mread)
+	{
+		struct file_memory *m = reader->udata;
+		
+		free(m->data);
+		free(m);
+	}
+	else
+		fclose(reader->udata);
+}
@@ -1,17 +1,68 @@
 #ifndef Z64DECOMPRESS_FILE_H_INCLUDED
 #define Z64DECOMPRESS_FILE_H_INCLUDED
 
+#include <stdio.h>
+
+/* granularity at which zeros are left as holes in written files */
+#define FILE_PAGE 4096
+
+/* granularity at which file_update() compares and rewrites files */
+#define FILE_CHUNK (64 * 1024)
+
+/* whether a file name stands for stdin or stdout ("-"), which file_load(),
+ * file_write(), and file_reader() then read or write */
+int file_is_std(const char *fn);
+
 /* get size of a file; returns 0 if fopen fails */
 unsigned file_size(const char *fn);
 
+/* name of the file that dma entry `index` is extracted to, in `dir`
+ * ("" for the current directory); the caller frees it */
+char *file_entry_name(const char *dir, int index, unsigned vstart);
+
 /* load a file into an existing buffer */
 void *file_load_into(const char *fn, size_t *sz, void *dst);
 
+/* whether a file is a gzip file or zip archive, which file_load() and
+ * file_reader() then read what it holds from */
+int file_is_archive(const char *fn);
+
 /* load a file */
 void *file_load(const char *fn, size_t *sz);
 
-/* write file */
+/* write file; pages of zeros are left as holes, which take no space on
+ * file systems with sparse files and read back as zeros on the rest */
 unsigned file_write(const char *fn, void *data, unsigned data_sz);
 
+/* like file_write(), for data that is never modified again and whose
+ * memory is unmapped (not freed to be reused) after; a pipe on stdout can
+ * then be handed its pages with vmsplice() instead of copies of them */
+unsigned file_write_mapped(const char *fn, void *data, unsigned data_sz);
+
+/* write `size` bytes at offset `ofs` of a file opened for writing that
+ * holds nothing from `ofs` on, leaving pages of zeros unwritten; the
+ * file must then be given its size by file_truncate() in case it ends
+ * in one (returns non-zero on failure) */
+int file_write_sparse(FILE *fp, size_t ofs, const void *data, size_t size);
+
+/* write file like file_write(), except that an existing file is compared
+ * with the new contents and only the chunks that differ are rewritten, so
+ * an identical file is left untouched, down to its modification time
+ * (returns the bytes that changed, counting any cut off the end) */
+size_t file_update(const char *fn, void *data, size_t data_sz);
+
+/* make a file `size` bytes long (returns non-zero on failure) */
+int file_truncate(FILE *fp, size_t size);
+
+/* open a file for decompressing without loading it into memory */
+struct z64dec_reader;
+void file_reader(const char *fn, struct z64dec_reader *reader, unsigned bufSz);
+
+/* like file_reader(), but returns non-zero on failure instead of exiting */
+int file_reader_open(const char *fn, struct z64dec_reader *reader, unsigned bufSz);
+
+/* close a file opened by file_reader() */
+void file_reader_close(struct z64dec_reader *reader);
+
 #endif /* Z64DECOMPRESS_FILE_H_INCLUDED */
 
@@ -9,424 +9,516 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 
-#include "decoder/decoder.h"
-#include "n64crc.h"
+#include "z64decompress.h"
+#include "aio.h"
+#include "arena.h"
+#include "batch.h"
+#include "counters.h"
 #include "file.h"
+#include "pool.h"
+#include "probes.h"
+#include "server.h"
+#include "stats.h"
+#include "tokens.h"
+#include "trace.h"
 #include "wow.h"
 
-#define STRIDE 16 /* bytes per dmadata entry */
-#define IDX    2  /* dmadata references itself at table[IDX] */
-#define STR32(X) (unsigned)((X[0]<<24)|(X[1]<<16)|(X[2]<<8)|X[3])
-#define DMA_DELETED 0xffffffff /* aka UINT32_MAX */
-
-typedef enum {
-	CODEC_NONE = -1,
-	CODEC_YAZ0,
-	CODEC_LZO,
-	CODEC_UCL,
-	CODEC_APLIB,
-	CODEC_ZLIB,
-	CODEC_MAX
-} Codec;
-
-typedef struct {
-	const char *name; /* name used for program args */
-	const char *header; /* identifer used in the headers of compressed files */
-	size_t (*decode)(void *src, void *dst, size_t sz); /* decompression handler function */
-} CodecInfo;
-
-static CodecInfo decCodecInfo[CODEC_MAX] = {
-	[CODEC_YAZ0]  = { "yaz"  , "Yaz0", yazdec },
-	[CODEC_LZO]   = { "lzo"  , "LZO0", lzodec },
-	[CODEC_UCL]   = { "ucl"  , "UCL0", ucldec },
-	[CODEC_APLIB] = { "aplib", "APL0", apldec },
-	[CODEC_ZLIB ] = { "zlib" , "ZLIB", zlibdec },
-};
+/* abort if a libz64decompress call failed */
+static void check(int err)
+{
+	if (err)
+		die("ERROR: %s", z64dec_strerror(err));
+}
 
-// non-zero if iQue edition
-static char iQue = 0;
+/* what is measured while decompressing (each NULL unless requested) */
+struct observe
+{
+	struct stats      *stats;  /* --stats */
+	struct trace      *trace;  /* --trace */
+	struct counters   *counters; /* --counters */
+};
 
-// non-zero if files are headerless
-static char headerlessFlag = 0;
+/* pass the library's events to whatever is measuring */
+static void observeEvent(void *udata, const struct z64dec_event *event)
+{
+	struct observe *obs = udata;
+
+	/* hardware counters are read closest to the decompression, so
+	 * that they don't count the other measurements */
+	if (event->type == Z64DEC_EVENT_ENTRY_END)
+		counters_event(obs->counters, event);
+	stats_event(obs->stats, event);
+	trace_event(obs->trace, event);
+	if (event->type != Z64DEC_EVENT_ENTRY_END)
+		counters_event(obs->counters, event);
+}
 
-// This points to an array detailing whether each file in the rom is compressed or not.
-// This allows us to print the arguments that should be passed to the z64compress to recompress the rom.
-// 0 = uncompressed, 1 = compressed, -1 = terminator
-static signed char *fileIsCompressed;
+/* begin measuring the files of an opened rom, whose compressed size is romSz */
+static void observeRom(struct observe *obs, z64dec_rom *rom, size_t romSz)
+{
+	if (!obs->stats && !obs->trace && !obs->counters)
+		return;
 
-// Save the start of dma data for the z64compress args
-static unsigned dmaStartArg = 0; 
+	stats_attach(obs->stats, rom, romSz);
+	trace_attach(obs->trace, rom, romSz);
+	counters_attach(obs->counters, rom);
+	z64dec_rom_set_events(rom, observeEvent, obs);
+}
 
-// Save the last used codec for the z64compress args
-static Codec lastUsedCodec = CODEC_NONE;
+/* a phase that began at `start` (a stats_now() time) has ended */
+static void observePhase(struct observe *obs, enum stats_phase phase, double start)
+{
+	stats_add(obs->stats, phase, stats_now() - start);
+	trace_span(obs->trace, stats_phase_name(phase), start, -1);
+}
 
-Codec get_codec_type_from_name(const char *name)
+/* the file extracted from dma entry `index` has been written */
+static void observeWrite(struct observe *obs, int index, double start)
 {
-	for (int i = 0; i < CODEC_MAX; i++)
-	{
-		if (!strcmp(name, decCodecInfo[i].name))
-		{
-			return (Codec)i;
-		}
-	}
-	return CODEC_NONE;
+	stats_add_write(obs->stats, index, stats_now() - start);
+	trace_span(obs->trace, "write", start, index);
 }
 
-Codec get_codec_type_from_header(const void *header) {
-    for (int i = 0; i < CODEC_MAX; i++)
-    {
-        if (!memcmp(decCodecInfo[i].header, header, 4))
-        {
-            return (Codec)i;
-        }
-    }
-    return CODEC_NONE;
+/* decompress rom (returns pointer to decompressed rom) */
+static void *romdec(z64dec_rom *rom, size_t *dstSz, struct arena *arena, struct observe *obs)
+{
+	struct z64dec_info info;
+	double start;
+	void *dec;
+	
+	z64dec_rom_info(rom, &info);
+	*dstSz = info.size;
+	
+	/* allocate decompressed rom */
+	start = stats_now();
+	dec = arena_reserve(arena, *dstSz, 1);
+	stats_add_alloc(obs->stats, STATS_ALLOC, -1, *dstSz, *dstSz);
+	observePhase(obs, STATS_ALLOC, start);
+	
+	check(z64dec_rom_decode(rom, dec, *dstSz));
+	
+	return dec;
 }
 
-/* big-endian bytes to u32 */
-static inline unsigned beU32(void *bytes)
+/* decompress a single dma entry (returns pointer to decompressed file) */
+static void *entrydec(const z64dec_rom *rom, int index, size_t *dstSz, int *codec, struct observe *obs)
 {
-	unsigned char *b = bytes;
-	return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+	struct z64dec_entry e;
+	void *dec;
+
+	check(z64dec_rom_entry(rom, index, &e));
+	*dstSz = e.vend - e.vstart;
+	dec = calloc_safe(*dstSz, 1);
+	stats_add_alloc(obs->stats, STATS_DECODE, index, *dstSz, *dstSz);
+	check(z64dec_rom_decode_entry(rom, index, dec, *dstSz, codec));
+
+	return dec;
 }
 
-/* write u32 as big-endian bytes */
-static inline void wbeU32(void *bytes, unsigned v)
+/* write a decompressed rom or file, or with --update-in-place rewrite
+ * only what changed in an existing one (returns the bytes that changed) */
+static size_t writeOutput(const char *fn, void *data, size_t size, int update, int mapped)
 {
-	unsigned char *b = bytes;
-	b[0] = v >> 24;
-	b[1] = v >> 16;
-	b[2] = v >>  8;
-	b[3] = v;
+	if (update)
+		return file_update(fn, data, size);
+
+	if (mapped)
+		return file_write_mapped(fn, data, size);
+
+	return file_write(fn, data, size);
 }
 
-/* decompress a file (returns non-zero if unknown codec) */
-static size_t decompress(void *dst, void *src, size_t sz, Codec codecOverride)
+/* state shared by the threads extracting files from a rom */
+struct extractJob
+{
+	const z64dec_rom  *rom;
+	const char        *dir;
+	const int         *which;  /* dma index of each file to extract */
+	int               *codec;  /* codec used by each extracted file */
+	int                update; /* only rewrite what changed         */
+	struct observe    *obs;    /* what is measured while extracting */
+};
+
+/* decompress one dma entry and write it to its own file */
+static void extractEntry(void *udata, int n)
 {
-	Codec codecHeader;
+	struct extractJob *job = udata;
+	struct z64dec_entry e;
+	int index = job->which[n];
+	void *dec;
+	size_t decSz;
+	double start;
+	char *fn;
 
-	assert(src != NULL);
-	assert(dst != NULL);
-	assert(sz != 0);
+	dec = entrydec(job->rom, index, &decSz, &job->codec[n], job->obs);
+
+	z64dec_rom_entry(job->rom, index, &e);
+	fn = file_entry_name(job->dir, index, e.vstart);
+	start = stats_now();
+	PROBE2(write__start, index, decSz);
+	writeOutput(fn, dec, decSz, job->update, 0);
+	PROBE2(write__done, index, decSz);
+	observeWrite(job->obs, index, start);
+
+	free(fn);
+	free(dec);
+}
 
-	/* override codec if requested rather than autodetecting it */
-	if (codecOverride != CODEC_NONE)
+/* write the files at the given dma indices to their own files in a directory,
+ * along with an index describing them */
+static void romextract(const z64dec_rom *rom, const char *dir, const int *which, int count, int update, struct pool *pool, struct observe *obs)
+{
+	struct extractJob job;
+	char *indexName;
+	char *index;
+	size_t indexSz;
+	int i;
+
+	if (!wow_is_dir(dir) && wow_mkdir(dir))
+		die("failed to create directory '%s'", dir);
+
+	/* decompress and write every file in parallel */
+	job.rom = rom;
+	job.dir = dir;
+	job.which = which;
+	job.codec = calloc_safe(count, sizeof(*job.codec));
+	job.update = update;
+	job.obs = obs;
+	pool_for(pool, count, extractEntry, &job);
+
+	/* write index; it is put together in memory first so that it, too, can
+	 * be left untouched by --update-in-place */
+	indexName = malloc_safe(strlen(dir) + 32);
+	sprintf(indexName, "%s/index.txt", dir);
+	index = malloc_safe(64 + (size_t)count * 128);
+	indexSz = sprintf(index, "# index\tvstart\tvend\tpstart\tpend\tcodec\tfile\n");
+	for (i = 0; i < count; ++i)
 	{
-		/* save the last used codec for the z64compress args */
-		lastUsedCodec = codecOverride;
-		return decCodecInfo[codecOverride].decode(src, dst, sz);
+		struct z64dec_entry e;
+		char *fn;
+
+		z64dec_rom_entry(rom, which[i], &e);
+		fn = file_entry_name("", which[i], e.vstart);
+		indexSz += sprintf(index + indexSz, "%d\t0x%08X\t0x%08X\t0x%08X\t0x%08X\t%s\t%s\n"
+			, which[i], e.vstart, e.vend, e.pstart, e.pend
+			, z64dec_codec_name(job.codec[i]), fn
+		);
+		free(fn);
 	}
+	writeOutput(indexName, index, indexSz, update, 0);
+
+	free(index);
+	free(indexName);
+	free(job.codec);
+}
+
+/* a decompressed rom being written a file at a time */
+struct romStream
+{
+	FILE        *fp;
+	const char  *fn;
+	size_t       end;   /* end of the furthest write */
+};
 
-	/* the codec header is the first 4 bytes of the file */
-	codecHeader = get_codec_type_from_header(src);
+/* write `size` bytes at offset `ofs` of a streamed rom; bytes skipped
+ * over read back as zeros, and are left as holes where they fill pages */
+static void streamWrite(struct romStream *out, size_t ofs, const void *data, size_t size)
+{
+	size_t over = 0;
 
-	if (codecHeader != CODEC_NONE)
+	/* what lands on bytes written before replaces them as it is */
+	if (ofs < out->end)
 	{
-		/* save the last used codec for the z64compress args */
-		lastUsedCodec = codecHeader;
-		return decCodecInfo[codecHeader].decode(src, dst, sz);
+		over = out->end - ofs < size ? out->end - ofs : size;
+		if (fseek(out->fp, ofs, SEEK_SET)
+			|| fwrite(data, 1, over, out->fp) != over
+		)
+			die("failed to write contents of '%s'", out->fn);
 	}
 
-	die("ERROR: compressed file, unknown encoding");
-	return 0;
+	/* and the rest can skip pages of zeros */
+	if (size > over
+		&& file_write_sparse(out->fp, ofs + over, (const unsigned char *)data + over, size - over)
+	)
+		die("failed to write contents of '%s'", out->fn);
+
+	if (ofs + size > out->end)
+		out->end = ofs + size;
+}
+
+/* copy the part of [ofs, ofs + size) that lies in the first headSz bytes
+ * of the rom to head */
+static void streamHead(unsigned char *head, size_t headSz, size_t ofs, const void *data, size_t size)
+{
+	if (ofs >= headSz)
+		return;
+
+	memcpy(head + ofs, data, ofs + size > headSz ? headSz - ofs : size);
+}
+
+/* dma entries in order of virtual address */
+struct streamOrder
+{
+	unsigned  vstart;
+	int       index;
+};
+
+static int streamCompare(const void *a, const void *b)
+{
+	const struct streamOrder *oa = a;
+	const struct streamOrder *ob = b;
+
+	if (oa->vstart != ob->vstart)
+		return oa->vstart < ob->vstart ? -1 : 1;
+
+	return oa->index - ob->index;
 }
 
-/* decompress rom that uses the ZZRTL dmaext hack (returns pointer to decompressed rom) */
-static inline void *romdec_dmaext(unsigned char *rom, size_t romSz, size_t *dstSz, Codec codecOverride)
+/* decompress a rom to a file a file at a time, in order of virtual address,
+ * so that only the largest file and the part of the rom the crc covers
+ * are held in memory (returns the codec of the last compressed file) */
+static int romstream(const z64dec_rom *rom, const char *fn, const int *which, int count, struct observe *obs)
 {
-	#define COMPRESSED (1 << 31)
-	#define OVERLAP (1 <<  0)
-	#define HEADER (1 <<  1)
-	#define PMASK (~(COMPRESSED | OVERLAP | HEADER))
-	
-	/* macros for accessing dma entries */
-	#define Vstart(X)   (beU32(((unsigned char *)X) + 0 * 4))
-	#define Pbits(X)    (beU32(((unsigned char *)X) + 1 * 4))
-	#define Pstart(X)   (Pbits(X) & PMASK)
-	#define Vend(X)     (beU32(((unsigned char *)X) + 2 * 4))
-
-	#define Traverse(X) X = (((unsigned char*)X) + ((Pbits(X) & OVERLAP) ? 2 : 3) * 4)
-	
-	unsigned char* dmaStart = NULL;
-	unsigned char* dmaEnd = NULL;
-	unsigned char *dmaCur;
-	unsigned char *dec; // decompressed rom in ram
-	int dmaNum; // used for writing to fileIsCompressed
-
-	/* ensure that dstSz is at least the size of the rom itself, but we will correct the value later */
-	*dstSz = romSz;
-
-	/* check to make sure a codec is provided since with dmaext the autodetection will fail */
-	if (codecOverride == CODEC_NONE)
+	struct romStream out = { NULL, fn, 0 };
+	struct streamOrder *order;
+	struct z64dec_info info;
+	const void *dmadata;
+	size_t dmaSz;
+	unsigned char *head;
+	size_t headSz;
+	size_t largest = 0;
+	int last = Z64DEC_CODEC_AUTO;
+	void *dec;
+	double start;
+	int i;
+
+	z64dec_rom_info(rom, &info);
+	order = malloc_safe(sizeof(*order) * (count + 1));
+	for (i = 0; i < count; ++i)
 	{
-		die("ERROR: dmaext requires a codec to to be provided");
-		return NULL;
+		struct z64dec_entry e;
+
+		z64dec_rom_entry(rom, which[i], &e);
+		order[i].vstart = e.vstart;
+		order[i].index = which[i];
+		if (e.vend - e.vstart > largest)
+			largest = e.vend - e.vstart;
 	}
-	
-	/* find dmadata in rom */
-	for (dmaCur = rom; (unsigned)(dmaCur - rom) < romSz - 32; dmaCur += 0x10)
+	qsort(order, count, sizeof(*order), streamCompare);
+
+	/* one buffer for every file, and a copy of the rom's beginning; a
+	 * rom holds at least its dmadata, but the files may all be empty */
+	start = stats_now();
+	headSz = info.size < Z64DEC_CRC_EXTENT ? info.size : Z64DEC_CRC_EXTENT;
+	head = calloc_safe(headSz, 1);
+	dec = largest ? malloc_safe(largest) : NULL;
+	stats_add_alloc(obs->stats, STATS_ALLOC, -1, headSz + largest, headSz + largest);
+	observePhase(obs, STATS_ALLOC, start);
+
+	if (!(out.fp = wow_fopen(fn, "wb")))
+		die("failed to open '%s' for writing", fn);
+
+	for (i = 0; i < count; ++i)
 	{
-		/* it is expected that dmaext dmadata will start with this entry */
-		static unsigned char dmaExtStartMagic[] = {
-			0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x01,
-			0x00, 0x00, 0x10, 0x60,
-			0x00, 0x00, 0x10, 0x61,
-		};
-
-		/* check if the magic value is found */
-		if (!memcmp(dmaCur, dmaExtStartMagic, sizeof(dmaExtStartMagic)))
-		{
-			/* found the start */
-			dmaStart = dmaCur;
+		struct z64dec_entry e;
+		int index = order[i].index;
+		size_t decSz;
+		int codec = Z64DEC_CODEC_AUTO;
 
-			/* dmadata is confirmed to be found, now let's find the end of dmadata */
-			/* we will also determine the end of the rom in this loop by finding the
-			   largest decompressed end address of all the files */
-			for (dmaCur = dmaStart, Traverse(dmaCur); Vstart(dmaCur) != 0; Traverse(dmaCur))
-			{
-				/* determine the "distal" end of the rom */
-				if (*dstSz < Vend(dmaCur)) {
-					*dstSz *= 2;
-				}
-			}
-			dmaEnd = dmaCur;
-			break;
-		}
+		z64dec_rom_entry(rom, index, &e);
+		decSz = e.vend - e.vstart;
+		
+		/* an empty file leaves nothing to write */
+		if (!decSz)
+			continue;
+		
+		check(z64dec_rom_decode_entry(rom, index, dec, decSz, &codec));
+		if (codec != Z64DEC_CODEC_AUTO)
+			last = codec;
+
+		start = stats_now();
+		PROBE2(write__start, index, decSz);
+		streamWrite(&out, e.vstart, dec, decSz);
+		PROBE2(write__done, index, decSz);
+		observeWrite(obs, index, start);
+		streamHead(head, headSz, e.vstart, dec, decSz);
 	}
 
-	/* check if the start and end of dmadata was found */
-	if (dmaStart == NULL) {
-		die("ERROR: Could not find the start of dmadata!");
-		return NULL;
-	} else if (dmaEnd == NULL) {
-		die("ERROR: Could not find the end of dmadata!");
-		return NULL;
+	/* zeros up to the end of the rom, then the patched dmadata and the
+	 * crc over the files written at the beginning of the rom */
+	start = stats_now();
+	streamWrite(&out, info.size, NULL, 0);
+	dmadata = z64dec_rom_dmadata(rom, &dmaSz);
+	streamWrite(&out, info.dmadata, dmadata, dmaSz);
+	streamHead(head, headSz, info.dmadata, dmadata, dmaSz);
+	observePhase(obs, STATS_WRITE, start);
+
+	if (!z64dec_rom_crc(rom, head, headSz))
+	{
+		start = stats_now();
+		streamWrite(&out, 0x10, head + 0x10, 8);
+		observePhase(obs, STATS_WRITE, start);
 	}
+	if (file_truncate(out.fp, out.end) || fclose(out.fp))
+		die("failed to write contents of '%s'", fn);
 
-	/* since we now know where the end of dmadata is, we can allocate the list of
-		compressed and uncompressed files for printing the z64compress args later. */
-	/* Add one for the terminator */
-	fileIsCompressed = calloc(1, sizeof(signed char) * (((dmaEnd - dmaStart) / 4) + 1));
+	free(order);
+	free(head);
+	free(dec);
 
-	/* allocate decompressed rom */
-	dec = calloc_safe(*dstSz, 1);
+	return last;
+}
+
+/* add a dma index to a selection, unless it's already in it (returns new count) */
+static int selectEntry(int *which, int count, int index)
+{
+	int i;
+
+	for (i = 0; i < count; ++i)
+		if (which[i] == index)
+			return count;
+
+	which[count] = index;
+	return count + 1;
+}
+
+/* select the dma entries given by index or virtual address in comma-separated
+ * lists, or every valid entry if neither is given (returns number selected) */
+static int selectEntries(const z64dec_rom *rom, const char *entries, const char *vaddrs, int **which)
+{
+	struct z64dec_info info;
+	struct z64dec_entry e;
+	int count = 0;
+	int i;
+
+	z64dec_rom_info(rom, &info);
+	*which = malloc_safe(sizeof(**which) * (info.entries + 1));
 
-	/* transfer files from comp to dec, and decompress them if needed */
-	for (dmaNum = 0, dmaCur = dmaStart; dmaCur < dmaEnd; dmaNum++) 
+	/* every valid entry */
+	if (!entries && !vaddrs)
 	{
-		/* if file is compressed, decompress it! */
-		if (Pbits(dmaCur) & COMPRESSED)
-		{
-            if (Pbits(dmaCur) & HEADER)
-            {
-                /* copy z64ext header */
-                memmove(dec + Vstart(dmaCur), rom + Pstart(dmaCur), 0x10);
-
-                /* decompress file while accounting for the header*/
-                decompress(
-                    dec + Vstart(dmaCur) + 0x10, /* dst */
-                    rom + Pstart(dmaCur) + 0x10, /* src */
-                    beU32(rom + Pstart(dmaCur) + 0x10), /* sz */
-                    codecOverride
-                );
-            }
-			else
-			{
-				/* no z64ext header */
-				decompress(
-					dec + Vstart(dmaCur), /* dst */
-					rom + Pstart(dmaCur), /* src */
-					beU32(rom + Pstart(dmaCur)), /* sz */
-					codecOverride
-				);
-			}
-		}
-		else
-		{
-			/* not compressed */
-			memcpy(dec + Vstart(dmaCur), rom + Pstart(dmaCur), Vend(dmaCur) - Vstart(dmaCur));
-		}
+		for (i = 0; i < info.entries; ++i)
+			if (!z64dec_rom_entry(rom, i, &e) && e.valid)
+				(*which)[count++] = i;
+		return count;
+	}
 
-		/* Update dma entries */
-		wbeU32(dmaCur + (4 * 1), (Pbits(dmaCur) & (OVERLAP | HEADER)) | Vstart(dmaCur));
+	/* by index */
+	while (entries && *entries)
+	{
+		char *end;
+		long index = strtol(entries, &end, 0);
 
-		/* find the next dma table entry */
-		Traverse(dmaCur);
+		if (end == entries || z64dec_rom_entry(rom, index, &e) || !e.valid)
+			die("ERROR: invalid dma entry: %s", entries);
 
-		/* update the compressed info */
-		fileIsCompressed[dmaNum] = (Pbits(dmaCur) & COMPRESSED) ? 1 : 0;
+		count = selectEntry(*which, count, index);
+		entries = *end == ',' ? end + 1 : end;
 	}
 
-	/* write the terminator */
-	fileIsCompressed[dmaNum] = -1;
+	/* by virtual address */
+	while (vaddrs && *vaddrs)
+	{
+		char *end;
+		unsigned long vaddr = strtoul(vaddrs, &end, 0);
+		int index;
 
-	/* copy modified dmadata to decompressed rom */
-	memcpy(dec + (dmaStart - rom), dmaStart, dmaEnd - dmaStart);
-	
-	/* update crc */
-	n64crc(dec);
-	
-	/* set the start of dmadata for the z64compress args */
-	dmaStartArg = dmaStart - rom;
+		if (end == vaddrs || (index = z64dec_rom_lookup(rom, vaddr)) < 0)
+			die("ERROR: no dma entry contains virtual address: %s", vaddrs);
 
-	/* return the pointer to the decompressed rom */
-	return dec;
+		count = selectEntry(*which, count, index);
+		vaddrs = *end == ',' ? end + 1 : end;
+	}
+
+	return count;
 }
 
-/* decompress rom (returns pointer to decompressed rom) */
-static inline void *romdec(void *rom, size_t romSz, size_t *dstSz, Codec codecOverride)
+/* parse a size in bytes, which may end in K, M, or G */
+static size_t parseSize(const char *str)
 {
-	unsigned char *comp = rom; /* compressed rom */
-	unsigned char *dec;
-	unsigned char *dma;
-	unsigned char *dmaStart;
-	unsigned char *dmaEnd = 0;
-	unsigned dmaNum = 0;
-	int dmaCur; // used for writing to fileIsCompressed
-	
-	/* find dmadata in rom */
-	dmaStart = 0;
-	for (dma = comp; (unsigned)(dma - comp) < romSz - 32; dma += 16)
-	{
-		/* table always starts like so */
-		static const unsigned char dmaStartMagic[] = {
-			0x00,0x00,0x00,0x00   /* Vstart */
-			, 0x00,0x00,0x10,0x60 /* Vend   */
-			, 0x00,0x00,0x00,0x00 /* Pstart */
-			, 0x00,0x00,0x00,0x00 /* Pend   */
-			, 0x00,0x00,0x10,0x60 /* Vstart (next) */
-		};
-		/* iQue has the hard-coded value x1050 instead of x1060 */
-		static const unsigned char dmaStartiQue[] = {
-			0x00,0x00,0x00,0x00   /* Vstart */
-			, 0x00,0x00,0x10,0x50 /* Vend   */
-			, 0x00,0x00,0x00,0x00 /* Pstart */
-			, 0x00,0x00,0x00,0x00 /* Pend   */
-			, 0x00,0x00,0x10,0x50 /* Vstart (next) */
-		};
-
-		/* data matches iQue */
-		iQue = !memcmp(dma, dmaStartiQue, sizeof(dmaStartiQue));
-		if (iQue)
-			headerlessFlag = 1;
-
-		/* data doesn't match */
-		if (!iQue && memcmp(dma, dmaStartMagic, sizeof(dmaStartMagic)))
-			continue;
-		
-		/* table[IDX].Vstart isn't current rom offset */
-		if (beU32(dma + STRIDE * IDX) != (unsigned)(dma - comp))
-			continue;
-		
-		/* all tests passed; this is dmadata */
-		dmaStart = dma;
-		dmaNum = (beU32(dma + STRIDE * IDX + 4) - (dma - comp)) / STRIDE;
-		dmaEnd = dmaStart + dmaNum * STRIDE;
-
-		/* since we now know how many dma entries there are, we can allocate the list of
-		   compressed and uncompressed files for printing the z64compress args later. */
-		/* Add one for the terminator */
-		fileIsCompressed = calloc(1, sizeof(signed char) * (dmaNum + 1));
-		break;
-	}
-	
-	/* failed to locate dmadata in rom */
-	if (!dmaStart)
-		die("failed to locate dmadata in rom");
-	
-	/* determine distal end of decompressed rom */
-	*dstSz = romSz;
-	for (dma = dmaStart; dma < dmaEnd; dma += STRIDE)
+	char *end;
+	double v = strtod(str, &end);
+
+	switch (*end)
 	{
-		unsigned Vend = beU32(dma + 4);
-		if (Vend > *dstSz)
-			*dstSz *= 2;
+		case 'k': case 'K': v *= 1024; break;
+		case 'm': case 'M': v *= 1024 * 1024; break;
+		case 'g': case 'G': v *= 1024 * 1024 * 1024; break;
+		case '\0': break;
+		default: die("ERROR: invalid size: %s", str);
 	}
-	
-	/* iQue's default compression is zlib */
-	if (iQue && codecOverride == CODEC_NONE)
-		codecOverride = CODEC_ZLIB;
-	
-	/* allocate decompressed rom */
-	dec = calloc_safe(*dstSz, 1);
-	
-	/* transfer files from comp to dec */
-	for (dmaCur = 0, dma = dmaStart; dma < dmaEnd; dma += STRIDE, dmaCur++)
-	{
-		unsigned Vstart = beU32(dma +  0); /* virtual addresses */
-		unsigned Vend   = beU32(dma +  4);
-		unsigned Pstart = beU32(dma +  8); /* physical addresses */
-		unsigned Pend   = beU32(dma + 12);
-		
-		/* unused or invalid entry */
-		if (Pstart == DMA_DELETED
-			|| Vstart == DMA_DELETED
-			|| Pend == DMA_DELETED
-			|| Vend == DMA_DELETED
-			|| Vend <= Vstart /* sizes must be > 0 */
-			|| (Pend && Pend == Pstart)
-		)
-			continue;
-		
-		/* compressed */
-		if (Pend)
-		{
-			/* files are headerless */
-			if (headerlessFlag)
-				Pstart -= 8; 
-			
-			decompress(
-				dec + Vstart     /* dst */
-				, comp + Pstart  /* src */
-				, Pend - Pstart  /* sz  */
-				, codecOverride  /* codecOverride */
-			);
-		}
-		else
-		{
-			/* not compressed */
-			memcpy(dec + Vstart, comp + Pstart, Vend - Vstart);
-		}
 
-		/* update the compressed info */
-		fileIsCompressed[dmaCur] = (Pend) ? 1 : 0;
+	if (v < 1)
+		die("ERROR: invalid size: %s", str);
+
+	return v;
+}
+
+/* die if buffers of `need` bytes don't fit in a --max-memory budget */
+static void budgetCheck(size_t budget, size_t need, const char *hint)
+{
+	if (budget && need > budget)
+		die("ERROR: this needs %lu bytes, more than --max-memory allows%s"
+			, (unsigned long)need, hint
+		);
+}
+
+/* the number of threads that can decompress the selected files at once
+ * within a --max-memory budget; each holds a decompressed file and a
+ * refill buffer, and is limited to the largest of the selected files */
+static int budgetJobs(const z64dec_rom *rom, const int *which, int count, int jobs, unsigned readBuffer, size_t budget)
+{
+	size_t largest = 0;
+	size_t fit;
+	int i;
+
+	if (!budget)
+		return jobs;
+
+	for (i = 0; i < count; ++i)
+	{
+		struct z64dec_entry e;
 
-		/* update dma entry */
-		wbeU32(dma +  8, Vstart);
-		wbeU32(dma + 12, 0);
+		if (!z64dec_rom_entry(rom, which[i], &e) && e.vend - e.vstart > largest)
+			largest = e.vend - e.vstart;
 	}
 
-	/* write the terminator */
-	fileIsCompressed[dmaCur] = -1;
+	budgetCheck(budget, largest + readBuffer, "");
+	fit = budget / (largest + readBuffer);
 
-	/* copy modified dmadata to decompressed rom */
-	memcpy(dec + (dmaStart - comp), dmaStart, dmaNum * STRIDE);
-	
-	/* update crc */
-	n64crc(dec);
+	if (jobs <= 0)
+		jobs = pool_cpus();
+	if ((size_t)jobs > fit)
+	{
+		jobs = fit;
+		fprintf(stderr, "using %d thread%s to stay within --max-memory\n", jobs, jobs == 1 ? "" : "s");
+	}
 
-	/* set the start of dmadata for the z64compress args */
-	dmaStartArg = dmaStart - comp;
-	
-	return dec;
+	return jobs;
 }
 
-static inline void *filedec(void *file, size_t fileSz, size_t *dstSz, Codec codecOverride) {
+/* decompress an individual file into a buffer of the size its header
+ * gives, or Z64DEC_FILE_MAX bytes if it has none (returns pointer to the
+ * decompressed file) */
+static void *filedec(void *file, size_t fileSz, size_t *dstSz, int codec, size_t budget, struct arena *arena, struct observe *obs)
+{
 	unsigned char *dec;
+	size_t decMax;
+	double start;
 
-	/* allocate file */
-	dec = calloc_safe(1024 * 1024 * 8, 1);
+	if (z64dec_file_size(file, fileSz, &decMax))
+		decMax = Z64DEC_FILE_MAX;
+	budgetCheck(budget, fileSz + decMax, "");
+
+	/* allocate file; the decoder writes every byte of it */
+	dec = arena_reserve(arena, decMax, 0);
 	
 	/* decompress */
-	*dstSz = decompress(
-		dec             /* dst */
-		, file          /* src */
-		, fileSz        /* sz  */
-		, codecOverride /* codecOverride */
-	);
+	start = stats_now();
+	check(z64dec_file(file, fileSz, dec, decMax, dstSz, codec));
+	stats_add_alloc(obs->stats, STATS_DECODE, -1, decMax, *dstSz);
+	observePhase(obs, STATS_DECODE, start);
 
 	return dec;
 }
@@ -439,6 +531,10 @@ static char *quickOutname(char *in)
 	char *ss;
 	char *slash;
 	
+	/* what comes from stdin goes to stdout */
+	if (file_is_std(in))
+		return strdup_safe(in);
+	
 	out = malloc_safe(strlen(in) + 1 + strlen(append));
 	strcpy(out, in);
 	
@@ -449,9 +545,16 @@ static char *quickOutname(char *in)
 	if (!slash)
 		slash = out;
 	
-	/* eliminate extension, if there is one */
+	/* eliminate extension, if there is one, and the rom's own extension
+	 * under a .gz one */
 	if ((ss = strrchr(out, '.')) && ss > slash)
+	{
+		int gz = !strcmp(ss, ".gz");
+		
 		*ss = '\0';
+		if (gz && (ss = strrchr(out, '.')) && ss > slash)
+			*ss = '\0';
+	}
 	/* otherwise, so use end of string */
 	ss = slash + strlen(slash);
 	
@@ -468,18 +571,61 @@ static void showargs(void)
 	P("Usage: z64decompress [file-in] [file-out] [options]");
 	P("  The [file-out] argument is optional if you do not use any options.");
 	P("  If not specified, \"file-in.decompressed.extension\" will be generated.");
+	P("  Either may be - to read from stdin or write to stdout.");
+	P("  A [file-in] in a .gz or .zip file is read without extracting it.");
 	P("");
 	P("Options:");
 	P("  -h, --help          show help information");
 	P("  -c, --codec         manually choose the decompression codec");
 	P("  -i, --individual    decompress a single compressed file");
-	P("                      (not for use on roms)");
+	P("                      (not for use on roms), or with a directory as");
+	P("                      [file-in], every file in it into [file-out]");
+	P("  -o, --out-dir DIR   with -i, decompress every file and directory");
+	P("                      named before the options into DIR");
 	P("  -d, --dmaext        decompress rom using the ZZRTL dmaext hack");
 	P("  -k, --headerless    files don't have standard 8-byte header");
+	P("  -x, --extract DIR   write each file in the rom to its own file in DIR");
+	P("  -e, --entry N,...   only decompress the files at these dma indices");
+	P("  -v, --vaddr A,...   only decompress the files containing these");
+	P("                      virtual addresses (e.g. 0xA94000)");
+	P("  -j, --jobs N        number of threads to use (default: all processors)");
+	P("  -r, --read-buffer N bytes read from the rom at a time by --extract,");
+	P("                      --entry, and --vaddr (default: 65536)");
+	P("  -m, --max-memory N  keep the buffers used within N bytes (or NK, NM,");
+	P("                      NG), running fewer threads if need be");
+	P("  -s, --stats         report the time and memory spent in each phase,");
+	P("                      and the time spent on the slowest files");
+	P("  --stats-top N       number of slow files to list (default: 10)");
+	P("  --stats-json FILE   also write the --stats report to FILE as json");
+	P("  --trace FILE        write a timeline of every phase and file to FILE,");
+	P("                      for viewing in Perfetto or chrome://tracing");
+	P("  --counters          report hardware counters (cycles, instructions,");
+	P("                      branch, cache, and tlb misses) per codec and file");
+	P("  --profile-stream    instead of decompressing, print histograms of the");
+	P("                      literal runs, match lengths, and match distances");
+	P("                      in the rom's compressed files, per codec");
+	P("  --profile-json FILE also write them per codec and per file to FILE");
+	P("  --stream            decompress the rom a file at a time, holding only");
+	P("                      the largest file and the first 1 MiB in memory");
+	P("  --server            instead of decompressing [file-in], answer requests");
+	P("                      read a line at a time from stdin (see README)");
+	P("  --in-place          decompress the rom in the buffer it's loaded into,");
+	P("                      instead of a second one");
+	P("  --huge-pages        back the decompressed rom, and the buffers reused by");
+	P("                      -i and --server, with transparent huge pages");
+	P("  --update-in-place   rewrite only the parts of an existing [file-out] (or");
+	P("                      --extract file) that changed, leaving an identical");
+	P("                      one untouched");
+	P("  --io uring|thread   how -i loads and stores many files in the background:");
+	P("                      through io_uring (default, on Linux where the kernel");
+	P("                      allows it) or on a thread of blocking reads and writes");
 	P("");
 	P("Example Usage:");
 	P("   z64decompress \"rom-in.z64\" \"rom-out.z64\"");
 	P("   z64decompress \"file-in.yaz\" \"file-out.bin\" -c yaz -i");
+	P("   z64decompress \"a.yaz\" \"b.yaz\" \"c.yaz\" -i --out-dir \"files\"");
+	P("   z64decompress \"rom-in.z64\" --extract \"files\"");
+	P("   z64decompress \"rom-in.z64\" \"code.bin\" --vaddr 0xA94000");
 #ifdef _WIN32 /* helps users unfamiliar with command line */
 	P("");
 	P("Alternatively, Windows users can close this window and drop");
@@ -502,32 +648,39 @@ static int toMiB(int compSz)
 }
 
 /* creates z64compress args once the rom successfully decompresses */
-static void printZ64CompressArgs(const char* decFileName, size_t compSz, Codec codec, unsigned dmaStart)
+static void printZ64CompressArgs(const char* decFileName, size_t compSz, const z64dec_rom *rom, int codec)
 {
-	int dmaEntries;
-	const char *headerless = headerlessFlag ? " --headerless" : "";
+	struct z64dec_info info;
+	const char *headerless;
+	FILE *out = stdout;
 
-	/* count dma entries */
-	for (dmaEntries = 0; fileIsCompressed[dmaEntries] != -1; dmaEntries++) {}
+	z64dec_rom_info(rom, &info);
+	headerless = info.headerless ? " --headerless" : "";
+
+	/* stdout holds the rom itself */
+	if (file_is_std(decFileName))
+		out = stderr;
 
 	/* print the normal z64compress args */
-	fprintf(stdout, "here are your z64compress arguments:\n");
-	fprintf(stdout, "z64compress --in \"%s\" --out \"out.z64\" --mb %d --codec %s --dma \"0x%X,%d\" --compress \"0-END\"%s",
-		decFileName,               // use the decompressed file name
-		toMiB(compSz),             // convert the compressed size in bytes to megabytes
-		decCodecInfo[codec].name,  // use the codec name
-		dmaStart,                  // start of the dma table
-		dmaEntries,                // number of dma entries
-		headerless                 // files are headerless when recompressing
+	fprintf(out, "here are your z64compress arguments:\n");
+	fprintf(out, "z64compress --in \"%s\" --out \"out.z64\" --mb %d --codec %s --dma \"0x%X,%d\" --compress \"0-END\"%s",
+		decFileName,                    // use the decompressed file name
+		toMiB(compSz),                  // convert the compressed size in bytes to megabytes
+		z64dec_codec_name(codec),       // use the codec name
+		info.dmadata,                   // start of the dma table
+		info.entries,                   // number of dma entries
+		headerless                      // files are headerless when recompressing
 	);
 
 	/* print the file skips */
-	for (int i = 0; i < dmaEntries; i++) {
-		if (!fileIsCompressed[i]) {
-			fprintf(stdout, " --skip \"%d\"", i);
+	for (int i = 0; i < info.entries; i++) {
+		struct z64dec_entry e;
+		z64dec_rom_entry(rom, i, &e);
+		if (!(e.valid && e.compressed)) {
+			fprintf(out, " --skip \"%d\"", i);
 		}
 	}
-	fprintf(stdout, "\n");
+	fprintf(out, "\n");
 }
 
 /**************************************
@@ -588,14 +741,59 @@ wow_main
 
 	/* flag that determines if individual files are decompressed or a whole rom */
 	int individualFlag = 0;
+	
+	/* flag that determines if a rom is decompressed a file at a time */
+	int streamFlag = 0;
+	
+	/* flag that determines if a rom is decompressed in the buffer holding it */
+	int inplaceFlag = 0;
+	
+	/* flag that determines if requests are read from stdin instead */
+	int serverFlag = get_arg_bool(argv, "--server", "--server");
+	
+	/* back large buffers with transparent huge pages */
+	int hugeFlag = 0;
+	
+	/* flag that determines if only what changed in an existing output is
+	 * rewritten */
+	int updateFlag = 0;
+	
+	/* how individual files are loaded and stored in the background */
+	enum aio_backend ioBackend = AIO_URING;
+
+	/* how roms and files are decompressed (dmaext hack, codec to use, etc) */
+	struct z64dec_options options = { .codec = Z64DEC_CODEC_AUTO };
+
+	/* directory that files are extracted to (NULL when decompressing) */
+	const char *extractDir = NULL;
+	
+	/* directory that several individual files are decompressed to */
+	const char *outDir = NULL;
+
+	/* comma-separated dma entries to decompress, by index or virtual address */
+	const char *entryArg = NULL;
+	const char *vaddrArg = NULL;
+
+	/* number of threads to use (0 = one per processor) */
+	int jobs = 0;
 
-	/* flag that determines if dmaext hack is used */
-	int dmaExtFlag = 0;
+	/* bytes read at once when only some of a rom's files are wanted */
+	unsigned readBuffer = 64 * 1024;
 
-	/* name of codec to use (for use with decCodecInfo.name) */
-	Codec codecType = CODEC_NONE;
+	/* bytes of buffers that may be used at once (0 = unlimited) */
+	size_t maxMemory = 0;
 
-	/* decompressed file and size */
+	/* time spent in each phase, and a timeline of it */
+	struct observe obs = { NULL, NULL, NULL };
+	const char *statsJson = NULL;
+	const char *traceName = NULL;
+	const char *profileJson = NULL;
+	int profileFlag = 0;
+	int statsTop = 10;
+	double start;
+
+	/* decompressed file and size, and the arena holding it */
+	struct arena decArena;
 	void *dec;
 	size_t decSz;
 
@@ -603,6 +801,9 @@ wow_main
 	void *comp;
 	size_t compSz;
 	
+	/* bytes of the output that changed */
+	size_t changed;
+	
 	int exitCode = EXIT_SUCCESS;
 	wow_main_argv;
 	
@@ -623,10 +824,23 @@ wow_main
 	
 	/* get the input and output files */
 	inFileName = ARG_INFILE;
-	if (argc <= 2) 
+	if (serverFlag)
+	{
+		/* the requests name them */
+		optionsFlag = 1;
+		outfileName = ARG_OUTFILE;
+	}
+	else if (argc <= 2) 
+	{
+		/* user did not specify output file; one read from stdin isn't a
+		 * file dropped onto the program */
+		optionsFlag = file_is_std(inFileName);
+		outfileName = quickOutname(inFileName);
+	}
+	else if (ARG_OUTFILE[0] == '-' && !file_is_std(ARG_OUTFILE))
 	{
-		/* user did not specify output file */
-		optionsFlag = 0;
+		/* options follow the input file directly */
+		optionsFlag = 1;
 		outfileName = quickOutname(inFileName);
 	}
 	else
@@ -640,75 +854,351 @@ wow_main
 	if (optionsFlag)
 	{
 		const char *codecName;
+		const char *jobsArg;
+		const char *readBufferArg;
+		const char *statsTopArg;
+		const char *maxMemoryArg;
+		const char *ioArg;
 
 		/* booleans */
 		individualFlag = get_arg_bool(argv, "--individual", "-i");
-		headerlessFlag = get_arg_bool(argv, "--headerless", "-k");
-		dmaExtFlag = get_arg_bool(argv, "--dmaext", "-d");
+		streamFlag = get_arg_bool(argv, "--stream", "--stream");
+		inplaceFlag = get_arg_bool(argv, "--in-place", "--in-place");
+		hugeFlag = get_arg_bool(argv, "--huge-pages", "--huge-pages");
+		updateFlag = get_arg_bool(argv, "--update-in-place", "--update-in-place");
+		options.headerless = get_arg_bool(argv, "--headerless", "-k");
+		options.dmaext = get_arg_bool(argv, "--dmaext", "-d");
 
 		/* fields */
 		codecName = get_arg_field(argv, "--codec", "-c");
+		extractDir = get_arg_field(argv, "--extract", "-x");
+		outDir = get_arg_field(argv, "--out-dir", "-o");
+		jobsArg = get_arg_field(argv, "--jobs", "-j");
+		entryArg = get_arg_field(argv, "--entry", "-e");
+		vaddrArg = get_arg_field(argv, "--vaddr", "-v");
+		readBufferArg = get_arg_field(argv, "--read-buffer", "-r");
+		maxMemoryArg = get_arg_field(argv, "--max-memory", "-m");
+		ioArg = get_arg_field(argv, "--io", "--io");
+		statsJson = get_arg_field(argv, "--stats-json", "--stats-json");
+		statsTopArg = get_arg_field(argv, "--stats-top", "--stats-top");
+		traceName = get_arg_field(argv, "--trace", "--trace");
+		profileJson = get_arg_field(argv, "--profile-json", "--profile-json");
+		profileFlag = get_arg_bool(argv, "--profile-stream", "--profile-stream") || profileJson;
+		
+		if (get_arg_bool(argv, "--stats", "-s") || statsJson || statsTopArg)
+			obs.stats = stats_new();
+		
+		if (traceName)
+		{
+			if (individualFlag)
+				die("ERROR: --trace can not be used with individual files!");
+			obs.trace = trace_new();
+		}
+		
+		if (get_arg_bool(argv, "--counters", "--counters"))
+		{
+			if (individualFlag)
+				die("ERROR: --counters can not be used with individual files!");
+			obs.counters = counters_new();
+		}
+		
+		if (statsTopArg)
+			statsTop = atoi(statsTopArg);
+		
+		if (jobsArg)
+			jobs = atoi(jobsArg);
+		
+		if (readBufferArg)
+			readBuffer = strtoul(readBufferArg, NULL, 0);
+		
+		if (maxMemoryArg)
+			maxMemory = parseSize(maxMemoryArg);
+		
+		if (ioArg)
+		{
+			if (!strcmp(ioArg, "uring"))
+				ioBackend = AIO_URING;
+			else if (!strcmp(ioArg, "thread"))
+				ioBackend = AIO_THREAD;
+			else
+				die("ERROR: invalid --io backend: %s (expected uring or thread)", ioArg);
+		}
 		
 		if (codecName)
 		{
-			codecType = get_codec_type_from_name(codecName);
+			options.codec = z64dec_codec_from_name(codecName);
 
-			if (codecType == CODEC_NONE)
+			if (options.codec == Z64DEC_CODEC_AUTO)
 			{
 				die("ERROR: invalid codec name: %s\n", codecName);
 			}
 		}
 	}
 
-	/* attempt to load file */
-	comp = file_load(inFileName, &compSz);
+	/* outputs that aren't written in one piece are always rewritten */
+	if (updateFlag && (serverFlag || streamFlag))
+		die("ERROR: --update-in-place can not be used with %s!", serverFlag ? "--server" : "--stream");
 	
-	if (!individualFlag)
+	/* stdin can only be read once, and stdout only written in order */
+	if (!serverFlag && file_is_std(outfileName) && (streamFlag || updateFlag))
+		die("ERROR: %s can not write to stdout!", streamFlag ? "--stream" : "--update-in-place");
+	if (!serverFlag && file_is_std(inFileName) && (inplaceFlag || outDir))
+		die("ERROR: %s can not read from stdin!", inplaceFlag ? "--in-place" : "--out-dir");
+	if (!serverFlag && inplaceFlag && file_is_archive(inFileName))
+		die("ERROR: --in-place can not read from an archive!");
+	
+	/* answer requests until stdin ends, with roms opened as the options say */
+	if (serverFlag)
 	{
-		/* attempt to decompress rom */
-		if (dmaExtFlag)
+		exitCode = server_run(stdin, stdout, &options, readBuffer, hugeFlag);
+		goto L_cleanup;
+	}
+	
+	/* individual files given as a list or a directory are decompressed
+	 * into a directory, several at once */
+	if (individualFlag && (outDir || wow_is_dir(inFileName)))
+	{
+		struct pool *pool;
+		char **files;
+		int inputs = 1;
+		int count;
+		int failed;
+		
+		/* with --out-dir, every name before the first option is an input;
+		 * otherwise [file-out] names the directory */
+		if (outDir)
+			while (argv[inputs + 1] && argv[inputs + 1][0] != '-')
+				++inputs;
+		else if (outfileName == ARG_OUTFILE)
+			outDir = outfileName;
+		else
+			die("ERROR: give a directory to decompress the files in '%s' to", inFileName);
+		
+		if (options.dmaext)
+			die("ERROR: dmaext can not be used with individual files!");
+		if (obs.stats || updateFlag)
+			die("ERROR: %s can not be used with more than one individual file!"
+				, obs.stats ? "--stats" : "--update-in-place"
+			);
+		
+		count = batch_list(argv + 1, inputs, &files);
+		pool = pool_new(jobs);
+		failed = batch_files(files, count, outDir, options.codec, hugeFlag, ioBackend, maxMemory, pool);
+		pool_free(pool);
+		
+		fprintf(stderr, "decompressed %d files to '%s'\n", count - failed, outDir);
+		if (failed)
+		{
+			fprintf(stderr, "ERROR: %d file%s failed to decompress\n", failed, failed == 1 ? "" : "s");
+			exitCode = EXIT_FAILURE;
+		}
+		batch_free(files, count);
+		goto L_cleanup;
+	}
+	
+	if (extractDir || entryArg || vaddrArg || profileFlag || streamFlag)
+	{
+		struct z64dec_reader reader;
+		z64dec_rom *rom;
+		int *which;
+		int count;
+		
+		if (individualFlag)
+			die("ERROR: %s can not be used with individual files!"
+				, profileFlag ? "--profile-stream" : streamFlag ? "--stream" : "extract"
+			);
+		
+		/* find the requested files, without decompressing the rest of the
+		 * rom, or even loading it; they're read a buffer at a time */
+		file_reader(inFileName, &reader, readBuffer);
+		start = stats_now();
+		check(z64dec_rom_open_reader(&rom, &reader, &options));
+		observePhase(&obs, STATS_SEARCH, start);
+		observeRom(&obs, rom, reader.size);
+		count = selectEntries(rom, entryArg, vaddrArg, &which);
+		/* --stream also holds the part of the rom the crc covers */
+		jobs = budgetJobs(rom, which, count, jobs, readBuffer + (streamFlag ? Z64DEC_CRC_EXTENT : 0), maxMemory);
+		
+		if (profileFlag)
+		{
+			struct pool *pool = pool_new(jobs);
+			
+			tokens_profile(rom, which, count, pool, profileJson);
+			pool_free(pool);
+		}
+		else if (extractDir)
+		{
+			struct pool *pool = pool_new(jobs);
+			
+			romextract(rom, extractDir, which, count, updateFlag, pool, &obs);
+			pool_free(pool);
+			
+			fprintf(stderr, "extracted %d files to '%s' successfully\n", count, extractDir);
+		}
+		else if (streamFlag && !entryArg && !vaddrArg)
 		{
-			dec = romdec_dmaext(comp, compSz, &decSz, codecType);
+			int codec;
+			
+			codec = romstream(rom, outfileName, which, count, &obs);
+			printZ64CompressArgs(outfileName, reader.size, rom, codec);
+			
+			fprintf(stderr, "decompressed rom '%s' written successfully\n", outfileName);
 		}
 		else
 		{
-			dec = romdec(comp, compSz, &decSz, codecType);
+			if (count != 1)
+				die("ERROR: use --extract to write more than one dma entry");
+			
+			/* default to the name --extract would use */
+			if (outfileName != ARG_OUTFILE && !file_is_std(outfileName))
+			{
+				struct z64dec_entry e;
+				
+				z64dec_rom_entry(rom, which[0], &e);
+				free(outfileName);
+				outfileName = file_entry_name("", which[0], e.vstart);
+			}
+			
+			dec = entrydec(rom, which[0], &decSz, NULL, &obs);
+			start = stats_now();
+			PROBE2(write__start, which[0], decSz);
+			changed = writeOutput(outfileName, dec, decSz, updateFlag, 0);
+			PROBE2(write__done, which[0], decSz);
+			observePhase(&obs, STATS_WRITE, start);
+			free(dec);
+			
+			fprintf(stderr, "decompressed file '%s' %s\n", outfileName, updateFlag && !changed ? "is unchanged" : "written successfully");
 		}
 		
+		stats_print(obs.stats, statsTop, statsJson);
+		counters_print(obs.counters, statsTop);
+		trace_write(obs.trace, traceName);
+		free(which);
+		z64dec_rom_close(rom);
+		file_reader_close(&reader);
+		goto L_cleanup;
+	}
+	
+	/* whatever is decompressed from here on is held in an arena */
+	arena_init(&decArena, hugeFlag);
+	
+	/* the rom is loaded into a buffer that can hold it decompressed, and
+	 * decompressed there */
+	if (inplaceFlag)
+	{
+		struct z64dec_reader reader;
+		struct z64dec_info info;
+		z64dec_rom *rom;
+		
+		if (individualFlag)
+			die("ERROR: --in-place can not be used with individual files!");
+		
+		/* dmadata is located before the buffer is allocated */
+		file_reader(inFileName, &reader, readBuffer);
+		start = stats_now();
+		check(z64dec_rom_open_reader(&rom, &reader, &options));
+		observePhase(&obs, STATS_SEARCH, start);
+		observeRom(&obs, rom, reader.size);
+		z64dec_rom_info(rom, &info);
+		decSz = info.size > reader.size ? info.size : reader.size;
+		budgetCheck(maxMemory, decSz, "; --stream decompresses a file at a time");
+		
+		start = stats_now();
+		dec = arena_reserve(&decArena, decSz, 0);
+		stats_add_alloc(obs.stats, STATS_ALLOC, -1, decSz, decSz);
+		observePhase(&obs, STATS_ALLOC, start);
+		
+		start = stats_now();
+		file_load_into(inFileName, &compSz, dec);
+		PROBE1(rom__load, compSz);
+		observePhase(&obs, STATS_LOAD, start);
+		
+		check(z64dec_rom_decode_inplace(rom, dec, decSz));
+		decSz = info.size;
+		
+		/* print arguments for z64compress */
+		z64dec_rom_info(rom, &info);
+		printZ64CompressArgs(outfileName, compSz, rom, info.codec);
+		z64dec_rom_close(rom);
+		file_reader_close(&reader);
+		comp = NULL;
+		goto L_write;
+	}
+	
+	/* the whole file is loaded, and with -i decompressed into a buffer
+	 * of the size its header gives */
+	budgetCheck(maxMemory, file_size(inFileName), "");
+	
+	/* attempt to load file */
+	start = stats_now();
+	comp = file_load(inFileName, &compSz);
+	PROBE1(rom__load, compSz);
+	stats_add_alloc(obs.stats, STATS_LOAD, -1, compSz, compSz);
+	observePhase(&obs, STATS_LOAD, start);
+	
+	if (!individualFlag)
+	{
+		struct z64dec_info info;
+		z64dec_rom *rom;
+		
+		/* attempt to decompress rom */
+		start = stats_now();
+		check(z64dec_rom_open(&rom, comp, compSz, &options));
+		observePhase(&obs, STATS_SEARCH, start);
+		observeRom(&obs, rom, compSz);
+		z64dec_rom_info(rom, &info);
+		budgetCheck(maxMemory, compSz + info.size, "; --stream decompresses a file at a time");
+		dec = romdec(rom, &decSz, &decArena, &obs);
+		
 		/* print arguments for z64compress */
-		printZ64CompressArgs(outfileName, compSz, lastUsedCodec, dmaStartArg);
+		z64dec_rom_info(rom, &info);
+		printZ64CompressArgs(outfileName, compSz, rom, info.codec);
+		z64dec_rom_close(rom);
 	} 
 	else
 	{
-		if (dmaExtFlag)
+		if (options.dmaext)
 		{
 			die("ERROR: dmaext can not be used with individual files!");
 		}
 		/* attempt to decompress individual file */
-		dec = filedec(comp, compSz, &decSz, codecType);
+		dec = filedec(comp, compSz, &decSz, options.codec, maxMemory, &decArena, &obs);
 	}
 
+L_write:
 	/* write out file */
-	file_write(outfileName, dec, decSz);
+	start = stats_now();
+	PROBE2(write__start, -1, decSz);
+	/* the arena is unmapped once it has been written */
+	changed = writeOutput(outfileName, dec, decSz, updateFlag, 1);
+	PROBE2(write__done, -1, decSz);
+	observePhase(&obs, STATS_WRITE, start);
 
 	fprintf(
 		stderr
-		, "decompressed %s '%s' written successfully\n"
+		, "decompressed %s '%s' %s\n"
 		, individualFlag ? "file" : "rom"
 		, outfileName
+		, updateFlag && !changed ? "is unchanged" : "written successfully"
 	);
+	stats_print(obs.stats, statsTop, statsJson);
+	counters_print(obs.counters, statsTop);
+	trace_write(obs.trace, traceName);
 
 	/* cleanup */
 	free(comp);
-	free(dec);
+	arena_release(&decArena);
 
+L_cleanup:
+	stats_free(obs.stats);
+	trace_free(obs.trace);
+	counters_free(obs.counters);
 	if (outfileName != ARG_OUTFILE)
-	{
 		free(outfileName);
 #ifdef _WIN32 /* assume user dropped file onto z64decompress.exe */
+	if (!optionsFlag)
 		getchar();
 #endif
-	}
 	
 	return exitCode;
 }
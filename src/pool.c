@@ -0,0 +1,156 @@
+/*
+ * pool.c <z64.me>
+ *
+ * a tiny worker pool for running loops in parallel
+ *
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+#include "wow.h"
+
+struct pool
+{
+	pthread_t       *thread;     /* worker threads                   */
+	int              threads;    /* number of worker threads         */
+	pthread_mutex_t  lock;
+	pthread_cond_t   wake;       /* signalled when work is posted    */
+	pthread_cond_t   done;       /* signalled when work is finished  */
+	void           (*func)(void *udata, int index);
+	void            *udata;
+	int              count;      /* number of indices in current job */
+	int              next;       /* next index to hand out           */
+	int              finished;   /* number of indices completed      */
+	int              quit;       /* non-zero when shutting down      */
+};
+
+/* claim and run indices until the current job has none left */
+static void pool_work(struct pool *pool)
+{
+	while (pool->next < pool->count)
+	{
+		int index = pool->next++;
+
+		pthread_mutex_unlock(&pool->lock);
+		pool->func(pool->udata, index);
+		pthread_mutex_lock(&pool->lock);
+
+		if (++pool->finished == pool->count)
+			pthread_cond_broadcast(&pool->done);
+	}
+}
+
+static void *pool_thread(void *udata)
+{
+	struct pool *pool = udata;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;)
+	{
+		while (!pool->quit && pool->next >= pool->count)
+			pthread_cond_wait(&pool->wake, &pool->lock);
+
+		if (pool->quit)
+			break;
+
+		pool_work(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/* number of processors available to this process */
+int pool_cpus(void)
+{
+	int n;
+
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	n = info.dwNumberOfProcessors;
+#else
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return n < 1 ? 1 : n;
+}
+
+/* create a worker pool; threads <= 0 uses one thread per processor */
+struct pool *pool_new(int threads)
+{
+	struct pool *pool = calloc_safe(1, sizeof(*pool));
+	int i;
+
+	if (threads <= 0)
+		threads = pool_cpus();
+
+	/* the thread calling pool_for() is a worker too */
+	pool->threads = threads - 1;
+	pool->thread = calloc_safe(threads, sizeof(*pool->thread));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (i = 0; i < pool->threads; ++i)
+		if (pthread_create(&pool->thread[i], NULL, pool_thread, pool))
+			die("failed to create worker thread");
+
+	return pool;
+}
+
+/* number of threads that work on jobs, including the calling thread */
+int pool_threads(struct pool *pool)
+{
+	return pool->threads + 1;
+}
+
+/* call func(udata, index) for every index in [0, count) across all
+ * threads in the pool, and return once every call has finished */
+void pool_for(struct pool *pool, int count, void func(void *udata, int index), void *udata)
+{
+	if (count <= 0)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->udata = udata;
+	pool->count = count;
+	pool->next = 0;
+	pool->finished = 0;
+	pthread_cond_broadcast(&pool->wake);
+
+	pool_work(pool);
+	while (pool->finished < pool->count)
+		pthread_cond_wait(&pool->done, &pool->lock);
+
+	/* nothing left to hand out */
+	pool->count = 0;
+	pool->next = 0;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/* stop and free a worker pool */
+void pool_free(struct pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->threads; ++i)
+		pthread_join(pool->thread[i], NULL);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+	pthread_cond_destroy(&pool->done);
+	free(pool->thread);
+	free(pool);
+}
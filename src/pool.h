@@ -0,0 +1,22 @@
+#ifndef Z64DECOMPRESS_POOL_H_INCLUDED
+#define Z64DECOMPRESS_POOL_H_INCLUDED
+
+struct pool;
+
+/* number of processors available to this process */
+int pool_cpus(void);
+
+/* create a worker pool; threads <= 0 uses one thread per processor */
+struct pool *pool_new(int threads);
+
+/* number of threads that work on jobs, including the calling thread */
+int pool_threads(struct pool *pool);
+
+/* call func(udata, index) for every index in [0, count) across all
+ * threads in the pool, and return once every call has finished */
+void pool_for(struct pool *pool, int count, void func(void *udata, int index), void *udata);
+
+/* stop and free a worker pool */
+void pool_free(struct pool *pool);
+
+#endif /* Z64DECOMPRESS_POOL_H_INCLUDED */
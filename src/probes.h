@@ -0,0 +1,35 @@
+#ifndef Z64DECOMPRESS_PROBES_H_INCLUDED
+#define Z64DECOMPRESS_PROBES_H_INCLUDED
+
+/* USDT (SystemTap-style) static probes, for bpftrace and the like to
+ * attach to a running z64decompress; build with make USDT=1, which
+ * needs <sys/sdt.h> (systemtap-sdt-dev or systemtap-sdt-devel); without
+ * it they compile to nothing
+ *
+ * provider z64decompress:
+ *   rom__load(size)                     rom read into memory
+ *   dmadata__found(start, entries)      dmadata located and parsed
+ *   entry__start(index, vstart, vsize, psize)
+ *   entry__done(index, codec, vsize, error)
+ *   crc__start()
+ *   crc__done()
+ *   write__start(index, size)           index is -1 for a whole rom
+ *   write__done(index, size)
+ *
+ * psize is 0 where dmadata doesn't store it (dmaext, uncompressed files)
+ */
+
+#ifdef Z64DEC_USDT
+ #include <sys/sdt.h>
+ #define PROBE0(NAME)             DTRACE_PROBE(z64decompress, NAME)
+ #define PROBE1(NAME, A)          DTRACE_PROBE1(z64decompress, NAME, A)
+ #define PROBE2(NAME, A, B)       DTRACE_PROBE2(z64decompress, NAME, A, B)
+ #define PROBE4(NAME, A, B, C, D) DTRACE_PROBE4(z64decompress, NAME, A, B, C, D)
+#else
+ #define PROBE0(NAME)             do { } while (0)
+ #define PROBE1(NAME, A)          do { } while (0)
+ #define PROBE2(NAME, A, B)       do { } while (0)
+ #define PROBE4(NAME, A, B, C, D) do { } while (0)
+#endif
+
+#endif /* Z64DECOMPRESS_PROBES_H_INCLUDED */
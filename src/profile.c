@@ -0,0 +1,81 @@
+/*
+ * profile.c <z64.me>
+ *
+ * tallying the tokens the stream decoders find in compressed data
+ *
+ */
+
+#include "z64decompress.h"
+#include "decoder/stream.h"
+
+/* power-of-two bucket of a length or distance */
+static unsigned bucket(unsigned v)
+{
+	unsigned b = 0;
+
+	while (v > 1 && b < Z64DEC_PROFILE_BUCKETS - 1)
+	{
+		v >>= 1;
+		++b;
+	}
+
+	return b;
+}
+
+/* the literals between two back references make one run */
+static void end_run(struct decstream *s)
+{
+	if (!s->run)
+		return;
+
+	s->profile->literalRuns[bucket(s->run)] += 1;
+	s->run = 0;
+}
+
+/* n more literals */
+void decstream_tally_literals(struct decstream *s, unsigned n)
+{
+	s->profile->literals += n;
+	s->run += n;
+}
+
+/* a back reference of `len` bytes from `dist` bytes back */
+void decstream_tally_match(struct decstream *s, unsigned len, unsigned dist)
+{
+	struct z64dec_profile *p = s->profile;
+
+	end_run(s);
+	p->matches += 1;
+	p->matchBytes += len;
+	p->matchLengths[bucket(len)] += 1;
+	p->matchDistances[bucket(dist)] += 1;
+}
+
+/* the end of the file */
+void decstream_tally_end(struct decstream *s)
+{
+	end_run(s);
+	s->profile->files += 1;
+}
+
+/* a zlib block of the given type, holding `stored` bytes if it's stored */
+void decstream_tally_block(struct decstream *s, unsigned type, unsigned stored)
+{
+	struct z64dec_profile *p = s->profile;
+
+	p->blocks[type] += 1;
+	p->storedBytes += stored;
+}
+
+/* the code lengths of a dynamic zlib block's huffman tables */
+void decstream_tally_codes(struct decstream *s, const unsigned char *lit, unsigned nlit, const unsigned char *dist, unsigned ndist)
+{
+	struct z64dec_profile *p = s->profile;
+	unsigned i;
+
+	for (i = 0; i < nlit; ++i)
+		p->literalCodes[lit[i] & 15] += 1;
+
+	for (i = 0; i < ndist; ++i)
+		p->distanceCodes[dist[i] & 15] += 1;
+}
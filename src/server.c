@@ -0,0 +1,430 @@
+/*
+ * server.c <z64.me>
+ *
+ * a persistent worker answering decompression requests, so build systems
+ * that decompress a little at a time don't start a process for each
+ *
+ * each request is a line of fields separated by tabs (or by spaces, if
+ * there are no tabs); each answer is a line beginning with "ok" or
+ * "error", followed by tab-separated details:
+ *
+ *   rom IN OUT          decompress rom IN to OUT      ok SIZE CODEC
+ *   entry IN OUT N      decompress dma entry N of IN  ok SIZE CODEC
+ *   extract IN DIR      decompress every file of IN   ok FILES
+ *                       into DIR, named as --extract
+ *                       names them
+ *   file IN OUT         decompress individual file    ok SIZE
+ *   quit                stop answering                ok
+ *
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "server.h"
+#include "arena.h"
+#include "file.h"
+#include "wow.h"
+
+/* roms kept open between requests */
+#define SERVER_ROMS 8
+
+/* most fields in a request */
+#define SERVER_FIELDS 8
+
+/* a rom whose dmadata has been located */
+struct serverRom
+{
+	char                 *path;     /* NULL if the slot is free      */
+	size_t                size;
+	time_t                mtime;    /* reopened if it changes        */
+	struct z64dec_reader  reader;
+	z64dec_rom           *rom;
+	unsigned              used;     /* request it was last used for  */
+};
+
+struct server
+{
+	const struct z64dec_options *options;
+	unsigned              readBuffer;
+	struct serverRom      rom[SERVER_ROMS];
+	unsigned              requests;
+	struct arena          dec;      /* reused for decompressed data  */
+	struct arena          comp;     /* reused for individual files   */
+	FILE                 *out;
+};
+
+static void answer(struct server *server, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+
+/* write an answer line */
+static void answer(struct server *server, const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vfprintf(server->out, fmt, args);
+	va_end(args);
+	fputc('\n', server->out);
+	fflush(server->out);
+}
+
+static void forget(struct serverRom *r)
+{
+	z64dec_rom_close(r->rom);
+	file_reader_close(&r->reader);
+	free(r->path);
+	r->path = NULL;
+}
+
+/* get an opened rom, opening it unless it is open and unchanged (returns
+ * NULL after answering with an error) */
+static z64dec_rom *openRom(struct server *server, const char *path)
+{
+	struct serverRom *r = NULL;
+	struct stat st;
+	int err;
+	int i;
+
+	if (stat(path, &st))
+	{
+		answer(server, "error\tfailed to open '%s' for reading", path);
+		return NULL;
+	}
+
+	for (i = 0; i < SERVER_ROMS; ++i)
+	{
+		struct serverRom *s = &server->rom[i];
+
+		if (!s->path || strcmp(s->path, path))
+			continue;
+
+		if (s->size == (size_t)st.st_size && s->mtime == st.st_mtime)
+		{
+			s->used = server->requests;
+			return s->rom;
+		}
+
+		forget(s);
+		break;
+	}
+
+	/* the least recently used slot */
+	for (i = 0; i < SERVER_ROMS; ++i)
+		if (!r || !server->rom[i].path || (r->path && server->rom[i].used < r->used))
+			r = &server->rom[i];
+	if (r->path)
+		forget(r);
+
+	if (file_reader_open(path, &r->reader, server->readBuffer))
+	{
+		answer(server, "error\tfailed to open '%s' for reading", path);
+		return NULL;
+	}
+
+	if ((err = z64dec_rom_open_reader(&r->rom, &r->reader, server->options)))
+	{
+		file_reader_close(&r->reader);
+		answer(server, "error\t%s", z64dec_strerror(err));
+		return NULL;
+	}
+
+	r->path = strdup_safe(path);
+	r->size = st.st_size;
+	r->mtime = st.st_mtime;
+	r->used = server->requests;
+
+	return r->rom;
+}
+
+/* write a file (returns non-zero after answering with an error) */
+static int writeFile(struct server *server, const char *fn, const void *data, size_t size)
+{
+	FILE *fp;
+	int err = 0;
+
+	if (!(fp = wow_fopen(fn, "wb")))
+	{
+		answer(server, "error\tfailed to open '%s' for writing", fn);
+		return 1;
+	}
+
+	if (file_write_sparse(fp, 0, data, size) || file_truncate(fp, size))
+		err = 1;
+	if (fclose(fp))
+		err = 1;
+	if (err)
+		answer(server, "error\tfailed to write contents of '%s'", fn);
+
+	return err;
+}
+
+/* decompress a whole rom */
+static void requestRom(struct server *server, char **field)
+{
+	struct z64dec_info info;
+	z64dec_rom *rom;
+	int err;
+
+	if (!(rom = openRom(server, field[1])))
+		return;
+
+	z64dec_rom_info(rom, &info);
+	arena_reserve(&server->dec, info.size, 1);
+	if ((err = z64dec_rom_decode(rom, server->dec.data, info.size)))
+	{
+		answer(server, "error\t%s", z64dec_strerror(err));
+		return;
+	}
+
+	if (writeFile(server, field[2], server->dec.data, info.size))
+		return;
+
+	z64dec_rom_info(rom, &info);
+	answer(server, "ok\t%lu\t%s", (unsigned long)info.size, z64dec_codec_name(info.codec));
+}
+
+/* decompress dma entry `index` of a rom into the reused buffer (returns
+ * non-zero after answering with an error) */
+static int decodeEntry(struct server *server, z64dec_rom *rom, int index, size_t *size, int *codec)
+{
+	struct z64dec_entry e;
+	int err;
+
+	if ((err = z64dec_rom_entry(rom, index, &e)) || !e.valid)
+	{
+		answer(server, "error\t%s", z64dec_strerror(Z64DEC_ERR_ENTRY));
+		return 1;
+	}
+
+	*size = e.vend - e.vstart;
+	arena_reserve(&server->dec, *size, 0);
+	if ((err = z64dec_rom_decode_entry(rom, index, server->dec.data, *size, codec)))
+	{
+		answer(server, "error\t%s", z64dec_strerror(err));
+		return 1;
+	}
+
+	return 0;
+}
+
+/* decompress one dma entry */
+static void requestEntry(struct server *server, char **field)
+{
+	z64dec_rom *rom;
+	char *end;
+	long index;
+	size_t size;
+	int codec;
+
+	index = strtol(field[3], &end, 0);
+	if (end == field[3] || *end)
+	{
+		answer(server, "error\tinvalid dma entry: %s", field[3]);
+		return;
+	}
+
+	if (!(rom = openRom(server, field[1])))
+		return;
+
+	if (decodeEntry(server, rom, index, &size, &codec)
+		|| writeFile(server, field[2], server->dec.data, size)
+	)
+		return;
+
+	answer(server, "ok\t%lu\t%s", (unsigned long)size, z64dec_codec_name(codec));
+}
+
+/* decompress every dma entry into a directory */
+static void requestExtract(struct server *server, char **field)
+{
+	struct z64dec_info info;
+	z64dec_rom *rom;
+	const char *dir = field[2];
+	char *fn;
+	int count = 0;
+	int i;
+
+	if (!(rom = openRom(server, field[1])))
+		return;
+
+	if (!wow_is_dir(dir) && wow_mkdir(dir))
+	{
+		answer(server, "error\tfailed to create directory '%s'", dir);
+		return;
+	}
+
+	z64dec_rom_info(rom, &info);
+	for (i = 0; i < info.entries; ++i)
+	{
+		struct z64dec_entry e;
+		size_t size;
+		int codec;
+		int failed;
+
+		if (z64dec_rom_entry(rom, i, &e) || !e.valid)
+			continue;
+
+		fn = file_entry_name(dir, i, e.vstart);
+		failed = decodeEntry(server, rom, i, &size, &codec)
+			|| writeFile(server, fn, server->dec.data, size);
+		free(fn);
+		if (failed)
+			break;
+		++count;
+	}
+
+	if (i == info.entries)
+		answer(server, "ok\t%d", count);
+}
+
+/* decompress an individual file */
+static void requestFile(struct server *server, char **field)
+{
+	FILE *fp;
+	size_t compSz;
+	size_t decMax;
+	size_t decSz;
+	long end;
+	int err;
+
+	if (!(fp = wow_fopen(field[1], "rb")))
+	{
+		answer(server, "error\tfailed to open '%s' for reading", field[1]);
+		return;
+	}
+	if (fseek(fp, 0, SEEK_END) || (end = ftell(fp)) <= 0)
+	{
+		fclose(fp);
+		answer(server, "error\tsize of file '%s' is zero", field[1]);
+		return;
+	}
+	compSz = end;
+	arena_reserve(&server->comp, compSz, 0);
+	fseek(fp, 0, SEEK_SET);
+	if (fread(server->comp.data, 1, compSz, fp) != compSz)
+	{
+		fclose(fp);
+		answer(server, "error\tfailed to read contents of '%s'", field[1]);
+		return;
+	}
+	fclose(fp);
+
+	if (z64dec_file_size(server->comp.data, compSz, &decMax))
+		decMax = Z64DEC_FILE_MAX;
+	arena_reserve(&server->dec, decMax, 0);
+	if ((err = z64dec_file(server->comp.data, compSz, server->dec.data, decMax, &decSz, server->options->codec)))
+	{
+		answer(server, "error\t%s", z64dec_strerror(err));
+		return;
+	}
+
+	if (writeFile(server, field[2], server->dec.data, decSz))
+		return;
+
+	answer(server, "ok\t%lu", (unsigned long)decSz);
+}
+
+/* split a request into fields (returns how many) */
+static int split(char *line, char **field)
+{
+	const char *sep = strchr(line, '\t') ? "\t" : " ";
+	int count = 0;
+	char *tok;
+
+	for (tok = strtok(line, sep); tok && count < SERVER_FIELDS; tok = strtok(NULL, sep))
+		field[count++] = tok;
+
+	return count;
+}
+
+/* read a line of any length, without its line ending (returns NULL at
+ * the end of the input) */
+static char *readLine(FILE *in, char **line, size_t *lineSz)
+{
+	size_t len = 0;
+
+	if (!*line)
+		*line = malloc_safe(*lineSz = 256);
+
+	while (fgets(*line + len, *lineSz - len, in))
+	{
+		len += strlen(*line + len);
+		if (len && (*line)[len - 1] == '\n')
+			break;
+		*line = realloc_safe(*line, *lineSz *= 2);
+	}
+
+	if (!len)
+		return NULL;
+
+	while (len && ((*line)[len - 1] == '\n' || (*line)[len - 1] == '\r'))
+		(*line)[--len] = '\0';
+
+	return *line;
+}
+
+/* answer requests until the input ends */
+int server_run(FILE *in, FILE *out, const struct z64dec_options *options, unsigned readBuffer, int huge)
+{
+	static const struct
+	{
+		const char  *name;
+		int          fields;
+		void       (*func)(struct server *server, char **field);
+	} request[] = {
+		{ "rom",     3, requestRom     },
+		{ "entry",   4, requestEntry   },
+		{ "extract", 3, requestExtract },
+		{ "file",    3, requestFile    },
+	};
+	struct server server = { 0 };
+	char *line = NULL;
+	size_t lineSz = 0;
+	int i;
+
+	server.options = options;
+	server.readBuffer = readBuffer;
+	server.out = out;
+	arena_init(&server.dec, huge);
+	arena_init(&server.comp, huge);
+
+	while (readLine(in, &line, &lineSz))
+	{
+		char *field[SERVER_FIELDS];
+		int count = split(line, field);
+
+		if (!count)
+			continue;
+
+		++server.requests;
+		if (!strcmp(field[0], "quit"))
+		{
+			answer(&server, "ok");
+			break;
+		}
+
+		for (i = 0; i < (int)(sizeof(request) / sizeof(*request)); ++i)
+			if (!strcmp(field[0], request[i].name))
+				break;
+
+		if (i == (int)(sizeof(request) / sizeof(*request)))
+			answer(&server, "error\tunknown request: %s", field[0]);
+		else if (count != request[i].fields)
+			answer(&server, "error\t%s takes %d arguments", request[i].name, request[i].fields - 1);
+		else
+			request[i].func(&server, field);
+	}
+
+	for (i = 0; i < SERVER_ROMS; ++i)
+		if (server.rom[i].path)
+			forget(&server.rom[i]);
+	arena_release(&server.dec);
+	arena_release(&server.comp);
+	free(line);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,15 @@
+#ifndef Z64DECOMPRESS_SERVER_H_INCLUDED
+#define Z64DECOMPRESS_SERVER_H_INCLUDED
+
+#include <stdio.h>
+
+#include "z64decompress.h"
+
+/* answer requests read a line at a time from `in` with a line each on
+ * `out` until `in` ends or a quit request arrives, keeping roms open and
+ * buffers mapped between them, with huge pages if `huge` is set; roms
+ * are opened with `options` and read `readBuffer` bytes at a time
+ * (returns EXIT_SUCCESS) */
+int server_run(FILE *in, FILE *out, const struct z64dec_options *options, unsigned readBuffer, int huge);
+
+#endif /* Z64DECOMPRESS_SERVER_H_INCLUDED */
@@ -0,0 +1,479 @@
+/*
+ * stats.c <z64.me>
+ *
+ * measuring where the time goes while decompressing a rom
+ *
+ */
+
+#ifdef __linux__
+ #define _GNU_SOURCE /* RUSAGE_THREAD */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef _WIN32
+ #define PSAPI_VERSION 2
+ #include <windows.h>
+ #include <psapi.h>
+#else
+ #include <sys/resource.h>
+#endif
+
+#include "stats.h"
+#include "wow.h"
+#include "threadlocal.h"
+
+/* a file taken from the rom */
+struct stats_file
+{
+	double   start;      /* when it began decompressing           */
+	double   seconds;    /* time taken to decompress or copy it   */
+	double   write;      /* time taken to write it, if extracted  */
+	size_t   alloc;      /* buffers allocated for it              */
+	size_t   unused;     /* bytes of them that weren't needed     */
+	int      allocPhase;
+	size_t   faultStart; /* page faults when it began             */
+	size_t   faults;     /* page faults taken while decompressing */
+	size_t   compSz;     /* bytes it occupies in the rom          */
+	size_t   decSz;
+	unsigned vstart;
+	int      index;
+	int      codec;      /* Z64DEC_CODEC_AUTO if copied           */
+	int      done;       /* non-zero once it has been taken       */
+};
+
+struct stats
+{
+	double             begin;           /* when measuring began         */
+	double             phase[STATS_MAX];
+	double             crcStart;
+	size_t             crcFaults;       /* page faults when it began    */
+	size_t             alloc[STATS_MAX];   /* bytes allocated          */
+	size_t             unused[STATS_MAX];  /* of which weren't needed  */
+	size_t             rss[STATS_MAX];     /* peak rss once it ended   */
+	size_t             faults[STATS_MAX];  /* page faults taken        */
+	struct stats_file *file;            /* one per dma entry            */
+	int                files;
+};
+
+/* files are summed per codec; slot 0 holds those that were copied */
+#define CODEC_SLOTS   (Z64DEC_CODEC_MAX + 1)
+#define CODEC_SLOT(C) ((C) - Z64DEC_CODEC_AUTO)
+
+/* names of phases, as printed */
+static const char *phaseName[STATS_MAX] = {
+	[STATS_LOAD]   = "load",
+	[STATS_SEARCH] = "dmadata",
+	[STATS_ALLOC]  = "alloc",
+	[STATS_DECODE] = "decode",
+	[STATS_COPY]   = "copy",
+	[STATS_CRC]    = "n64crc",
+	[STATS_WRITE]  = "write",
+};
+
+/* seconds elapsed since some fixed point, from a monotonic clock */
+double stats_now(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER count, freq;
+
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+
+	return (double)count.QuadPart / freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* the largest resident set size the process has had */
+size_t stats_peak_rss(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+
+	return pmc.PeakWorkingSetSize;
+#else
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+
+ #ifdef __APPLE__
+	return ru.ru_maxrss;
+ #else
+	return (size_t)ru.ru_maxrss * 1024;
+ #endif
+#endif
+}
+
+/* page faults the calling thread has taken */
+size_t stats_page_faults(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+
+	return pmc.PageFaultCount;
+#else
+	struct rusage ru;
+
+ #ifdef RUSAGE_THREAD
+	if (getrusage(RUSAGE_THREAD, &ru))
+ #else
+	if (getrusage(RUSAGE_SELF, &ru))
+ #endif
+		return 0;
+
+	return ru.ru_minflt + ru.ru_majflt;
+#endif
+}
+
+/* page faults the calling thread had taken when its last phase ended;
+ * the faults of files and the crc are taken out as they are measured,
+ * so what remains belongs to the phase being measured by the caller */
+static THREADLOCAL size_t faultMark;
+
+/* name of a phase */
+const char *stats_phase_name(enum stats_phase phase)
+{
+	return phaseName[phase];
+}
+
+/* bytes dma entry `index` occupies in a rom of `romSz` bytes */
+size_t stats_rom_bytes(const z64dec_rom *rom, int index, size_t romSz)
+{
+	struct z64dec_info info;
+	struct z64dec_entry e;
+	size_t next = romSz;
+	int k;
+
+	if (z64dec_rom_entry(rom, index, &e))
+		return 0;
+
+	if (!e.compressed)
+		return e.vend - e.vstart;
+
+	if (e.pend)
+		return e.pend - e.pstart;
+
+	/* dmaext doesn't store compressed sizes, so those files are taken
+	 * to extend up to whichever one follows them in the rom */
+	z64dec_rom_info(rom, &info);
+	for (k = 0; k < info.entries; ++k)
+	{
+		struct z64dec_entry o;
+
+		if (!z64dec_rom_entry(rom, k, &o) && o.valid
+			&& o.pstart > e.pstart && o.pstart < next
+		)
+			next = o.pstart;
+	}
+
+	return next > e.pstart ? next - e.pstart : 0;
+}
+
+/* library events: each file is timed from the thread decompressing it,
+ * and only its own slot is written (see z64dec_rom_set_events()) */
+void stats_event(struct stats *stats, const struct z64dec_event *event)
+{
+	double now = stats_now();
+
+	if (!stats)
+		return;
+
+	switch (event->type)
+	{
+		case Z64DEC_EVENT_ENTRY_BEGIN:
+			stats->file[event->index].start = now;
+			stats->file[event->index].faultStart = stats_page_faults();
+			break;
+
+		case Z64DEC_EVENT_ENTRY_END:
+		{
+			struct stats_file *f = &stats->file[event->index];
+
+			f->faults = stats_page_faults() - f->faultStart;
+			faultMark += f->faults;
+			f->seconds = now - f->start;
+			f->codec = event->codec;
+			f->done = !event->error;
+			break;
+		}
+
+		case Z64DEC_EVENT_CRC_BEGIN:
+			stats->crcStart = now;
+			stats->crcFaults = stats_page_faults();
+			break;
+
+		case Z64DEC_EVENT_CRC_END:
+		{
+			size_t faults = stats_page_faults() - stats->crcFaults;
+
+			stats->phase[STATS_CRC] += now - stats->crcStart;
+			stats->faults[STATS_CRC] += faults;
+			faultMark += faults;
+			stats->rss[STATS_CRC] = stats_peak_rss();
+			break;
+		}
+	}
+}
+
+/* begin measuring */
+struct stats *stats_new(void)
+{
+	struct stats *stats = calloc_safe(1, sizeof(*stats));
+
+	stats->begin = stats_now();
+	faultMark = stats_page_faults();
+
+	return stats;
+}
+
+/* measure each file decompressed from `rom` */
+void stats_attach(struct stats *stats, const z64dec_rom *rom, size_t romSz)
+{
+	struct z64dec_info info;
+	int i;
+
+	if (!stats)
+		return;
+
+	z64dec_rom_info(rom, &info);
+	stats->files = info.entries;
+	stats->file = calloc_safe(info.entries + 1, sizeof(*stats->file));
+
+	for (i = 0; i < info.entries; ++i)
+	{
+		struct stats_file *f = &stats->file[i];
+		struct z64dec_entry e;
+
+		z64dec_rom_entry(rom, i, &e);
+		f->index = i;
+		f->vstart = e.vstart;
+		f->decSz = e.vend - e.vstart;
+		f->compSz = stats_rom_bytes(rom, i, romSz);
+	}
+}
+
+/* add time spent in a phase */
+void stats_add(struct stats *stats, enum stats_phase phase, double seconds)
+{
+	size_t faults;
+
+	if (!stats)
+		return;
+
+	faults = stats_page_faults();
+	stats->phase[phase] += seconds;
+	stats->faults[phase] += faults - faultMark;
+	stats->rss[phase] = stats_peak_rss();
+	faultMark = faults;
+}
+
+/* add time spent writing the file extracted from dma entry `index` */
+void stats_add_write(struct stats *stats, int index, double seconds)
+{
+	if (stats)
+		stats->file[index].write += seconds;
+}
+
+/* add a buffer allocated during a phase */
+void stats_add_alloc(struct stats *stats, enum stats_phase phase, int index, size_t capacity, size_t used)
+{
+	if (!stats)
+		return;
+
+	if (index >= 0)
+	{
+		struct stats_file *f = &stats->file[index];
+
+		f->alloc += capacity;
+		f->unused += capacity - used;
+		f->allocPhase = phase;
+		return;
+	}
+
+	stats->alloc[phase] += capacity;
+	stats->unused[phase] += capacity - used;
+}
+
+/* slowest files first */
+static int slowest(const void *a, const void *b)
+{
+	const struct stats_file *fa = a;
+	const struct stats_file *fb = b;
+
+	if (fa->seconds != fb->seconds)
+		return fa->seconds < fb->seconds ? 1 : -1;
+
+	return fa->index - fb->index;
+}
+
+static double mbps(size_t bytes, double seconds)
+{
+	return seconds > 0 ? bytes / (seconds * 1e6) : 0;
+}
+
+/* print the time spent in each phase and the slowest files */
+void stats_print(struct stats *stats, int top, const char *json)
+{
+	double codecTime[CODEC_SLOTS] = { 0 };
+	size_t codecComp[CODEC_SLOTS] = { 0 };
+	size_t codecDec[CODEC_SLOTS] = { 0 };
+	int codecFiles[CODEC_SLOTS] = { 0 };
+	double total;
+	FILE *fp = NULL;
+	int first = 1;
+	int i;
+
+	if (!stats)
+		return;
+	total = stats_now() - stats->begin;
+
+	/* sum up the files */
+	for (i = 0; i < stats->files; ++i)
+	{
+		const struct stats_file *f = &stats->file[i];
+
+		if (!f->done)
+			continue;
+
+		codecTime[CODEC_SLOT(f->codec)] += f->seconds;
+		codecComp[CODEC_SLOT(f->codec)] += f->compSz;
+		codecDec[CODEC_SLOT(f->codec)] += f->decSz;
+		codecFiles[CODEC_SLOT(f->codec)] += 1;
+		stats->phase[f->codec == Z64DEC_CODEC_AUTO ? STATS_COPY : STATS_DECODE] += f->seconds;
+		stats->faults[f->codec == Z64DEC_CODEC_AUTO ? STATS_COPY : STATS_DECODE] += f->faults;
+		stats->phase[STATS_WRITE] += f->write;
+		stats->alloc[f->allocPhase] += f->alloc;
+		stats->unused[f->allocPhase] += f->unused;
+	}
+
+	qsort(stats->file, stats->files, sizeof(*stats->file), slowest);
+	if (top > stats->files)
+		top = stats->files;
+	while (top > 0 && !stats->file[top - 1].done)
+		--top;
+
+	if (json && !(fp = wow_fopen(json, "w")))
+		die("failed to open '%s' for writing", json);
+
+	/* time per phase; several threads can be decompressing and writing
+	 * at once, so those phases may add up to more than the total */
+	fprintf(stderr, "\n%-10s %12s %7s\n", "phase", "time", "share");
+	if (fp)
+		fprintf(fp, "{\n  \"total_ms\": %.3f,\n  \"phases\": {", total * 1e3);
+	for (i = 0; i < STATS_MAX; ++i)
+	{
+		double t = stats->phase[i];
+
+		fprintf(stderr, "%-10s %9.3f ms %6.1f%%\n", phaseName[i], t * 1e3, total > 0 ? t * 100 / total : 0);
+		if (fp)
+			fprintf(fp, "%s\n    \"%s_ms\": %.3f", i ? "," : "", phaseName[i], t * 1e3);
+	}
+	fprintf(stderr, "%-10s %9.3f ms\n", "total", total * 1e3);
+	if (fp)
+		fprintf(fp, "\n  },\n  \"memory\": {\n    \"peak_rss\": %lu", (unsigned long)stats_peak_rss());
+
+	/* memory per phase; buffers allocated in a phase may be freed in
+	 * it, so these add up to more than the peak when extracting; page
+	 * faults are those of the thread that ran the phase, which is each
+	 * file's own thread for decoding and copying */
+	fprintf(stderr, "\n%-10s %14s %14s %14s %10s\n", "memory", "allocated", "unused", "peak rss", "faults");
+	for (i = 0; i < STATS_MAX; ++i)
+	{
+		char rss[32] = "-";
+
+		if (!stats->alloc[i] && !stats->rss[i] && !stats->faults[i])
+			continue;
+
+		if (stats->rss[i])
+			sprintf(rss, "%lu", (unsigned long)stats->rss[i]);
+		fprintf(stderr, "%-10s %14lu %14lu %14s %10lu\n"
+			, phaseName[i], (unsigned long)stats->alloc[i], (unsigned long)stats->unused[i], rss
+			, (unsigned long)stats->faults[i]
+		);
+		if (fp)
+			fprintf(fp, ",\n    \"%s\": {\"allocated\": %lu, \"unused\": %lu, \"peak_rss\": %lu, \"faults\": %lu}"
+				, phaseName[i], (unsigned long)stats->alloc[i], (unsigned long)stats->unused[i]
+				, (unsigned long)stats->rss[i], (unsigned long)stats->faults[i]
+			);
+	}
+	fprintf(stderr, "%-10s %14s %14s %14lu\n", "total", "", "", (unsigned long)stats_peak_rss());
+	if (fp)
+		fprintf(fp, "\n  },\n  \"codecs\": [");
+
+	/* decoding, per codec */
+	fprintf(stderr, "\n%-10s %6s %12s %12s %12s %10s\n", "codec", "files", "compressed", "decompressed", "time", "MB/s");
+	for (i = 0; i < CODEC_SLOTS; ++i)
+	{
+		const char *name = i ? z64dec_codec_name(i + Z64DEC_CODEC_AUTO) : "copy";
+
+		if (!codecFiles[i])
+			continue;
+
+		fprintf(stderr, "%-10s %6d %12lu %12lu %9.3f ms %10.2f\n"
+			, name, codecFiles[i], (unsigned long)codecComp[i], (unsigned long)codecDec[i]
+			, codecTime[i] * 1e3, mbps(codecDec[i], codecTime[i])
+		);
+		if (fp)
+			fprintf(fp, "%s\n    {\"codec\": \"%s\", \"files\": %d, \"compressed\": %lu"
+				", \"decompressed\": %lu, \"ms\": %.3f, \"mbps\": %.3f}"
+				, first ? "" : ","
+				, name, codecFiles[i], (unsigned long)codecComp[i], (unsigned long)codecDec[i]
+				, codecTime[i] * 1e3, mbps(codecDec[i], codecTime[i])
+			);
+		first = 0;
+	}
+	if (fp)
+		fprintf(fp, "\n  ],\n  \"slowest\": [");
+
+	/* the slowest files */
+	if (top)
+		fprintf(stderr, "\n%-6s %-10s %-6s %12s %12s %9s %10s\n", "index", "vstart", "codec", "compressed", "decompressed", "time", "MB/s");
+	for (i = 0; i < top; ++i)
+	{
+		const struct stats_file *f = &stats->file[i];
+		const char *name = f->codec == Z64DEC_CODEC_AUTO ? "copy" : z64dec_codec_name(f->codec);
+
+		fprintf(stderr, "%-6d 0x%08X %-6s %12lu %12lu %6.3f ms %10.2f\n"
+			, f->index, f->vstart, name, (unsigned long)f->compSz, (unsigned long)f->decSz
+			, f->seconds * 1e3, mbps(f->decSz, f->seconds)
+		);
+		if (fp)
+			fprintf(fp, "%s\n    {\"index\": %d, \"vstart\": %u, \"codec\": \"%s\""
+				", \"compressed\": %lu, \"decompressed\": %lu, \"ms\": %.3f, \"mbps\": %.3f}"
+				, i ? "," : ""
+				, f->index, f->vstart, name, (unsigned long)f->compSz, (unsigned long)f->decSz
+				, f->seconds * 1e3, mbps(f->decSz, f->seconds)
+			);
+	}
+
+	if (fp)
+	{
+		fprintf(fp, "\n  ]\n}\n");
+		fclose(fp);
+	}
+}
+
+/* stop measuring */
+void stats_free(struct stats *stats)
+{
+	if (!stats)
+		return;
+
+	free(stats->file);
+	free(stats);
+}
@@ -0,0 +1,75 @@
+#ifndef Z64DECOMPRESS_STATS_H_INCLUDED
+#define Z64DECOMPRESS_STATS_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+#include "z64decompress.h"
+
+/* phases of decompressing a rom; decoding and copying files and the crc
+ * are measured by the library's events, and the rest by the caller */
+enum stats_phase
+{
+	STATS_LOAD,      /* reading the rom into memory            */
+	STATS_SEARCH,    /* locating and parsing dmadata           */
+	STATS_ALLOC,     /* allocating the decompressed rom        */
+	STATS_DECODE,    /* decompressing compressed files         */
+	STATS_COPY,      /* copying uncompressed files             */
+	STATS_CRC,       /* n64crc()                               */
+	STATS_WRITE,     /* writing the output                     */
+	STATS_MAX
+};
+
+/* the functions below do nothing when given a NULL stats, so callers
+ * needn't check whether statistics were requested */
+struct stats;
+
+/* seconds elapsed since some fixed point, from a monotonic clock */
+double stats_now(void);
+
+/* begin measuring; the total runs from here to stats_print() */
+struct stats *stats_new(void);
+
+/* measure each file decompressed from `rom`, whose compressed size
+ * is `romSz`; this can be done once the rom has been opened, and the
+ * rom's events must then be passed to stats_event() */
+void stats_attach(struct stats *stats, const z64dec_rom *rom, size_t romSz);
+
+/* handle an event reported by z64dec_rom_set_events() */
+void stats_event(struct stats *stats, const struct z64dec_event *event);
+
+/* add time spent in a phase */
+void stats_add(struct stats *stats, enum stats_phase phase, double seconds);
+
+/* add time spent writing the file extracted from dma entry `index`;
+ * threads may do so at once for different entries */
+void stats_add_write(struct stats *stats, int index, double seconds);
+
+/* add a buffer of `capacity` bytes allocated during a phase, of which
+ * only `used` bytes were needed; `index` is the dma entry it holds, or
+ * -1, and as with stats_add_write() threads may do so at once for
+ * different entries, but only one thread for -1 */
+void stats_add_alloc(struct stats *stats, enum stats_phase phase, int index, size_t capacity, size_t used);
+
+/* the largest resident set size the process has had, in bytes, or 0
+ * if it can't be had */
+size_t stats_peak_rss(void);
+
+/* page faults the calling thread has taken, or the whole process where
+ * they can't be had per thread, or 0 if they can't be had at all; the
+ * phases and files are charged with the faults taken while they ran */
+size_t stats_page_faults(void);
+
+/* print the time and memory spent in each phase and the `top` slowest
+ * files on stderr, and as json to `json` if it isn't NULL */
+void stats_print(struct stats *stats, int top, const char *json);
+
+/* stop measuring */
+void stats_free(struct stats *stats);
+
+/* name of a phase */
+const char *stats_phase_name(enum stats_phase phase);
+
+/* bytes dma entry `index` occupies in a rom of `romSz` bytes */
+size_t stats_rom_bytes(const z64dec_rom *rom, int index, size_t romSz);
+
+#endif /* Z64DECOMPRESS_STATS_H_INCLUDED */
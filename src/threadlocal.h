@@ -0,0 +1,11 @@
+#ifndef Z64DECOMPRESS_THREADLOCAL_H_INCLUDED
+#define Z64DECOMPRESS_THREADLOCAL_H_INCLUDED
+
+/* storage that each thread has its own copy of */
+#ifdef _MSC_VER
+ #define THREADLOCAL __declspec(thread)
+#else
+ #define THREADLOCAL _Thread_local
+#endif
+
+#endif /* Z64DECOMPRESS_THREADLOCAL_H_INCLUDED */
@@ -0,0 +1,236 @@
+/*
+ * tokens.c <z64.me>
+ *
+ * histograms of the literals and back references in a rom's compressed
+ * files, to see which fast paths a decoder would benefit from
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tokens.h"
+#include "pool.h"
+#include "wow.h"
+
+/* state shared by the threads profiling files */
+struct tokensJob
+{
+	const z64dec_rom      *rom;
+	const int             *which;    /* dma index of each file       */
+	struct z64dec_profile *profile;  /* tokens of each file          */
+	int                   *codec;    /* codec used by each file      */
+	int                   *error;    /* Z64DEC_OK, or why it failed  */
+};
+
+static void profileEntry(void *udata, int n)
+{
+	struct tokensJob *job = udata;
+
+	job->error[n] = z64dec_rom_profile(job->rom, job->which[n], &job->profile[n], &job->codec[n]);
+}
+
+/* add one profile to another */
+static void add(struct z64dec_profile *dst, const struct z64dec_profile *src)
+{
+	int i;
+
+	dst->files += src->files;
+	dst->literals += src->literals;
+	dst->matches += src->matches;
+	dst->matchBytes += src->matchBytes;
+	dst->storedBytes += src->storedBytes;
+
+	for (i = 0; i < Z64DEC_PROFILE_BUCKETS; ++i)
+	{
+		dst->literalRuns[i] += src->literalRuns[i];
+		dst->matchLengths[i] += src->matchLengths[i];
+		dst->matchDistances[i] += src->matchDistances[i];
+	}
+
+	for (i = 0; i < 3; ++i)
+		dst->blocks[i] += src->blocks[i];
+
+	for (i = 0; i < 16; ++i)
+	{
+		dst->literalCodes[i] += src->literalCodes[i];
+		dst->distanceCodes[i] += src->distanceCodes[i];
+	}
+}
+
+/* share of a total, as a percentage */
+static double pct(unsigned long n, unsigned long total)
+{
+	return total ? n * 100.0 / total : 0;
+}
+
+static unsigned long sum(const unsigned long *v, int n)
+{
+	unsigned long total = 0;
+
+	while (n--)
+		total += v[n];
+
+	return total;
+}
+
+/* print the histograms of a codec */
+static void print(const char *name, const struct z64dec_profile *p)
+{
+	unsigned long runs = sum(p->literalRuns, Z64DEC_PROFILE_BUCKETS);
+	int last = 0;
+	int i;
+
+	fprintf(stderr, "\n%s: %lu files, %lu literals, %lu back references copying %lu bytes (%.2f average)\n"
+		, name, p->files, p->literals, p->matches, p->matchBytes
+		, p->matches ? (double)p->matchBytes / p->matches : 0
+	);
+
+	for (i = 0; i < Z64DEC_PROFILE_BUCKETS; ++i)
+		if (p->literalRuns[i] || p->matchLengths[i] || p->matchDistances[i])
+			last = i;
+
+	fprintf(stderr, "%-16s %18s %18s %18s\n", "value", "literal runs", "match lengths", "match distances");
+	for (i = 0; i <= last; ++i)
+	{
+		char range[32];
+
+		if (i == 0)
+			strcpy(range, "1");
+		else if (i == Z64DEC_PROFILE_BUCKETS - 1)
+			sprintf(range, "%lu+", 1UL << i);
+		else
+			sprintf(range, "%lu-%lu", 1UL << i, (2UL << i) - 1);
+
+		fprintf(stderr, "%-16s %10lu %6.2f%% %10lu %6.2f%% %10lu %6.2f%%\n", range
+			, p->literalRuns[i], pct(p->literalRuns[i], runs)
+			, p->matchLengths[i], pct(p->matchLengths[i], p->matches)
+			, p->matchDistances[i], pct(p->matchDistances[i], p->matches)
+		);
+	}
+
+	/* zlib */
+	if (!sum(p->blocks, 3))
+		return;
+
+	fprintf(stderr, "blocks: %lu stored (%lu bytes), %lu fixed, %lu dynamic\n"
+		, p->blocks[0], p->storedBytes, p->blocks[1], p->blocks[2]
+	);
+	if (!p->blocks[2])
+		return;
+
+	fprintf(stderr, "%-16s %18s %18s\n", "code length", "literal/length", "distance");
+	for (i = 1; i < 16; ++i)
+		fprintf(stderr, "%-16d %10lu %6.2f%% %10lu %6.2f%%\n", i
+			, p->literalCodes[i], pct(p->literalCodes[i], sum(p->literalCodes + 1, 15))
+			, p->distanceCodes[i], pct(p->distanceCodes[i], sum(p->distanceCodes + 1, 15))
+		);
+}
+
+static void json_array(FILE *fp, const char *name, const unsigned long *v, int n)
+{
+	int i;
+
+	fprintf(fp, ", \"%s\": [", name);
+	for (i = 0; i < n; ++i)
+		fprintf(fp, "%s%lu", i ? ", " : "", v[i]);
+	fprintf(fp, "]");
+}
+
+/* write the fields of a profile as json */
+static void json_profile(FILE *fp, const struct z64dec_profile *p)
+{
+	fprintf(fp, "\"files\": %lu, \"literals\": %lu, \"matches\": %lu, \"match_bytes\": %lu"
+		, p->files, p->literals, p->matches, p->matchBytes
+	);
+	json_array(fp, "literal_runs", p->literalRuns, Z64DEC_PROFILE_BUCKETS);
+	json_array(fp, "match_lengths", p->matchLengths, Z64DEC_PROFILE_BUCKETS);
+	json_array(fp, "match_distances", p->matchDistances, Z64DEC_PROFILE_BUCKETS);
+
+	if (sum(p->blocks, 3))
+	{
+		json_array(fp, "blocks", p->blocks, 3);
+		fprintf(fp, ", \"stored_bytes\": %lu", p->storedBytes);
+		json_array(fp, "literal_codes", p->literalCodes, 16);
+		json_array(fp, "distance_codes", p->distanceCodes, 16);
+	}
+}
+
+/* tally the tokens of the files at the given dma indices */
+void tokens_profile(const z64dec_rom *rom, const int *which, int count, struct pool *pool, const char *json)
+{
+	struct z64dec_profile codec[Z64DEC_CODEC_MAX] = { { 0 } };
+	struct tokensJob job;
+	FILE *fp = NULL;
+	int first = 1;
+	int i;
+
+	job.rom = rom;
+	job.which = which;
+	job.profile = calloc_safe(count + 1, sizeof(*job.profile));
+	job.codec = calloc_safe(count + 1, sizeof(*job.codec));
+	job.error = calloc_safe(count + 1, sizeof(*job.error));
+	pool_for(pool, count, profileEntry, &job);
+
+	if (json && !(fp = wow_fopen(json, "w")))
+		die("failed to open '%s' for writing", json);
+	if (fp)
+		fprintf(fp, "{\n  \"files\": [");
+
+	for (i = 0; i < count; ++i)
+	{
+		struct z64dec_entry e;
+
+		if (job.error[i])
+		{
+			fprintf(stderr, "WARNING: dma entry %d: %s\n", which[i], z64dec_strerror(job.error[i]));
+			continue;
+		}
+
+		/* uncompressed */
+		if (job.codec[i] == Z64DEC_CODEC_AUTO)
+			continue;
+
+		add(&codec[job.codec[i]], &job.profile[i]);
+
+		if (!fp)
+			continue;
+		z64dec_rom_entry(rom, which[i], &e);
+		fprintf(fp, "%s\n    {\"index\": %d, \"vstart\": %u, \"codec\": \"%s\", "
+			, first ? "" : ",", which[i], e.vstart, z64dec_codec_name(job.codec[i])
+		);
+		json_profile(fp, &job.profile[i]);
+		fprintf(fp, "}");
+		first = 0;
+	}
+
+	if (fp)
+		fprintf(fp, "\n  ],\n  \"codecs\": [");
+
+	first = 1;
+	for (i = 0; i < Z64DEC_CODEC_MAX; ++i)
+	{
+		if (!codec[i].files)
+			continue;
+
+		print(z64dec_codec_name(i), &codec[i]);
+
+		if (!fp)
+			continue;
+		fprintf(fp, "%s\n    {\"codec\": \"%s\", ", first ? "" : ",", z64dec_codec_name(i));
+		json_profile(fp, &codec[i]);
+		fprintf(fp, "}");
+		first = 0;
+	}
+
+	if (fp)
+	{
+		fprintf(fp, "\n  ]\n}\n");
+		fclose(fp);
+	}
+
+	free(job.profile);
+	free(job.codec);
+	free(job.error);
+}
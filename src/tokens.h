@@ -0,0 +1,13 @@
+#ifndef Z64DECOMPRESS_TOKENS_H_INCLUDED
+#define Z64DECOMPRESS_TOKENS_H_INCLUDED
+
+#include "z64decompress.h"
+
+struct pool;
+
+/* tally the tokens of the files at the given dma indices, across the
+ * threads in `pool`, and print histograms of them per codec on stderr;
+ * if `json` isn't NULL, also write them per codec and per file to it */
+void tokens_profile(const z64dec_rom *rom, const int *which, int count, struct pool *pool, const char *json);
+
+#endif /* Z64DECOMPRESS_TOKENS_H_INCLUDED */
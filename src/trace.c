@@ -0,0 +1,235 @@
+/*
+ * trace.c <z64.me>
+ *
+ * recording a timeline of decompressing a rom in the Chrome Trace Event
+ * format, to see idle workers, stragglers, and i/o stalls
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "trace.h"
+#include "stats.h"
+#include "wow.h"
+#include "threadlocal.h"
+
+/* something that took time, on one thread */
+struct span
+{
+	const char    *name;
+	const char    *cat;        /* "phase", "entry", or "io"         */
+	double         start;      /* seconds, relative to trace begin  */
+	double         seconds;
+	int            thread;
+	int            index;      /* dma entry, or -1                  */
+	int            codec;      /* entries: codec used               */
+	int            error;      /* entries: Z64DEC_OK or an error    */
+};
+
+/* a dma entry */
+struct file
+{
+	double         start;      /* when it began decompressing       */
+	size_t         compSz;     /* bytes it occupies in the rom      */
+	size_t         decSz;
+	unsigned       vstart;
+};
+
+struct trace
+{
+	pthread_mutex_t lock;
+	double          begin;     /* when recording began              */
+	struct span    *span;
+	int             spans;
+	int             cap;
+	int             threads;   /* threads that have recorded spans  */
+	struct file    *file;      /* one per dma entry                 */
+	int             files;
+	double          crcStart;
+};
+
+/* each thread is numbered as it records its first span */
+static THREADLOCAL int threadNum;
+
+static int thread_num(struct trace *trace)
+{
+	if (!threadNum)
+		threadNum = ++trace->threads;
+
+	return threadNum;
+}
+
+/* record a span; `start` and `end` are stats_now() times */
+static void record(struct trace *trace, const char *name, const char *cat, double start, double end, int index, int codec, int error)
+{
+	struct span *s;
+
+	pthread_mutex_lock(&trace->lock);
+
+	if (trace->spans == trace->cap)
+	{
+		trace->cap = trace->cap ? trace->cap * 2 : 1024;
+		trace->span = realloc(trace->span, trace->cap * sizeof(*trace->span));
+		if (!trace->span)
+			die("memory error");
+	}
+
+	s = &trace->span[trace->spans++];
+	s->name = name;
+	s->cat = cat;
+	s->start = start - trace->begin;
+	s->seconds = end - start;
+	s->thread = thread_num(trace);
+	s->index = index;
+	s->codec = codec;
+	s->error = error;
+
+	pthread_mutex_unlock(&trace->lock);
+}
+
+/* begin recording */
+struct trace *trace_new(void)
+{
+	struct trace *trace = calloc_safe(1, sizeof(*trace));
+
+	pthread_mutex_init(&trace->lock, NULL);
+	trace->begin = stats_now();
+
+	return trace;
+}
+
+/* describe the files of `rom` */
+void trace_attach(struct trace *trace, const z64dec_rom *rom, size_t romSz)
+{
+	struct z64dec_info info;
+	int i;
+
+	if (!trace)
+		return;
+
+	z64dec_rom_info(rom, &info);
+	trace->files = info.entries;
+	trace->file = calloc_safe(info.entries + 1, sizeof(*trace->file));
+
+	for (i = 0; i < info.entries; ++i)
+	{
+		struct file *f = &trace->file[i];
+		struct z64dec_entry e;
+
+		z64dec_rom_entry(rom, i, &e);
+		f->vstart = e.vstart;
+		f->decSz = e.vend - e.vstart;
+		f->compSz = stats_rom_bytes(rom, i, romSz);
+	}
+}
+
+/* handle an event reported by z64dec_rom_set_events(); the span list
+ * is shared between files, so recording takes the lock */
+void trace_event(struct trace *trace, const struct z64dec_event *event)
+{
+	double now = stats_now();
+
+	if (!trace)
+		return;
+
+	switch (event->type)
+	{
+		case Z64DEC_EVENT_ENTRY_BEGIN:
+			trace->file[event->index].start = now;
+			break;
+
+		case Z64DEC_EVENT_ENTRY_END:
+			record(trace
+				, event->codec == Z64DEC_CODEC_AUTO ? "copy" : "decode", "entry"
+				, trace->file[event->index].start, now
+				, event->index, event->codec, event->error
+			);
+			break;
+
+		case Z64DEC_EVENT_CRC_BEGIN:
+			trace->crcStart = now;
+			break;
+
+		case Z64DEC_EVENT_CRC_END:
+			record(trace, "n64crc", "phase", trace->crcStart, now, -1, Z64DEC_CODEC_AUTO, Z64DEC_OK);
+			break;
+	}
+}
+
+/* record that the calling thread spent from `start` until now on `name` */
+void trace_span(struct trace *trace, const char *name, double start, int index)
+{
+	if (trace)
+		record(trace, name, index < 0 ? "phase" : "io", start, stats_now(), index, Z64DEC_CODEC_AUTO, Z64DEC_OK);
+}
+
+/* write the timeline in the Chrome Trace Event format; every span is a
+ * complete ("X") event, with timestamps in microseconds */
+void trace_write(struct trace *trace, const char *fn)
+{
+	FILE *fp;
+	int i;
+
+	if (!trace)
+		return;
+
+	if (!(fp = wow_fopen(fn, "w")))
+		die("failed to open '%s' for writing", fn);
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	fprintf(fp, "  {\"ph\": \"M\", \"name\": \"process_name\", \"pid\": 1, \"tid\": 0"
+		", \"args\": {\"name\": \"z64decompress\"}}"
+	);
+	for (i = 1; i <= trace->threads; ++i)
+		fprintf(fp, ",\n  {\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %d"
+			", \"args\": {\"name\": \"thread %d\"}}", i, i
+		);
+
+	for (i = 0; i < trace->spans; ++i)
+	{
+		const struct span *s = &trace->span[i];
+
+		fprintf(fp, ",\n  {\"ph\": \"X\", \"name\": \"%s\", \"cat\": \"%s\", \"pid\": 1, \"tid\": %d"
+			", \"ts\": %.3f, \"dur\": %.3f"
+			, s->name, s->cat, s->thread
+			, s->start * 1e6, s->seconds * 1e6
+		);
+
+		if (s->index >= 0 && s->index < trace->files)
+		{
+			const struct file *f = &trace->file[s->index];
+
+			fprintf(fp, ", \"args\": {\"index\": %d, \"vstart\": \"0x%08X\", \"decompressed\": %lu"
+				, s->index, f->vstart, (unsigned long)f->decSz
+			);
+			if (!strcmp(s->cat, "entry"))
+				fprintf(fp, ", \"codec\": \"%s\", \"compressed\": %lu"
+					, s->codec == Z64DEC_CODEC_AUTO ? "none" : z64dec_codec_name(s->codec)
+					, (unsigned long)f->compSz
+				);
+			if (s->error)
+				fprintf(fp, ", \"error\": \"%s\"", z64dec_strerror(s->error));
+			fprintf(fp, "}");
+		}
+
+		fprintf(fp, "}");
+	}
+
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+}
+
+/* stop recording */
+void trace_free(struct trace *trace)
+{
+	if (!trace)
+		return;
+
+	pthread_mutex_destroy(&trace->lock);
+	free(trace->span);
+	free(trace->file);
+	free(trace);
+}
@@ -0,0 +1,33 @@
+#ifndef Z64DECOMPRESS_TRACE_H_INCLUDED
+#define Z64DECOMPRESS_TRACE_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+#include "z64decompress.h"
+
+/* a timeline of decompressing a rom, for viewing in Perfetto or
+ * chrome://tracing; every function may be called from several threads
+ * at once, and does nothing when given a NULL trace */
+struct trace;
+
+/* begin recording; timestamps are relative to this */
+struct trace *trace_new(void);
+
+/* describe the files of `rom`, whose compressed size is `romSz`; the
+ * rom's events must then be passed to trace_event() */
+void trace_attach(struct trace *trace, const z64dec_rom *rom, size_t romSz);
+
+/* handle an event reported by z64dec_rom_set_events() */
+void trace_event(struct trace *trace, const struct z64dec_event *event);
+
+/* record that the calling thread spent from `start` (a stats_now() time)
+ * until now on `name`; `index` is the dma entry involved, or -1 */
+void trace_span(struct trace *trace, const char *name, double start, int index);
+
+/* write the timeline in the Chrome Trace Event format */
+void trace_write(struct trace *trace, const char *fn);
+
+/* stop recording */
+void trace_free(struct trace *trace);
+
+#endif /* Z64DECOMPRESS_TRACE_H_INCLUDED */
@@ -0,0 +1,890 @@
+/*
+ * z64decompress.c <z64.me>
+ *
+ * libz64decompress: decompress zelda 64 roms and files in memory, or
+ * read piece by piece through a callback
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "z64decompress.h"
+#include "codec.h"
+#include "dma.h"
+#include "n64crc.h"
+#include "probes.h"
+#include "decoder/reader.h"
+#include "decoder/stream.h"
+
+struct z64dec_rom
+{
+	struct dmaTable      table;
+	struct decreader     reader;    /* compressed rom                */
+	Codec                codec;     /* codec used on compressed files *
+	                                 * (CODEC_NONE = autodetect)      */
+	Codec                lastCodec; /* last codec used by rom_decode */
+	z64dec_event_func    events;    /* called around each step       */
+	void                *eventsUdata;
+};
+
+struct z64dec_stream
+{
+	struct decstream     dec;
+	Codec                codec;     /* CODEC_NONE until header is read */
+	int                  headerless;
+	int                  started;   /* non-zero once header is read    */
+	int                  done;      /* non-zero once stream has ended  */
+	unsigned char        header[16];
+	unsigned             headerSz;  /* bytes of header received        */
+};
+
+/* describe an error code */
+const char *z64dec_strerror(int error)
+{
+	static const char *str[Z64DEC_ERR_MAX] = {
+		[Z64DEC_OK]            = "success",
+		[Z64DEC_ERR_ARG]       = "invalid argument",
+		[Z64DEC_ERR_NOMEM]     = "memory error",
+		[Z64DEC_ERR_NODMA]     = "failed to locate dmadata in rom",
+		[Z64DEC_ERR_CODEC]     = "compressed file, unknown encoding",
+		[Z64DEC_ERR_NEEDCODEC] = "dmaext requires a codec to be provided",
+		[Z64DEC_ERR_ENTRY]     = "invalid dma entry",
+		[Z64DEC_ERR_RANGE]     = "file lies outside of the rom",
+		[Z64DEC_ERR_SPACE]     = "destination buffer is too small",
+		[Z64DEC_ERR_DATA]      = "corrupt compressed data",
+		[Z64DEC_ERR_READ]      = "failed to read compressed data",
+	};
+
+	if (error == Z64DEC_MORE)
+		return "stream not finished";
+
+	if (error < 0 || error >= Z64DEC_ERR_MAX)
+		return "unknown error";
+
+	return str[error];
+}
+
+/* get codec by name; returns Z64DEC_CODEC_AUTO if the name is unknown */
+int z64dec_codec_from_name(const char *name)
+{
+	if (!name)
+		return Z64DEC_CODEC_AUTO;
+
+	return get_codec_type_from_name(name);
+}
+
+/* get the name of a codec */
+const char *z64dec_codec_name(int codec)
+{
+	if (codec < 0 || codec >= CODEC_MAX)
+		return "none";
+
+	return decCodecInfo[codec].name;
+}
+
+/* set up a decoder reader from a public one (returns Z64DEC_ERR_*) */
+static int reader_init(struct decreader *dec, const struct z64dec_reader *reader)
+{
+	if (!reader || !reader->read)
+		return Z64DEC_ERR_ARG;
+
+	memset(dec, 0, sizeof(*dec));
+	dec->read = reader->read;
+	dec->udata = reader->udata;
+	dec->size = reader->size;
+
+	/* dma_decode() allocates buffers of other sizes when needed */
+	if (reader->bufSz && reader->bufSz != DECREADER_BUF_DEFAULT)
+	{
+		dec->buf_size = reader->bufSz & ~7u;
+		if (dec->buf_size < DECREADER_BUF_MIN)
+			dec->buf_size = DECREADER_BUF_MIN;
+	}
+
+	return Z64DEC_OK;
+}
+
+/* decompress a single compressed file; *decSz receives its size */
+int z64dec_file(const void *src, size_t srcSz, void *dst, size_t dstSz, size_t *decSz, int codec)
+{
+	const struct z64dec_reader reader = { decreader_memory, (void*)src, srcSz, 0 };
+
+	if (!src)
+		return Z64DEC_ERR_ARG;
+
+	return z64dec_file_read(&reader, dst, dstSz, decSz, codec);
+}
+
+/* get the decompressed size of a single compressed file */
+int z64dec_file_size(const void *src, size_t srcSz, size_t *decSz)
+{
+	if (!src || !decSz)
+		return Z64DEC_ERR_ARG;
+
+	*decSz = 0;
+
+	if (srcSz < 8)
+		return Z64DEC_ERR_ARG;
+
+	if (get_codec_type_from_header(src) == CODEC_NONE)
+		return Z64DEC_ERR_CODEC;
+
+	*decSz = beU32((const unsigned char*)src + 4);
+
+	return Z64DEC_OK;
+}
+
+/* decompress a single compressed file read through `reader` */
+int z64dec_file_read(const struct z64dec_reader *reader, void *dst, size_t dstSz, size_t *decSz, int codec)
+{
+	struct decreader src;
+	unsigned char header[16];
+	Codec use;
+	int err;
+
+	if (!dst || !decSz || codec < CODEC_NONE || codec >= CODEC_MAX)
+		return Z64DEC_ERR_ARG;
+
+	*decSz = 0;
+
+	if ((err = reader_init(&src, reader)))
+		return err;
+
+	if (src.size < 8)
+		return Z64DEC_ERR_ARG;
+
+	if (decreader_fill(&src, 0, header, sizeof(header)))
+		return Z64DEC_ERR_READ;
+
+	use = pick_codec(header, codec);
+	if (use == CODEC_NONE)
+		return Z64DEC_ERR_CODEC;
+
+	/* decompressed size in header must fit, whether or not its magic was
+	 * recognized; the decoder stops at dstSz regardless, but a file that
+	 * says it's too large is reported as such */
+	if (beU32(header + 4) > dstSz)
+		return Z64DEC_ERR_SPACE;
+
+	if (src.buf_size && !(src.buf = malloc(src.buf_size)))
+		return Z64DEC_ERR_NOMEM;
+
+	src.dst_size = dstSz;
+	err = codec_decode(use, &src, dst, decSz);
+
+	free(src.buf);
+
+	/* zlib stops writing at dstSz, but counts what didn't fit */
+	if (!err && *decSz > dstSz)
+		err = Z64DEC_ERR_SPACE;
+	if (err)
+		*decSz = 0;
+
+	return err;
+}
+
+/* locate dmadata in a rom */
+int z64dec_rom_open(z64dec_rom **rom, const void *data, size_t size, const struct z64dec_options *options)
+{
+	const struct z64dec_reader reader = { decreader_memory, (void*)data, size, 0 };
+
+	if (rom)
+		*rom = NULL;
+
+	if (!data)
+		return Z64DEC_ERR_ARG;
+
+	return z64dec_rom_open_reader(rom, &reader, options);
+}
+
+/* locate dmadata in a rom read through `reader` */
+int z64dec_rom_open_reader(z64dec_rom **rom, const struct z64dec_reader *reader, const struct z64dec_options *options)
+{
+	static const struct z64dec_options defaults = { .codec = Z64DEC_CODEC_AUTO };
+	struct decreader src;
+	z64dec_rom *r;
+	int err;
+
+	if (!rom)
+		return Z64DEC_ERR_ARG;
+
+	*rom = NULL;
+
+	if ((err = reader_init(&src, reader)))
+		return err;
+
+	if (!options)
+		options = &defaults;
+
+	if (options->codec < CODEC_NONE || options->codec >= CODEC_MAX)
+		return Z64DEC_ERR_ARG;
+
+	/* with dmaext the autodetection will fail */
+	if (options->dmaext && options->codec == CODEC_NONE)
+		return Z64DEC_ERR_NEEDCODEC;
+
+	if (!(r = calloc(1, sizeof(*r))))
+		return Z64DEC_ERR_NOMEM;
+
+	r->reader = src;
+	r->codec = options->codec;
+	r->lastCodec = CODEC_NONE;
+
+	/* find dmadata in rom */
+	if (options->dmaext)
+		err = dma_find_ext(&r->table, &r->reader);
+	else
+		err = dma_find(&r->table, &r->reader);
+
+	if (err)
+	{
+		z64dec_rom_close(r);
+		return err;
+	}
+
+	/* iQue's default compression is zlib, and its files are headerless */
+	if (r->table.iQue && r->codec == CODEC_NONE)
+		r->codec = CODEC_ZLIB;
+	r->table.headerless |= options->headerless;
+	PROBE2(dmadata__found, r->table.start, r->table.num);
+
+	*rom = r;
+
+	return Z64DEC_OK;
+}
+
+/* free an opened rom */
+void z64dec_rom_close(z64dec_rom *rom)
+{
+	if (!rom)
+		return;
+
+	dma_free(&rom->table);
+	free(rom);
+}
+
+/* get information about an opened rom */
+void z64dec_rom_info(const z64dec_rom *rom, struct z64dec_info *info)
+{
+	info->size = rom->table.decSz;
+	info->dmadata = rom->table.start;
+	info->entries = rom->table.num;
+	info->iQue = rom->table.iQue;
+	info->headerless = rom->table.headerless;
+	info->codec = rom->lastCodec;
+}
+
+/* get dma entry `index` */
+int z64dec_rom_entry(const z64dec_rom *rom, int index, struct z64dec_entry *entry)
+{
+	const struct dmaEntry *e;
+
+	if (index < 0 || index >= rom->table.num)
+		return Z64DEC_ERR_ENTRY;
+
+	e = &rom->table.entry[index];
+	entry->vstart = e->Vstart;
+	entry->vend = e->Vend;
+	entry->pstart = e->Pstart;
+	entry->pend = e->Pend;
+	entry->compressed = e->compressed;
+	entry->valid = e->valid;
+
+	return Z64DEC_OK;
+}
+
+/* find the valid dma entry containing a virtual address */
+int z64dec_rom_lookup(const z64dec_rom *rom, unsigned vaddr)
+{
+	return dma_lookup(&rom->table, vaddr);
+}
+
+/* report a step to the rom's event handler, if it has one */
+static void emit(const z64dec_rom *rom, int type, int index, Codec codec, int error, size_t size)
+{
+	struct z64dec_event event = { type, index, codec, error, size };
+
+	rom->events(rom->eventsUdata, &event);
+}
+
+/* decompress one dma entry read through `reader`, reporting it as an event */
+static int decode_entry(const z64dec_rom *rom, const struct decreader *reader, int index, unsigned char *dst, size_t dstSz, Codec *codec)
+{
+	const struct dmaEntry *e = &rom->table.entry[index];
+	int err;
+
+	PROBE4(entry__start, index, e->Vstart, e->Vend - e->Vstart, e->Pend ? e->Pend - e->Pstart : 0);
+	if (rom->events)
+		emit(rom, Z64DEC_EVENT_ENTRY_BEGIN, index, CODEC_NONE, Z64DEC_OK, 0);
+
+	err = dma_decode(&rom->table, index, reader, dst, dstSz, rom->codec, codec);
+
+	if (rom->events)
+		emit(rom, Z64DEC_EVENT_ENTRY_END, index, *codec, err, e->Vend - e->Vstart);
+	PROBE4(entry__done, index, *codec, e->Vend - e->Vstart, err);
+
+	return err;
+}
+
+/* decompress dma entry `index` into dst */
+int z64dec_rom_decode_entry(const z64dec_rom *rom, int index, void *dst, size_t dstSz, int *codec)
+{
+	Codec used = CODEC_NONE;
+	int err;
+
+	if (!dst)
+		return Z64DEC_ERR_ARG;
+
+	if (index < 0 || index >= rom->table.num)
+		err = Z64DEC_ERR_ENTRY;
+	else
+		err = decode_entry(rom, &rom->reader, index, dst, dstSz, &used);
+
+	if (codec)
+		*codec = used;
+
+	return err;
+}
+
+/* decompress an entire rom into dst */
+int z64dec_rom_decode(z64dec_rom *rom, void *dst, size_t dstSz)
+{
+	const struct dmaTable *table = &rom->table;
+	unsigned char *dec = dst;
+	size_t dmaStart = table->start;
+	size_t dmaSz = table->end - table->start;
+	int i;
+
+	if (!dst || dstSz < dmaStart + dmaSz)
+		return Z64DEC_ERR_ARG;
+
+	/* transfer files from comp to dec */
+	for (i = 0; i < table->num; ++i)
+	{
+		const struct dmaEntry *e = &table->entry[i];
+		Codec codec;
+		int err;
+
+		/* unused or invalid entry */
+		if (!e->valid)
+			continue;
+
+		if (e->Vstart > dstSz)
+			return Z64DEC_ERR_SPACE;
+
+		err = decode_entry(rom, &rom->reader, i, dec + e->Vstart, dstSz - e->Vstart, &codec);
+		if (err)
+			return err;
+
+		if (codec != CODEC_NONE)
+			rom->lastCodec = codec;
+	}
+
+	/* copy modified dmadata to decompressed rom */
+	memcpy(dec + dmaStart, table->patched, dmaSz);
+
+	/* update crc */
+	if (dstSz >= Z64DEC_CRC_EXTENT)
+		z64dec_rom_crc(rom, dec, dstSz);
+
+	return Z64DEC_OK;
+}
+
+/* a compressed rom in memory, some of whose files' compressed data has been
+ * moved elsewhere so that it isn't overwritten by decompressed files */
+struct inplace
+{
+	const unsigned char  *rom;
+	const unsigned char **moved;   /* per dma entry; NULL if not moved */
+	const size_t         *ofs;     /* rom offset of each entry's data  */
+	const size_t         *size;
+	int                   index;   /* entry being decompressed, or -1  */
+};
+
+/* `read` for a rom being decompressed in place */
+static size_t inplace_read(void *udata, size_t ofs, void *dst, size_t len)
+{
+	const struct inplace *in = udata;
+	unsigned char *out = dst;
+	int i = in->index;
+	size_t lo;
+	size_t hi;
+
+	if (i < 0 || !in->moved[i])
+	{
+		memcpy(dst, in->rom + ofs, len);
+		return len;
+	}
+
+	/* the part of [ofs, ofs + len) that was moved */
+	lo = ofs > in->ofs[i] ? ofs : in->ofs[i];
+	hi = ofs + len < in->ofs[i] + in->size[i] ? ofs + len : in->ofs[i] + in->size[i];
+	if (lo >= hi)
+	{
+		memcpy(dst, in->rom + ofs, len);
+		return len;
+	}
+
+	memcpy(out, in->rom + ofs, lo - ofs);
+	memcpy(out + (lo - ofs), in->moved[i] + (lo - in->ofs[i]), hi - lo);
+	memcpy(out + (hi - ofs), in->rom + hi, ofs + len - hi);
+
+	return len;
+}
+
+/* dma entries in order of an address */
+struct inplace_order
+{
+	size_t   addr;
+	int      index;
+};
+
+/* by ascending address */
+static int inplace_ascending(const void *a, const void *b)
+{
+	const struct inplace_order *oa = a;
+	const struct inplace_order *ob = b;
+
+	if (oa->addr != ob->addr)
+		return oa->addr < ob->addr ? -1 : 1;
+
+	return oa->index - ob->index;
+}
+
+/* by descending address */
+static int inplace_descending(const void *a, const void *b)
+{
+	return inplace_ascending(b, a);
+}
+
+/* decompress an entire rom within the buffer holding it */
+int z64dec_rom_decode_inplace(z64dec_rom *rom, void *buf, size_t bufSz)
+{
+	const struct dmaTable *table = &rom->table;
+	unsigned char *dec = buf;
+	size_t dmaStart = table->start;
+	size_t dmaSz = table->end - table->start;
+	size_t romSz = rom->reader.size;
+	struct inplace_order *order;
+	const unsigned char **moved;
+	struct decreader reader;
+	struct inplace in;
+	size_t *ofs;
+	size_t *size;
+	size_t end;
+	int last = -1;
+	int count = 0;
+	int err = Z64DEC_OK;
+	int i;
+	int k;
+
+	if (!buf || bufSz < romSz || bufSz < dmaStart + dmaSz)
+		return Z64DEC_ERR_ARG;
+
+	order = malloc(sizeof(*order) * (table->num + 1));
+	moved = calloc(table->num + 1, sizeof(*moved));
+	ofs = malloc(sizeof(*ofs) * (table->num + 1));
+	size = malloc(sizeof(*size) * (table->num + 1));
+	if (!order || !moved || !ofs || !size)
+	{
+		err = Z64DEC_ERR_NOMEM;
+		goto L_cleanup;
+	}
+
+	in.rom = buf;
+	in.moved = moved;
+	in.ofs = ofs;
+	in.size = size;
+	in.index = -1;
+	reader = rom->reader;
+	reader.read = inplace_read;
+	reader.udata = &in;
+
+	/* where each file's data lies, checked before anything is overwritten */
+	for (i = 0; i < table->num; ++i)
+	{
+		const struct dmaEntry *e = &table->entry[i];
+
+		if (!e->valid)
+			continue;
+
+		if (e->Vstart > bufSz)
+		{
+			err = Z64DEC_ERR_SPACE;
+			goto L_cleanup;
+		}
+
+		if ((err = dma_extent(table, i, &reader, &ofs[i], &size[i])))
+			goto L_cleanup;
+
+		order[count].addr = ofs[i];
+		order[count].index = i;
+		++count;
+	}
+
+	/* dmaext doesn't record compressed sizes, so a file is taken to end
+	 * where the next one in the rom begins */
+	if (table->ext)
+	{
+		qsort(order, count, sizeof(*order), inplace_ascending);
+		for (k = 0; k + 1 < count; ++k)
+		{
+			i = order[k].index;
+			if (order[k + 1].addr > ofs[i] && order[k + 1].addr < ofs[i] + size[i])
+				size[i] = order[k + 1].addr - ofs[i];
+		}
+	}
+
+	/* the files were packed in order of virtual address, and compressed
+	 * files are smaller than they were, so working back from the end of
+	 * the rom overwrites only the data of files that are already done */
+	for (k = 0; k < count; ++k)
+		order[k].addr = table->entry[order[k].index].Vstart;
+	qsort(order, count, sizeof(*order), inplace_descending);
+
+	for (k = 0; k < count; ++k)
+	{
+		const struct dmaEntry *e = &table->entry[order[k].index];
+		size_t lo = e->Vstart;
+		size_t hi = e->Vend;
+		Codec codec;
+		int j;
+
+		/* move the data of the files yet to be done (this one included)
+		 * that this one would overwrite out of its way */
+		for (j = k; j < count; ++j)
+		{
+			int index = order[j].index;
+			unsigned char *copy;
+
+			/* an empty file has nothing to move */
+			if (moved[index] || !size[index] || ofs[index] >= hi || ofs[index] + size[index] <= lo)
+				continue;
+
+			if (!(copy = malloc(size[index])))
+			{
+				err = Z64DEC_ERR_NOMEM;
+				goto L_cleanup;
+			}
+			memcpy(copy, dec + ofs[index], size[index]);
+			moved[index] = copy;
+		}
+
+		in.index = order[k].index;
+		err = decode_entry(rom, &reader, order[k].index, dec + e->Vstart, bufSz - e->Vstart, &codec);
+		free((void*)moved[order[k].index]);
+		moved[order[k].index] = NULL;
+		if (err)
+			goto L_cleanup;
+
+		if (codec != CODEC_NONE && order[k].index > last)
+		{
+			rom->lastCodec = codec;
+			last = order[k].index;
+		}
+	}
+
+	/* what no file covers is zero, as in a fresh buffer */
+	for (end = 0, k = count - 1; k >= 0; --k)
+	{
+		const struct dmaEntry *e = &table->entry[order[k].index];
+
+		if (e->Vstart > end)
+			memset(dec + end, 0, e->Vstart - end);
+		if (e->Vend > end)
+			end = e->Vend;
+	}
+	if (end < bufSz)
+		memset(dec + end, 0, bufSz - end);
+
+	/* copy modified dmadata to decompressed rom */
+	memcpy(dec + dmaStart, table->patched, dmaSz);
+
+	/* update crc */
+	if (bufSz >= Z64DEC_CRC_EXTENT)
+		z64dec_rom_crc(rom, dec, bufSz);
+
+L_cleanup:
+	if (moved)
+		for (i = 0; i < table->num; ++i)
+			free((void*)moved[i]);
+	free(order);
+	free(moved);
+	free(ofs);
+	free(size);
+
+	return err;
+}
+
+/* the patched dmadata of a rom */
+const void *z64dec_rom_dmadata(const z64dec_rom *rom, size_t *size)
+{
+	*size = rom->table.end - rom->table.start;
+
+	return rom->table.patched;
+}
+
+/* update the crc in the header of a decompressed rom */
+int z64dec_rom_crc(const z64dec_rom *rom, void *dst, size_t size)
+{
+	if (!dst || size < Z64DEC_CRC_EXTENT)
+		return Z64DEC_ERR_ARG;
+
+	PROBE0(crc__start);
+	if (rom->events)
+		emit(rom, Z64DEC_EVENT_CRC_BEGIN, -1, CODEC_NONE, Z64DEC_OK, 0);
+	n64crc(dst);
+	if (rom->events)
+		emit(rom, Z64DEC_EVENT_CRC_END, -1, CODEC_NONE, Z64DEC_OK, Z64DEC_CRC_EXTENT);
+	PROBE0(crc__done);
+
+	return Z64DEC_OK;
+}
+
+/* tally the tokens of dma entry `index` by decoding it with a stream */
+int z64dec_rom_profile(const z64dec_rom *rom, int index, struct z64dec_profile *profile, int *codec)
+{
+	unsigned char in[4096];
+	unsigned char out[16384];
+	struct decreader file;
+	z64dec_stream *stream;
+	size_t pos = 0;
+	int err;
+
+	if (codec)
+		*codec = CODEC_NONE;
+
+	if (!profile)
+		return Z64DEC_ERR_ARG;
+
+	if (index < 0 || index >= rom->table.num)
+		return Z64DEC_ERR_ENTRY;
+
+	/* files that aren't compressed have no tokens */
+	if ((err = dma_source(&rom->table, index, &rom->reader, &file)))
+		return err == Z64DEC_ERR_CODEC ? Z64DEC_OK : err;
+
+	if ((err = z64dec_stream_open(&stream, rom->codec, rom->table.headerless && !rom->table.ext)))
+		return err;
+	z64dec_stream_set_profile(stream, profile);
+
+	/* the decompressed data is discarded */
+	do
+	{
+		size_t n = file.size - pos;
+		size_t inUsed;
+		size_t outUsed;
+
+		if (n > sizeof(in))
+			n = sizeof(in);
+		if (decreader_fill(&file, pos, in, n))
+		{
+			err = Z64DEC_ERR_READ;
+			break;
+		}
+
+		err = z64dec_stream_decode(stream, in, n, &inUsed, out, sizeof(out), &outUsed);
+		pos += inUsed;
+
+		/* the file ended early */
+		if (err == Z64DEC_MORE && !inUsed && !outUsed)
+			err = Z64DEC_ERR_DATA;
+	} while (err == Z64DEC_MORE);
+
+	if (codec)
+		z64dec_stream_info(stream, codec, NULL);
+	z64dec_stream_close(stream);
+
+	return err;
+}
+
+/* have `func` called as each step of decompressing a rom begins and ends */
+void z64dec_rom_set_events(z64dec_rom *rom, z64dec_event_func func, void *udata)
+{
+	rom->events = func;
+	rom->eventsUdata = udata;
+}
+
+/* begin decompressing a file incrementally */
+int z64dec_stream_open(z64dec_stream **stream, int codec, int headerless)
+{
+	z64dec_stream *s;
+
+	if (!stream)
+		return Z64DEC_ERR_ARG;
+
+	*stream = NULL;
+
+	if (codec < CODEC_NONE || codec >= CODEC_MAX)
+		return Z64DEC_ERR_ARG;
+
+	/* without a header, yaz doesn't know where to stop, and ucl and
+	 * aplib don't know how large a window they need */
+	if (headerless && (codec == CODEC_NONE || codec == CODEC_YAZ0
+		|| codec == CODEC_UCL || codec == CODEC_APLIB)
+	)
+		return Z64DEC_ERR_ARG;
+
+	if (!(s = calloc(1, sizeof(*s))))
+		return Z64DEC_ERR_NOMEM;
+
+	s->codec = codec;
+	s->headerless = headerless;
+
+	*stream = s;
+
+	return Z64DEC_OK;
+}
+
+/* free a stream */
+void z64dec_stream_close(z64dec_stream *stream)
+{
+	if (!stream)
+		return;
+
+	free(stream->dec.win);
+	if (stream->started && stream->codec == CODEC_ZLIB)
+		free(stream->dec.u.zlib.state);
+	free(stream);
+}
+
+/* header size of a stream's files (yaz's is padded to 16 bytes) */
+static unsigned stream_header_size(const z64dec_stream *s)
+{
+	if (s->headerless)
+		return 0;
+
+	if (s->codec == CODEC_YAZ0
+		|| (s->codec == CODEC_NONE && s->headerSz >= 4
+			&& get_codec_type_from_header(s->header) == CODEC_YAZ0)
+	)
+		return 16;
+
+	return 8;
+}
+
+/* the header has been read: pick the codec, and allocate the window */
+static int stream_start(z64dec_stream *s)
+{
+	struct decstream *dec = &s->dec;
+	unsigned window;
+
+	if (!s->headerless)
+	{
+		s->codec = pick_codec(s->header, s->codec);
+		if (s->codec == CODEC_NONE)
+			return Z64DEC_ERR_CODEC;
+		dec->size = beU32(s->header + 4);
+	}
+
+	/* the window needn't be larger than the file, nor the most distant
+	 * back reference the codec allows, and must be a power of two */
+	window = decCodecInfo[s->codec].window;
+	if (dec->size && (!window || dec->size < window))
+		window = dec->size;
+	for (dec->mask = 1; dec->mask < window; dec->mask <<= 1)
+		if (!dec->mask)
+			return Z64DEC_ERR_NOMEM;
+	dec->mask -= 1;
+
+	if (!(dec->win = malloc(dec->mask + 1)))
+		return Z64DEC_ERR_NOMEM;
+
+	if (s->codec == CODEC_ZLIB
+		&& !(dec->u.zlib.state = calloc(1, zlibstream_state_size()))
+	)
+		return Z64DEC_ERR_NOMEM;
+
+	s->started = 1;
+
+	return Z64DEC_OK;
+}
+
+/* decompress a chunk of a stream */
+int z64dec_stream_decode(z64dec_stream *stream, const void *in, size_t inSz, size_t *inUsed, void *out, size_t outSz, size_t *outUsed)
+{
+	struct decstream *dec;
+	const unsigned char *src = in;
+	size_t used = 0;
+	int err = Z64DEC_MORE;
+
+	if (inUsed)
+		*inUsed = 0;
+	if (outUsed)
+		*outUsed = 0;
+
+	if (!stream || (!in && inSz) || (!out && outSz))
+		return Z64DEC_ERR_ARG;
+
+	if (stream->done)
+		return Z64DEC_OK;
+
+	dec = &stream->dec;
+
+	/* collect the header */
+	while (!stream->started)
+	{
+		unsigned want = stream_header_size(stream);
+
+		if (stream->headerSz == want)
+		{
+			int startErr = stream_start(stream);
+
+			if (startErr)
+				return startErr;
+			break;
+		}
+
+		if (used == inSz)
+		{
+			if (inUsed)
+				*inUsed = used;
+			return Z64DEC_MORE;
+		}
+
+		/* a byte at a time, as yaz's header is larger once detected */
+		stream->header[stream->headerSz++] = src[used++];
+	}
+
+	dec->in = src ? src + used : 0;
+	dec->in_end = src ? src + inSz : 0;
+	dec->out = out;
+	dec->out_end = out ? dec->out + outSz : 0;
+
+	switch (decCodecInfo[stream->codec].stream(dec))
+	{
+		case DECSTREAM_DONE:
+			stream->done = 1;
+			if (dec->profile)
+				decstream_tally_end(dec);
+			err = Z64DEC_OK;
+			break;
+
+		case DECSTREAM_ERROR:
+			err = Z64DEC_ERR_DATA;
+			break;
+	}
+
+	if (inUsed)
+		*inUsed = dec->in ? (size_t)(dec->in - src) : 0;
+	if (outUsed)
+		*outUsed = dec->out - (unsigned char*)out;
+
+	return err;
+}
+
+/* tally the tokens of a stream as they are decoded */
+void z64dec_stream_set_profile(z64dec_stream *stream, struct z64dec_profile *profile)
+{
+	stream->dec.profile = profile;
+}
+
+/* get the codec and decompressed size of a stream */
+void z64dec_stream_info(const z64dec_stream *stream, int *codec, size_t *size)
+{
+	if (codec)
+		*codec = stream->started ? stream->codec : CODEC_NONE;
+	if (size)
+		*size = stream->dec.size;
+}
@@ -0,0 +1,277 @@
+/*
+ * z64decompress.h <z64.me>
+ *
+ * libz64decompress: decompress zelda 64 roms and files in memory, or
+ * read piece by piece through a callback
+ *
+ * Every function that can fail returns Z64DEC_OK (zero) on success,
+ * or one of the Z64DEC_ERR_* codes; z64dec_strerror() describes them.
+ * z64dec_stream_decode() may also return Z64DEC_MORE.
+ * Input buffers are never modified.
+ *
+ */
+
+#ifndef Z64DECOMPRESS_H_INCLUDED
+#define Z64DECOMPRESS_H_INCLUDED
+
+#include <stddef.h> /* size_t */
+
+#if defined(Z64DEC_BUILD) && defined(__GNUC__) && !defined(_WIN32)
+ #define Z64DEC_API __attribute__((visibility("default")))
+#else
+ #define Z64DEC_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* error codes */
+enum z64dec_error
+{
+	Z64DEC_MORE = -1,      /* stream isn't finished (not an error) */
+	Z64DEC_OK = 0,
+	Z64DEC_ERR_ARG,        /* invalid argument                     */
+	Z64DEC_ERR_NOMEM,      /* memory allocation failed             */
+	Z64DEC_ERR_NODMA,      /* failed to locate dmadata in rom      */
+	Z64DEC_ERR_CODEC,      /* compressed file, unknown encoding    */
+	Z64DEC_ERR_NEEDCODEC,  /* dmaext requires a codec              */
+	Z64DEC_ERR_ENTRY,      /* no such dma entry, or entry unused   */
+	Z64DEC_ERR_RANGE,      /* file lies outside of the rom         */
+	Z64DEC_ERR_SPACE,      /* destination buffer is too small      */
+	Z64DEC_ERR_DATA,       /* corrupt compressed data              */
+	Z64DEC_ERR_READ,       /* a z64dec_reader's read failed        */
+	Z64DEC_ERR_MAX
+};
+
+/* codecs */
+enum z64dec_codec
+{
+	Z64DEC_CODEC_AUTO = -1, /* detect codec from each file's header */
+	Z64DEC_CODEC_YAZ,
+	Z64DEC_CODEC_LZO,
+	Z64DEC_CODEC_UCL,
+	Z64DEC_CODEC_APLIB,
+	Z64DEC_CODEC_ZLIB,
+	Z64DEC_CODEC_MAX
+};
+
+/* how a rom is to be decompressed; zero-initialize, then set codec */
+struct z64dec_options
+{
+	int codec;             /* Z64DEC_CODEC_AUTO, or codec to force */
+	int headerless;        /* files don't have standard 8b header  */
+	int dmaext;            /* rom uses the ZZRTL dmaext hack       */
+};
+
+/* a file described by dmadata */
+struct z64dec_entry
+{
+	unsigned vstart;       /* virtual addresses (decompressed rom) */
+	unsigned vend;
+	unsigned pstart;       /* physical addresses (compressed rom)  */
+	unsigned pend;         /* zero if unknown or uncompressed      */
+	int      compressed;   /* non-zero if file is compressed       */
+	int      valid;        /* zero if unused or invalid entry      */
+};
+
+/* information about an opened rom */
+struct z64dec_info
+{
+	size_t   size;         /* size of the decompressed rom         */
+	unsigned dmadata;      /* offset of dmadata within the rom     */
+	int      entries;      /* number of dma entries                */
+	int      iQue;         /* non-zero if iQue edition             */
+	int      headerless;   /* non-zero if files lack 8b header     */
+	int      codec;        /* codec used by the last compressed    *
+	                        * file z64dec_rom_decode() processed   */
+};
+
+/* copy up to `len` bytes at offset `ofs` of a rom or file into `dst`,
+ * returning how many bytes were copied; it may be called from several
+ * threads at once if z64dec_rom_decode_entry() is */
+typedef size_t (*z64dec_read_func)(void *udata, size_t ofs, void *dst, size_t len);
+
+/* a rom or file that isn't in memory; only a refill buffer of `bufSz`
+ * bytes is needed to decompress each of its files, which can make many
+ * small reads or a few large ones */
+struct z64dec_reader
+{
+	z64dec_read_func read;
+	void    *udata;        /* passed to `read`                     */
+	size_t   size;         /* size of the rom or file              */
+	unsigned bufSz;        /* refill buffer size (0 = 1 KiB, and   *
+	                        * at least 512 bytes are used)         */
+};
+
+/* steps of decompressing a rom, reported to a z64dec_event_func */
+enum z64dec_event_type
+{
+	Z64DEC_EVENT_ENTRY_BEGIN,  /* a dma entry is about to be decompressed */
+	Z64DEC_EVENT_ENTRY_END,    /* and has been                            */
+	Z64DEC_EVENT_CRC_BEGIN,    /* the rom's crc is about to be updated    */
+	Z64DEC_EVENT_CRC_END,      /* and has been                            */
+};
+
+/* a step that has begun or ended */
+struct z64dec_event
+{
+	int      type;         /* Z64DEC_EVENT_*                       */
+	int      index;        /* dma entry, or -1                     */
+	int      codec;        /* ENTRY_END: codec used, or            *
+	                        * Z64DEC_CODEC_AUTO if it was copied   */
+	int      error;        /* ENTRY_END: Z64DEC_OK or an error     */
+	size_t   size;         /* ENTRY_END: bytes of decompressed     *
+	                        * data (vend - vstart)                 */
+};
+
+typedef void (*z64dec_event_func)(void *udata, const struct z64dec_event *event);
+
+/* the rom header's crc covers this many bytes from the start of the rom */
+#define Z64DEC_CRC_EXTENT 0x101000
+
+/* lengths and distances are tallied in power-of-two buckets: bucket 0
+ * counts values of 1, bucket 1 values of 2-3, bucket 2 values of 4-7,
+ * and so on, with the last also counting everything larger */
+#define Z64DEC_PROFILE_BUCKETS 24
+
+/* the tokens found in compressed data, added to by z64dec_rom_profile()
+ * and streams given to z64dec_stream_set_profile() */
+struct z64dec_profile
+{
+	unsigned long files;
+	unsigned long literals;     /* bytes decoded as literals            */
+	unsigned long matches;      /* back references                      */
+	unsigned long matchBytes;   /* bytes copied by them                 */
+	unsigned long literalRuns[Z64DEC_PROFILE_BUCKETS];    /* literals   *
+	                             * between back references              */
+	unsigned long matchLengths[Z64DEC_PROFILE_BUCKETS];
+	unsigned long matchDistances[Z64DEC_PROFILE_BUCKETS];
+	
+	/* zlib only */
+	unsigned long blocks[3];    /* stored, fixed, and dynamic blocks    */
+	unsigned long storedBytes;  /* bytes in stored blocks               */
+	unsigned long literalCodes[16];   /* literal/length and distance    */
+	unsigned long distanceCodes[16];  /* codes of each bit length, in   *
+	                                   * dynamic blocks (0 = unused)    */
+};
+
+typedef struct z64dec_rom z64dec_rom;
+typedef struct z64dec_stream z64dec_stream;
+
+/* describe an error code */
+Z64DEC_API const char *z64dec_strerror(int error);
+
+/* get codec by name ("yaz", "lzo", "ucl", "aplib", "zlib");
+ * returns Z64DEC_CODEC_AUTO if the name is unknown */
+Z64DEC_API int z64dec_codec_from_name(const char *name);
+
+/* get the name of a codec */
+Z64DEC_API const char *z64dec_codec_name(int codec);
+
+/* decompress a single compressed file; *decSz receives its size */
+Z64DEC_API int z64dec_file(const void *src, size_t srcSz, void *dst, size_t dstSz, size_t *decSz, int codec);
+
+/* get the decompressed size of a single compressed file from its
+ * header; returns Z64DEC_ERR_CODEC if it has no codec header */
+Z64DEC_API int z64dec_file_size(const void *src, size_t srcSz, size_t *decSz);
+
+/* room to decompress a file into when z64dec_file_size() can't tell its
+ * size, as when its codec has to be given because its header isn't
+ * recognized */
+#define Z64DEC_FILE_MAX (1024 * 1024 * 8)
+
+/* decompress a single compressed file read through `reader` */
+Z64DEC_API int z64dec_file_read(const struct z64dec_reader *reader, void *dst, size_t dstSz, size_t *decSz, int codec);
+
+/* locate dmadata in a rom; `data` must remain valid until the rom is
+ * closed; `options` may be NULL to use the defaults */
+Z64DEC_API int z64dec_rom_open(z64dec_rom **rom, const void *data, size_t size, const struct z64dec_options *options);
+
+/* locate dmadata in a rom read through `reader`, which is copied; its
+ * udata must remain valid until the rom is closed */
+Z64DEC_API int z64dec_rom_open_reader(z64dec_rom **rom, const struct z64dec_reader *reader, const struct z64dec_options *options);
+
+/* free an opened rom */
+Z64DEC_API void z64dec_rom_close(z64dec_rom *rom);
+
+/* get information about an opened rom */
+Z64DEC_API void z64dec_rom_info(const z64dec_rom *rom, struct z64dec_info *info);
+
+/* get dma entry `index`, in range [0, info.entries) */
+Z64DEC_API int z64dec_rom_entry(const z64dec_rom *rom, int index, struct z64dec_entry *entry);
+
+/* find the valid dma entry containing a virtual address;
+ * returns its index, or -1 if there is none */
+Z64DEC_API int z64dec_rom_lookup(const z64dec_rom *rom, unsigned vaddr);
+
+/* decompress dma entry `index` into dst, which must hold at least
+ * vend - vstart bytes; *codec (if not NULL) receives the codec used,
+ * or Z64DEC_CODEC_AUTO if the file wasn't compressed; this can be
+ * called from several threads at once */
+Z64DEC_API int z64dec_rom_decode_entry(const z64dec_rom *rom, int index, void *dst, size_t dstSz, int *codec);
+
+/* decompress an entire rom into dst, which must hold info.size bytes
+ * and be zero-filled (areas not covered by any file are left as-is) */
+Z64DEC_API int z64dec_rom_decode(z64dec_rom *rom, void *dst, size_t dstSz);
+
+/* decompress an entire rom within buf, which holds the compressed rom
+ * the rom was opened on (read through a reader, or a copy of it) at its
+ * start and has room for at least info.size bytes; files are decompressed
+ * from the end of the rom back, and only the compressed data that would
+ * be overwritten before it's used is copied out of the way */
+Z64DEC_API int z64dec_rom_decode_inplace(z64dec_rom *rom, void *buf, size_t bufSz);
+
+/* the dmadata z64dec_rom_decode() writes at info.dmadata, with each
+ * entry patched to describe the decompressed file; for assembling a
+ * decompressed rom a file at a time, *size receives its size */
+Z64DEC_API const void *z64dec_rom_dmadata(const z64dec_rom *rom, size_t *size);
+
+/* update the crc in the header of a decompressed rom, given its first
+ * `size` bytes, of which there must be at least Z64DEC_CRC_EXTENT;
+ * z64dec_rom_decode() does this itself */
+Z64DEC_API int z64dec_rom_crc(const z64dec_rom *rom, void *dst, size_t size);
+
+/* tally the tokens of dma entry `index` in *profile, by decoding it
+ * with a stream (which is slower than z64dec_rom_decode_entry()); *codec
+ * (if not NULL) receives the codec used, or Z64DEC_CODEC_AUTO if the
+ * file isn't compressed, in which case nothing is tallied */
+Z64DEC_API int z64dec_rom_profile(const z64dec_rom *rom, int index, struct z64dec_profile *profile, int *codec);
+
+/* have `func` called as each step of decompressing a rom begins and
+ * ends, on the thread taking it (NULL to stop); it must be thread-safe
+ * if z64dec_rom_decode_entry() is called from several threads at once,
+ * but an entry's BEGIN and END always come from the same thread, and no
+ * two threads decompress the same entry, so state kept per entry needs
+ * no lock; only state shared between entries does */
+Z64DEC_API void z64dec_rom_set_events(z64dec_rom *rom, z64dec_event_func func, void *udata);
+
+/* begin decompressing a file incrementally, so neither it nor its
+ * decompressed data needs to be in memory at once; `codec` may be
+ * Z64DEC_CODEC_AUTO to detect it from the file's header; headerless
+ * files must name their codec, which can't be yaz, ucl, or aplib */
+Z64DEC_API int z64dec_stream_open(z64dec_stream **stream, int codec, int headerless);
+
+/* free a stream */
+Z64DEC_API void z64dec_stream_close(z64dec_stream *stream);
+
+/* decompress up to inSz bytes of compressed data from `in` into up to
+ * outSz bytes of `out`; *inUsed and *outUsed receive how many bytes
+ * of each were consumed (unconsumed input must be provided again);
+ * returns Z64DEC_MORE until the end of the file has been reached and
+ * all of its data output, then Z64DEC_OK (trailing input is ignored) */
+Z64DEC_API int z64dec_stream_decode(z64dec_stream *stream, const void *in, size_t inSz, size_t *inUsed, void *out, size_t outSz, size_t *outUsed);
+
+/* tally the tokens of a stream in *profile as they are decoded (NULL to
+ * stop); this must be set before its first z64dec_stream_decode() */
+Z64DEC_API void z64dec_stream_set_profile(z64dec_stream *stream, struct z64dec_profile *profile);
+
+/* get the codec and decompressed size of a stream, once its header has
+ * been consumed (Z64DEC_CODEC_AUTO and 0 until then, or if headerless) */
+Z64DEC_API void z64dec_stream_info(const z64dec_stream *stream, int *codec, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* Z64DECOMPRESS_H_INCLUDED */